@@ -413,6 +413,9 @@ void Port::updateStats(OstProto::PortStats *portStats)
     OstProto::PortState        oldState;
 
     oldState = stats.state(); 
+    // MergeFrom() appends repeated fields - so replace those instead
+    if (portStats->window_rates_size())
+        stats.clear_window_rates();
     stats.MergeFrom(*portStats);
 
     if (oldState.link_state() != stats.state().link_state())
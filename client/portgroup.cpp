@@ -47,6 +47,7 @@ PortGroup::PortGroup(QHostAddress ip, quint16 port)
 
     statsController = new PbRpcController(portIdList_, portStatsList_);
     isGetStatsPending_ = false;
+    isStatsSubscribed_ = false;
 
     compat = kUnknown;
 
@@ -70,6 +71,8 @@ PortGroup::PortGroup(QHostAddress ip, quint16 port)
         this, SLOT(on_rpcChannel_disconnected()));
     connect(rpcChannel, SIGNAL(error(QAbstractSocket::SocketError)), 
         this, SLOT(on_rpcChannel_error(QAbstractSocket::SocketError)));
+    connect(rpcChannel, SIGNAL(notification(int, QByteArray)), 
+        this, SLOT(on_rpcChannel_notification(int, QByteArray)));
 
     connect(this, SIGNAL(portListChanged(quint32)),
         this, SLOT(when_portListChanged(quint32)), Qt::QueuedConnection);
@@ -126,6 +129,7 @@ void PortGroup::on_rpcChannel_connected()
 
     qDebug("requesting version check ...");
     verInfo->set_version(version);
+    verInfo->set_max_pending_rpcs(PB_MAX_PENDING_RPCS);
     
     PbRpcController *controller = new PbRpcController(verInfo, verCompat);
     serviceStub->checkVersion(controller, verInfo, verCompat, 
@@ -159,6 +163,10 @@ void PortGroup::processVersionCompatibility(PbRpcController *controller)
 
     compat = kCompatible;
 
+    // Older drones don't pipeline RPCs - one RPC at a time for those
+    if (verCompat->max_pending_rpcs() > 1)
+        rpcChannel->setMaxPendingRpcs(verCompat->max_pending_rpcs());
+
     {
         OstProto::Void *void_ = new OstProto::Void;
         OstProto::PortIdList *portIdList = new OstProto::PortIdList;
@@ -185,6 +193,7 @@ void PortGroup::on_rpcChannel_disconnected()
     emit portGroupDataChanged(mPortGroupId);
 
     isGetStatsPending_ = false;
+    isStatsSubscribed_ = false;
 
     if (reconnect)
     {
@@ -313,6 +322,10 @@ void PortGroup::processPortConfigList(PbRpcController *controller)
     if (numPorts() > 0)
         getStreamIdList();
 
+    // Stats are pushed once the ports are known (to update)
+    if (!isStatsSubscribed_)
+        subscribeStats();
+
 _error_exit:
     delete controller;
 }
@@ -819,6 +832,10 @@ void PortGroup::getPortStats()
     if (isGetStatsPending_)
         goto _exit;
 
+    // Drone pushes the stats - no need to poll
+    if (isStatsSubscribed_)
+        goto _exit;
+
     statsController->Reset();
     isGetStatsPending_ = true;
     serviceStub->getStats(statsController, 
@@ -841,17 +858,76 @@ void PortGroup::processPortStatsList()
         goto _error_exit;
     }
 
-    for(int i = 0; i < portStatsList_->port_stats_size(); i++)
+    updatePortStats(portStatsList_);
+
+_error_exit:
+    isGetStatsPending_ = false;
+}
+
+void PortGroup::updatePortStats(OstProto::PortStatsList *portStatsList)
+{
+    for(int i = 0; i < portStatsList->port_stats_size(); i++)
     {
-        uint id = portStatsList_->port_stats(i).port_id().id();
+        uint id = portStatsList->port_stats(i).port_id().id();
         // FIXME: don't mix port id & index into mPorts[]
-        mPorts[id]->updateStats(portStatsList_->mutable_port_stats(i));
+        if (id >= uint(mPorts.size()))
+            continue;
+        mPorts[id]->updateStats(portStatsList->mutable_port_stats(i));
     }
 
     emit statsChanged(mPortGroupId);
+}
 
-_error_exit:
-    isGetStatsPending_ = false;
+void PortGroup::subscribeStats()
+{
+    OstProto::StatsSubscription *subscription = new OstProto::StatsSubscription;
+    OstProto::Ack *ack = new OstProto::Ack;
+    PbRpcController *controller = new PbRpcController(subscription, ack);
+
+    qDebug("In %s", __FUNCTION__);
+
+    subscription->set_interval_msec(kStatsInterval);
+    serviceStub->subscribeStats(controller, subscription, ack,
+        NewCallback(this, &PortGroup::processStatsSubscriptionAck, controller));
+}
+
+void PortGroup::processStatsSubscriptionAck(PbRpcController *controller)
+{
+    qDebug("In %s", __FUNCTION__);
+
+    // Older drones don't push stats - keep polling those
+    if (controller->Failed())
+    {
+        qDebug("%s: rpc failed(%s); polling stats instead", __FUNCTION__, 
+                qPrintable(controller->ErrorString()));
+        goto _exit;
+    }
+
+    isStatsSubscribed_ = true;
+
+_exit:
+    delete controller;
+}
+
+void PortGroup::on_rpcChannel_notification(int methodId, QByteArray msg)
+{
+    OstProto::PortStatsList portStatsList;
+
+    if (methodId != OstProto::OstService::descriptor()->FindMethodByName(
+                "subscribeStats")->index())
+    {
+        qDebug("%s: unexpected notification for method %d", __FUNCTION__,
+                methodId);
+        return;
+    }
+
+    if (!portStatsList.ParseFromArray(msg.constData(), msg.size()))
+    {
+        qWarning("%s: unable to parse pushed stats", __FUNCTION__);
+        return;
+    }
+
+    updatePortStats(&portStatsList);
 }
 
 void PortGroup::clearPortStats(QList<uint> *portList)
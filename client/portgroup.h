@@ -56,6 +56,8 @@ private:
     PbRpcChannel    *rpcChannel;
     PbRpcController *statsController;
     bool            isGetStatsPending_;
+    bool            isStatsSubscribed_;
+    static const int kStatsInterval = 1000; // ms
 
     OstProto::OstService::Stub *serviceStub;
 
@@ -131,6 +133,9 @@ public:
 
     void getPortStats();
     void processPortStatsList();
+    void updatePortStats(OstProto::PortStatsList *portStatsList);
+    void subscribeStats();
+    void processStatsSubscriptionAck(PbRpcController *controller);
     void clearPortStats(QList<uint> *portList = NULL);
     void processClearStatsAck(PbRpcController *controller);
 
@@ -146,6 +151,7 @@ private slots:
     void on_rpcChannel_connected();
     void on_rpcChannel_disconnected();
     void on_rpcChannel_error(QAbstractSocket::SocketError socketError);
+    void on_rpcChannel_notification(int methodId, QByteArray msg);
 
     void when_portListChanged(quint32 portGroupId);
 
@@ -175,7 +175,6 @@ StreamConfigDialog::StreamConfigDialog(Port &port, uint streamIndex,
     {
     case OstProto::kSequentialTransmit:
         rbModeFixed->setChecked(true);
-        rbModeContinuous->setDisabled(true);
         break;
     case OstProto::kInterleavedTransmit:
         rbModeContinuous->setChecked(true);
@@ -54,6 +54,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
   - protocolId()
   - protocolFrameSize()
   - isProtocolFrameValueVariable()
+  - isProtocolFrameValueRandom()
   - isProtocolFrameSizeVariable()
   - protocolFrameVariableCount()
 
@@ -558,6 +559,20 @@ bool AbstractProtocol::isProtocolFrameValueVariable() const
     return (protocolFrameVariableCount() > 1);
 }
 
+/*!
+  Returns true if the protocol varies one or more of its fields randomly,
+  false otherwise - frames of such a protocol are not repeatable and so
+  should not be cached and reused
+
+  The default implementation returns false. A subclass should reimplement
+  if it has randomly varying fields e.g. an IP protocol with random host
+  addresses
+*/
+bool AbstractProtocol::isProtocolFrameValueRandom() const
+{
+    return false;
+}
+
 /*!
   Returns true if the protocol varies its size at run-time, false otherwise
 
@@ -660,6 +675,68 @@ int AbstractProtocol::protocolFramePayloadVariableCount() const
     return false;
 }
 
+/*!
+  Describes how the protocol's frame value for any frame index can be derived
+  from its frame value for frame index 0 by patching fields and checksums.
+  Field and checksum offsets are relative to the start of the frame
+
+  Returns false if the protocol's frame value can not be described this way
+  in which case frames must be generated using protocolFrameValue()
+
+  The default implementation returns true (with no patches) only if the
+  protocol has no varying fields. A subclass with varying fields should
+  reimplement if its fields vary in the ways described by FieldPatch e.g. an
+  IP protocol that increments/decrements the IP address with every packet.
+  A subclass with a checksum that covers a varying field of another protocol
+  (e.g. TCP/UDP) should reimplement to append a CksumPatch for it
+*/
+bool AbstractProtocol::protocolFramePatches(QList<FieldPatch> &/*fields*/,
+    QList<CksumPatch> &/*cksums*/) const
+{
+    return !isProtocolFrameValueVariable();
+}
+
+/*!
+  Appends the (offset, length) byte ranges of the protocol's varying fields
+  that are part of its CksumIpPseudo checksum
+
+  Returns false if these ranges can not be described
+
+  The default implementation returns true (with no ranges) only if the
+  protocol has no varying fields
+*/
+bool AbstractProtocol::protocolFramePseudoHeaderRanges(
+    QList<QPair<int, int> > &/*ranges*/) const
+{
+    return !isProtocolFrameValueVariable();
+}
+
+/*!
+  Helper for subclasses with a checksum that includes the pseudo-IP header
+  of the preceding protocol (e.g. TCP, UDP) to append a CksumPatch for the
+  checksum field at cksumOffset to cksums
+
+  Returns false if the pseudo header can not be patched
+*/
+bool AbstractProtocol::appendPseudoHeaderCksumPatch(int cksumOffset,
+    QList<CksumPatch> &cksums) const
+{
+    CksumPatch cksum;
+
+    if (!prev)
+        return (parent == NULL);
+
+    cksum.offset = cksumOffset;
+    cksum.type = CksumPatch::Incremental;
+    if (!prev->protocolFramePseudoHeaderRanges(cksum.ranges))
+        return false;
+
+    if (!cksum.ranges.isEmpty())
+        cksums.append(cksum);
+
+    return true;
+}
+
 /*!
   Returns true if the protocol typically contains a payload or other protocols
   following it e.g. TCP, UDP have payloads, while ARP, IGMP do not 
@@ -24,6 +24,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <QVariant>
 #include <QByteArray>
 #include <QLinkedList>
+#include <QList>
+#include <QPair>
 #include <QFlags>
 #include <qendian.h>
 
@@ -101,6 +103,35 @@ public:
         CksumScopeAllProtocols,       //!< Cksum over all the protocols
     };
 
+    //! A varying field that can be patched into a template frame
+    struct FieldPatch {
+        enum Mode {
+            Increment,
+            Decrement,
+            Random
+        };
+
+        int offset;     //!< Byte offset of the field in the frame
+        int width;      //!< Field width in bytes (max 8)
+        Mode mode;
+        quint64 value;  //!< Field value for frame index 0
+        quint64 mask;   //!< Bits of value that are not varied
+        quint64 step;
+        quint32 count;
+    };
+
+    //! A checksum field that has to be updated in a patched template frame
+    struct CksumPatch {
+        enum Type {
+            Full,           //!< ranges cover all the checksummed bytes
+            Incremental     //!< ranges cover only the patched bytes
+        };
+
+        int offset;     //!< Byte offset of the 16-bit checksum field
+        Type type;
+        QList<QPair<int, int> > ranges; //!< (offset, length) pairs
+    };
+
     AbstractProtocol(StreamBase *stream, AbstractProtocol *parent = 0);
     virtual ~AbstractProtocol();
 
@@ -135,12 +166,18 @@ public:
     int protocolFramePayloadSize(int streamIndex = 0) const;
 
     virtual bool isProtocolFrameValueVariable() const;
+    virtual bool isProtocolFrameValueRandom() const;
     virtual bool isProtocolFrameSizeVariable() const;
     virtual int protocolFrameVariableCount() const;
     bool isProtocolFramePayloadValueVariable() const;
     bool isProtocolFramePayloadSizeVariable() const;
     int protocolFramePayloadVariableCount() const;
 
+    virtual bool protocolFramePatches(QList<FieldPatch> &fields,
+        QList<CksumPatch> &cksums) const;
+    virtual bool protocolFramePseudoHeaderRanges(
+        QList<QPair<int, int> > &ranges) const;
+
     bool protocolHasPayload() const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
@@ -154,6 +191,10 @@ public:
 
     static quint64 lcm(quint64 u, quint64 v);
     static quint64 gcd(quint64 u, quint64 v);
+
+protected:
+    bool appendPseudoHeaderCksumPatch(int cksumOffset,
+        QList<CksumPatch> &cksums) const;
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(AbstractProtocol::FieldFlags);
 
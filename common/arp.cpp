@@ -789,6 +789,15 @@ bool ArpProtocol::isProtocolFrameValueVariable() const
     return false;
 }
 
+bool ArpProtocol::isProtocolFrameValueRandom() const
+{
+    if ((data.sender_proto_addr_mode() == OstProto::Arp::kRandomHost)
+            || (data.target_proto_addr_mode() == OstProto::Arp::kRandomHost))
+        return true;
+
+    return false;
+}
+
 int ArpProtocol::protocolFrameVariableCount() const
 {
     int count = 1;
@@ -94,6 +94,7 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual bool isProtocolFrameValueVariable() const;
+    virtual bool isProtocolFrameValueRandom() const;
     virtual int protocolFrameVariableCount() const;
 
 private:
@@ -156,6 +156,12 @@ public:
             || protoB->isProtocolFrameValueVariable());
     }
 
+    virtual bool isProtocolFrameValueRandom() const
+    {
+        return (protoA->isProtocolFrameValueRandom()
+            || protoB->isProtocolFrameValueRandom());
+    }
+
     virtual bool isProtocolFrameSizeVariable() const
     {
         return (protoA->isProtocolFrameSizeVariable()
@@ -0,0 +1,241 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+
+#include "frametemplate.h"
+
+#include "protocollistiterator.h"
+#include "streambase.h"
+
+#include <string.h>
+
+static inline quint16 frameWord(const uchar *p, int offset, int end)
+{
+    return (p[offset] << 8) | ((offset + 1 < end) ? p[offset + 1] : 0);
+}
+
+static inline quint16 foldSum(quint32 sum)
+{
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    return sum;
+}
+
+FrameTemplate::FrameTemplate()
+{
+}
+
+/*!
+ Builds the template frame for the stream and collects the field and 
+ checksum patches from its protocols
+
+ Returns false if the stream's frames can not be generated from a template
+ e.g. because the frame length varies or a protocol varies its fields in a
+ way that can not be patched; frameValue() of the stream should be used 
+ for such streams
+*/
+bool FrameTemplate::compile(const StreamBase *stream, int bufMaxSize)
+{
+    ProtocolListIterator *iter;
+    bool isPatchable = true;
+    bool isRandom = false;
+    int len;
+
+    clear();
+
+    if ((stream->lenMode() != StreamBase::e_fl_fixed)
+            || stream->isFrameSizeVariable())
+        return false;
+
+    iter = stream->createProtocolListIterator();
+    while (isPatchable && iter->hasNext())
+    {
+        AbstractProtocol *proto = iter->next();
+
+        isPatchable = proto->protocolFramePatches(fields_, cksums_);
+    }
+    delete iter;
+
+    if (!isPatchable)
+        goto _fail;
+
+    frame_.resize(bufMaxSize);
+    len = stream->frameValue((uchar*) frame_.data(), bufMaxSize, 0);
+    if (len <= 0)
+        goto _fail;
+    frame_.resize(len);
+
+    // Patches must lie within the (possibly truncated) frame
+    foreach(const AbstractProtocol::FieldPatch &field, fields_)
+    {
+        if ((field.width < 1) || (field.width > 8) || (field.count == 0)
+                || (field.offset < 0) || (field.offset + field.width > len))
+            goto _fail;
+        if (field.mode == AbstractProtocol::FieldPatch::Random)
+            isRandom = true;
+    }
+    for (int i = 0; i < cksums_.size(); i++)
+    {
+        const AbstractProtocol::CksumPatch &cksum = cksums_.at(i);
+
+        if ((cksum.offset < 0) || (cksum.offset + 2 > len))
+            goto _fail;
+        for (int j = 0; j < cksum.ranges.size(); j++)
+        {
+            int offset = cksum.ranges.at(j).first;
+            int size = cksum.ranges.at(j).second;
+
+            if ((offset < 0) || (offset + size > len))
+                goto _fail;
+            if ((cksum.type == AbstractProtocol::CksumPatch::Full)
+                    && (cksum.offset >= offset) 
+                    && (cksum.offset < offset + size)
+                    && ((cksum.offset - offset) % 2))
+                goto _fail;
+            if ((cksum.type == AbstractProtocol::CksumPatch::Incremental)
+                    && (size % 2))
+                goto _fail;
+        }
+    }
+
+    // Inner checksums are updated before the outer ones that may cover them
+    for (int i = 0; i < cksums_.size()/2; i++)
+        cksums_.swap(i, cksums_.size() - 1 - i);
+
+    // Guard against protocols that vary in ways they don't describe
+    if (!isRandom && (stream->frameVariableCount() > 1))
+    {
+        QByteArray slow(len, 0), fast(len, 0);
+
+        if ((stream->frameValue((uchar*) slow.data(), len, 1) != len)
+                || (frameValue((uchar*) fast.data(), len, 1) != len)
+                || (slow != fast))
+        {
+            qWarning("frame template mismatch; using slow path");
+            goto _fail;
+        }
+    }
+
+    return true;
+
+_fail:
+    clear();
+    return false;
+}
+
+void FrameTemplate::clear()
+{
+    frame_.clear();
+    fields_.clear();
+    cksums_.clear();
+}
+
+bool FrameTemplate::isValid() const
+{
+    return !frame_.isEmpty();
+}
+
+/*!
+ Same as StreamBase::frameValue() for the stream that the template was
+ compiled for
+*/
+int FrameTemplate::frameValue(uchar *buf, int bufMaxSize, 
+        int frameIndex) const
+{
+    int len = frame_.size();
+
+    if ((len == 0) || (len > bufMaxSize))
+        return 0;
+
+    memcpy(buf, frame_.constData(), len);
+    patchFrame(buf, frameIndex);
+
+    return len;
+}
+
+void FrameTemplate::patchFrame(uchar *buf, int frameIndex) const
+{
+    const uchar *tmpl = (const uchar*) frame_.constData();
+
+    for (int i = 0; i < fields_.size(); i++)
+    {
+        const AbstractProtocol::FieldPatch &field = fields_.at(i);
+        quint64 widthMask = (field.width < 8) ? 
+            ((quint64(1) << (field.width * 8)) - 1) : ~quint64(0);
+        quint64 u = quint64(frameIndex % field.count) * field.step;
+        quint64 host = 0, value;
+
+        switch (field.mode)
+        {
+            case AbstractProtocol::FieldPatch::Increment:
+                host = (field.value & ~field.mask) + u;
+                break;
+            case AbstractProtocol::FieldPatch::Decrement:
+                host = (field.value & ~field.mask) - u;
+                break;
+            case AbstractProtocol::FieldPatch::Random:
+                host = qrand();
+                break;
+        }
+
+        value = ((field.value & field.mask) | (host & ~field.mask)) 
+            & widthMask;
+        for (int j = field.width - 1; j >= 0; j--)
+        {
+            buf[field.offset + j] = uchar(value);
+            value >>= 8;
+        }
+    }
+
+    for (int i = 0; i < cksums_.size(); i++)
+    {
+        const AbstractProtocol::CksumPatch &cksum = cksums_.at(i);
+        quint32 sum = 0;
+        quint16 result;
+
+        if (cksum.type == AbstractProtocol::CksumPatch::Incremental)
+        {
+            // RFC 1624: HC' = ~(~HC + ~m + m')
+            sum = quint16(~frameWord(buf, cksum.offset, cksum.offset + 2));
+        }
+
+        for (int j = 0; j < cksum.ranges.size(); j++)
+        {
+            int start = cksum.ranges.at(j).first;
+            int end = start + cksum.ranges.at(j).second;
+
+            for (int k = start; k < end; k += 2)
+            {
+                if (cksum.type == AbstractProtocol::CksumPatch::Incremental)
+                {
+                    sum += quint16(~frameWord(tmpl, k, end));
+                }
+                else if (k == cksum.offset)
+                    continue;
+
+                sum += frameWord(buf, k, end);
+            }
+            sum = foldSum(sum);
+        }
+
+        result = ~foldSum(sum);
+        buf[cksum.offset] = result >> 8;
+        buf[cksum.offset + 1] = result & 0xFF;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _FRAME_TEMPLATE_H
+#define _FRAME_TEMPLATE_H
+
+#include "abstractprotocol.h"
+
+#include <QByteArray>
+#include <QList>
+
+class StreamBase;
+
+/*!
+ Generates frames of a stream by patching the varying fields (and the
+ checksums covering them) of a pre-built template frame instead of building
+ each frame protocol by protocol
+*/
+class FrameTemplate
+{
+public:
+    FrameTemplate();
+
+    bool compile(const StreamBase *stream, int bufMaxSize);
+    void clear();
+    bool isValid() const;
+
+    int frameValue(uchar *buf, int bufMaxSize, int frameIndex) const;
+
+private:
+    void patchFrame(uchar *buf, int frameIndex) const;
+
+    QByteArray frame_;
+    QList<AbstractProtocol::FieldPatch> fields_;
+    QList<AbstractProtocol::CksumPatch> cksums_; // innermost first
+};
+
+#endif
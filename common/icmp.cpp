@@ -392,5 +392,16 @@ _exit:
     return isOk;
 }
 
+bool IcmpProtocol::protocolFramePatches(QList<FieldPatch> &/*fields*/,
+    QList<CksumPatch> &cksums) const
+{
+    if (isProtocolFrameValueVariable())
+        return false;
 
+    // Only the ICMPv6 checksum includes the pseudo-IP header
+    if (data.is_override_checksum()
+            || (icmpVersion() != OstProto::Icmp::kIcmp6))
+        return true;
 
+    return appendPseudoHeaderCksumPatch(protocolFrameOffset() + 2, cksums);
+}
@@ -79,6 +79,9 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual bool protocolFramePatches(QList<FieldPatch> &fields,
+        QList<CksumPatch> &cksums) const;
+
 private:
     OstProto::Icmp    data;
 
@@ -800,6 +800,15 @@ bool Ip4Protocol::isProtocolFrameValueVariable() const
         return false;
 }
 
+bool Ip4Protocol::isProtocolFrameValueRandom() const
+{
+    if ((data.src_ip_mode() == OstProto::Ip4::e_im_random_host)
+            || (data.dst_ip_mode() == OstProto::Ip4::e_im_random_host))
+        return true;
+    else
+        return false;
+}
+
 int Ip4Protocol::protocolFrameVariableCount() const
 {
     int count = 1;
@@ -813,6 +822,83 @@ int Ip4Protocol::protocolFrameVariableCount() const
     return count;
 }
 
+bool Ip4Protocol::protocolFramePatches(QList<FieldPatch> &fields,
+    QList<CksumPatch> &cksums) const
+{
+    int offset = protocolFrameOffset();
+    FieldPatch field;
+    CksumPatch cksum;
+
+    field.width = 4;
+    field.step = 1;
+
+    if (data.src_ip_mode() != OstProto::Ip4::e_im_fixed)
+    {
+        if (!data.src_ip_count())
+            return false;
+
+        field.offset = offset + 12;
+        field.mode = addrPatchMode(data.src_ip_mode());
+        field.value = data.src_ip();
+        field.mask = data.src_ip_mask();
+        field.count = data.src_ip_count();
+        fields.append(field);
+    }
+
+    if (data.dst_ip_mode() != OstProto::Ip4::e_im_fixed)
+    {
+        if (!data.dst_ip_count())
+            return false;
+
+        field.offset = offset + 16;
+        field.mode = addrPatchMode(data.dst_ip_mode());
+        field.value = data.dst_ip();
+        field.mask = data.dst_ip_mask();
+        field.count = data.dst_ip_count();
+        fields.append(field);
+    }
+
+    // The header is small enough to be checksummed afresh for every frame
+    if (isProtocolFrameValueVariable() && !data.is_override_cksum())
+    {
+        cksum.offset = offset + 10;
+        cksum.type = CksumPatch::Full;
+        cksum.ranges.append(qMakePair(offset, protocolFrameSize()));
+        cksums.append(cksum);
+    }
+
+    return true;
+}
+
+bool Ip4Protocol::protocolFramePseudoHeaderRanges(
+    QList<QPair<int, int> > &ranges) const
+{
+    // Random addresses are not patchable since the pseudo header checksum
+    // would be calculated using a different random address
+    if ((data.src_ip_mode() == OstProto::Ip4::e_im_random_host)
+            || (data.dst_ip_mode() == OstProto::Ip4::e_im_random_host))
+        return false;
+
+    if (isProtocolFrameValueVariable())
+        ranges.append(qMakePair(protocolFrameOffset() + 12, 8));
+
+    return true;
+}
+
+AbstractProtocol::FieldPatch::Mode Ip4Protocol::addrPatchMode(
+    OstProto::Ip4::IpAddrMode mode)
+{
+    switch (mode)
+    {
+        case OstProto::Ip4::e_im_dec_host:
+            return FieldPatch::Decrement;
+        case OstProto::Ip4::e_im_random_host:
+            return FieldPatch::Random;
+        default:
+            return FieldPatch::Increment;
+    }
+}
+
 quint32 Ip4Protocol::protocolFrameCksum(int streamIndex,
     CksumType cksumType) const
 {
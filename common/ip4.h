@@ -86,12 +86,19 @@ public:
             FieldAttrib attrib = FieldValue);
 
     virtual bool isProtocolFrameValueVariable() const;
+    virtual bool isProtocolFrameValueRandom() const;
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFramePatches(QList<FieldPatch> &fields,
+        QList<CksumPatch> &cksums) const;
+    virtual bool protocolFramePseudoHeaderRanges(
+        QList<QPair<int, int> > &ranges) const;
 
     virtual quint32 protocolFrameCksum(int streamIndex = 0,
         CksumType cksumType = CksumIp) const;
 
 private:
+    static FieldPatch::Mode addrPatchMode(OstProto::Ip4::IpAddrMode mode);
+
     OstProto::Ip4    data;
 };
 
@@ -765,6 +765,15 @@ bool Ip6Protocol::isProtocolFrameValueVariable() const
         return false;
 }
 
+bool Ip6Protocol::isProtocolFrameValueRandom() const
+{
+    if ((data.src_addr_mode() == OstProto::Ip6::kRandomHost)
+        || (data.dst_addr_mode() == OstProto::Ip6::kRandomHost))
+        return true;
+    else
+        return false;
+}
+
 int Ip6Protocol::protocolFrameVariableCount() const
 {
     int count = 1;
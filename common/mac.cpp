@@ -349,3 +349,42 @@ int MacProtocol::protocolFrameVariableCount() const
     return count;
 }
 
+bool MacProtocol::protocolFramePatches(QList<FieldPatch> &fields,
+    QList<CksumPatch> &/*cksums*/) const
+{
+    int offset = protocolFrameOffset();
+    FieldPatch field;
+
+    field.width = 6;
+    field.mask = 0;
+
+    if (data.dst_mac_mode() != OstProto::Mac::e_mm_fixed)
+    {
+        if (!data.dst_mac_count())
+            return false;
+
+        field.offset = offset;
+        field.mode = data.dst_mac_mode() == OstProto::Mac::e_mm_inc ?
+            FieldPatch::Increment : FieldPatch::Decrement;
+        field.value = data.dst_mac();
+        field.step = data.dst_mac_step();
+        field.count = data.dst_mac_count();
+        fields.append(field);
+    }
+
+    if (data.src_mac_mode() != OstProto::Mac::e_mm_fixed)
+    {
+        if (!data.src_mac_count())
+            return false;
+
+        field.offset = offset + 6;
+        field.mode = data.src_mac_mode() == OstProto::Mac::e_mm_inc ?
+            FieldPatch::Increment : FieldPatch::Decrement;
+        field.value = data.src_mac();
+        field.step = data.src_mac_step();
+        field.count = data.src_mac_count();
+        fields.append(field);
+    }
+
+    return true;
+}
@@ -65,6 +65,8 @@ public:
 
     virtual bool isProtocolFrameValueVariable() const;
     virtual int protocolFrameVariableCount() const;
+    virtual bool protocolFramePatches(QList<FieldPatch> &fields,
+        QList<CksumPatch> &cksums) const;
 
 private:
     OstProto::Mac    data;
@@ -541,3 +541,15 @@ quint16 MldProtocol::checksum(int streamIndex) const
 {
     return AbstractProtocol::protocolFrameCksum(streamIndex, CksumTcpUdp);
 }
+
+bool MldProtocol::protocolFramePatches(QList<FieldPatch> &/*fields*/,
+    QList<CksumPatch> &cksums) const
+{
+    if (isProtocolFrameValueVariable())
+        return false;
+
+    if (data.is_override_checksum())
+        return true;
+
+    return appendPseudoHeaderCksumPatch(protocolFrameOffset() + 2, cksums);
+}
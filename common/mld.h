@@ -60,6 +60,9 @@ public:
     virtual bool setFieldData(int index, const QVariant &value, 
             FieldAttrib attrib = FieldValue);
 
+    virtual bool protocolFramePatches(QList<FieldPatch> &fields,
+        QList<CksumPatch> &cksums) const;
+
 protected:
     virtual bool isSsmReport() const;
     virtual bool isQuery() const;
@@ -43,6 +43,7 @@ HEADERS = \
     protocollist.h \
     protocollistiterator.h \
     streambase.h \
+    frametemplate.h \
 
 HEADERS += \
     mac.h \
@@ -81,6 +82,7 @@ SOURCES = \
     protocollist.cpp \
     protocollistiterator.cpp \
     streambase.cpp \
+    frametemplate.cpp \
 
 SOURCES += \
     mac.cpp \
@@ -222,6 +222,11 @@ bool PayloadProtocol::isProtocolFrameValueVariable() const
         return false;
 }
 
+bool PayloadProtocol::isProtocolFrameValueRandom() const
+{
+    return (data.pattern_mode() == OstProto::Payload::e_dp_random);
+}
+
 bool PayloadProtocol::isProtocolFrameSizeVariable() const
 {
     if (mpStream->lenMode() == StreamBase::e_fl_fixed)
@@ -400,6 +400,17 @@ bool StreamBase::setAveragePacketRate(double packetsPerSec)
     return true;
 }
 
+bool StreamBase::isTrackingStats() const
+{
+    return mControl->track_stats();
+}
+
+bool StreamBase::setTrackingStats(bool flag)
+{
+    mControl->set_track_stats(flag);
+    return true;
+}
+
 bool StreamBase::isFrameVariable() const
 {
     ProtocolListIterator    *iter;
@@ -421,6 +432,31 @@ _exit:
     return true;
 }
 
+// Random frames are not repeatable - so they mustn't be cached and reused
+bool StreamBase::isFrameValueRandom() const
+{
+    ProtocolListIterator    *iter;
+
+    if (lenMode() == e_fl_random)
+        return true;
+
+    iter = createProtocolListIterator();
+    while (iter->hasNext())
+    {
+        AbstractProtocol    *proto;
+
+        proto = iter->next();
+        if (proto->isProtocolFrameValueRandom())
+            goto _exit;
+    }
+    delete iter;
+    return false;
+
+_exit:
+    delete iter;
+    return true;
+}
+
 bool StreamBase::isFrameSizeVariable() const
 {
     ProtocolListIterator    *iter;
@@ -550,6 +586,15 @@ bool StreamBase::preflightCheck(QString &result) const
             pass = false;
         }
 
+        if (isTrackingStats() && (frameLen(i) < (frameProtocolLength(i)
+                        + kStreamSignatureSize + kFcsSize)))
+        {
+            result += QString("Stream stats signature will overwrite "
+                "protocol headers - frame length should be at least %1.\n")
+                .arg(frameProtocolLength(i) + kStreamSignatureSize + kFcsSize);
+            pass = false;
+        }
+
         if (frameLen(i) > 1522)
         {
             result += QString("Jumbo frames may be truncated or dropped "
@@ -27,6 +27,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 const int kFcsSize = 4;
 
+// Trailer of frames of streams with stats tracking (see server/streamstats.h)
+const int kStreamSignatureSize = 26;
+
 class AbstractProtocol;
 class ProtocolList;
 class ProtocolListIterator;
@@ -136,7 +139,11 @@ public:
     double averagePacketRate() const;
     bool setAveragePacketRate(double packetsPerSec);
 
+    bool isTrackingStats() const;
+    bool setTrackingStats(bool flag);
+
     bool isFrameVariable() const;
+    bool isFrameValueRandom() const;
     bool isFrameSizeVariable() const;
     int frameVariableCount() const;
     int frameProtocolLength(int frameIndex) const;
@@ -604,3 +604,14 @@ int TcpProtocol::protocolFrameVariableCount() const
     return protocolFramePayloadVariableCount();
 }
 
+bool TcpProtocol::protocolFramePatches(QList<FieldPatch> &/*fields*/,
+    QList<CksumPatch> &cksums) const
+{
+    if (isProtocolFrameValueVariable())
+        return false;
+
+    if (data.is_override_cksum())
+        return true;
+
+    return appendPseudoHeaderCksumPatch(protocolFrameOffset() + 16, cksums);
+}
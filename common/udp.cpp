@@ -429,3 +429,15 @@ int UdpProtocol::protocolFrameVariableCount() const
 
     return protocolFramePayloadVariableCount();
 }
+
+bool UdpProtocol::protocolFramePatches(QList<FieldPatch> &/*fields*/,
+    QList<CksumPatch> &cksums) const
+{
+    if (isProtocolFrameValueVariable())
+        return false;
+
+    if (data.is_override_cksum())
+        return true;
+
+    return appendPseudoHeaderCksumPatch(protocolFrameOffset() + 6, cksums);
+}
@@ -217,6 +217,12 @@ bool UserScriptProtocol::isProtocolFrameValueVariable() const
     return userProtocol_.isProtocolFrameValueVariable();
 }
 
+// A script may vary its fields any way it likes - including randomly
+bool UserScriptProtocol::isProtocolFrameValueRandom() const
+{
+    return userProtocol_.isProtocolFrameValueVariable();
+}
+
 bool UserScriptProtocol::isProtocolFrameSizeVariable() const
 {
     return userProtocol_.isProtocolFrameSizeVariable();
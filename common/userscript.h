@@ -134,6 +134,7 @@ public:
     virtual int protocolFrameSize(int streamIndex = 0) const;
 
     virtual bool isProtocolFrameValueVariable() const;
+    virtual bool isProtocolFrameValueRandom() const;
     virtual bool isProtocolFrameSizeVariable() const;
     virtual int protocolFrameVariableCount() const;
 
@@ -7,5 +7,6 @@ SUBDIRS = \
     common/ostprotogui.pro \
     server/drone.pro \
     client/ostinato.pro \
-    binding/binding.pro
+    binding/binding.pro \
+    test/txbench.pro
 
@@ -26,20 +26,14 @@ static uchar msgBuf[4096];
 
 PbRpcChannel::PbRpcChannel(QHostAddress ip, quint16 port)
 {
-    isPending = false;
-    pendingMethodId = -1;    // don't care as long as isPending is false
-
-    controller = NULL;
-    done = NULL;
-    response = NULL;
+    maxPendingRpcs = 1;
+    nextRequestId = 0;
+    parsing = false;
 
     mServerAddress = ip;
     mServerPort = port;
     mpSocket = new QTcpSocket(this);
 
-    inStream = new google::protobuf::io::CopyingInputStreamAdaptor(
-            new PbQtInputStream(mpSocket));
-    inStream->SetOwnsCopyingStream(true);
     outStream = new google::protobuf::io::CopyingOutputStreamAdaptor(
             new PbQtOutputStream(mpSocket));
     outStream->SetOwnsCopyingStream(true);
@@ -63,7 +57,6 @@ PbRpcChannel::PbRpcChannel(QHostAddress ip, quint16 port)
 
 PbRpcChannel::~PbRpcChannel()
 {
-    delete inStream;
     delete outStream;
     delete mpSocket;
 }
@@ -89,6 +82,20 @@ void PbRpcChannel::tearDown()
     mpSocket->disconnectFromHost();
 }
 
+/*!
+ Sets the number of RPCs that may be outstanding at a time as allowed by the
+ server in its checkVersion() reply - more than 1 switches to request id
+ headers, so this must be called when no RPC is in flight i.e. from the
+ checkVersion() reply callback
+*/
+void PbRpcChannel::setMaxPendingRpcs(int count)
+{
+    Q_ASSERT(inFlightCalls.isEmpty());
+
+    maxPendingRpcs = qMax(1, count);
+    qDebug("RpcChannel: upto %d pending RPCs allowed", maxPendingRpcs);
+}
+
 void PbRpcChannel::CallMethod(
     const ::google::protobuf::MethodDescriptor *method,
     ::google::protobuf::RpcController *controller,
@@ -96,23 +103,33 @@ void PbRpcChannel::CallMethod(
     ::google::protobuf::Message *response,
     ::google::protobuf::Closure* done)
 {
-    char* msg = (char*) &msgBuf[0];
-    int     len;
-    bool    ret;
-  
-    if (isPending)
+    RpcCall call;
+
+    if (!req->IsInitialized())
     {
-        RpcCall call;
-        qDebug("RpcChannel: queueing rpc since method %d is pending;<----\n "
+        qWarning("RpcChannel: missing required fields in request <----");
+        qDebug("req = \n%s", req->DebugString().c_str());
+        qDebug("error = \n%s\n--->", req->InitializationErrorString().c_str());
+
+        controller->SetFailed("Required fields missing");
+        done->Run();
+        return;
+    }
+
+    call.method = method;
+    call.controller = controller;
+    call.request = req;
+    call.response = response;
+    call.done = done;
+
+    // Calls are sent in order - so queue if others are already queued
+    if ((inFlightCalls.size() >= maxPendingRpcs) || !pendingCallList.isEmpty())
+    {
+        qDebug("RpcChannel: queueing rpc since %d are pending;<----\n "
                 "queued method = %d\n"
                 "queued message = \n%s\n---->", 
-                pendingMethodId, method->index(), req->DebugString().c_str());
-
-        call.method = method;
-        call.controller = controller;
-        call.request = req;
-        call.response = response;
-        call.done = done;
+                inFlightCalls.size(), method->index(), 
+                req->DebugString().c_str());
 
         pendingCallList.append(call);
 	qDebug("pendingCallList size = %d", pendingCallList.size());
@@ -122,200 +139,183 @@ void PbRpcChannel::CallMethod(
         return;
     }
 
-    if (!req->IsInitialized())
-    {
-        qWarning("RpcChannel: missing required fields in request <----");
-        qDebug("req = \n%s", req->DebugString().c_str());
-        qDebug("error = \n%s\n--->", req->InitializationErrorString().c_str());
+    sendCall(call);
+}
 
-        controller->SetFailed("Required fields missing");
-        done->Run();
-        return;
+void PbRpcChannel::sendCall(const RpcCall &call)
+{
+    char* msg = (char*) &msgBuf[0];
+    int     hdrLen = PB_HDR_SIZE;
+    int     len;
+    quint32 id = 0;
+    bool    ret;
+  
+    if (maxPendingRpcs > 1)
+    {
+        id = nextRequestId++;
+        hdrLen = PB_ID_HDR_SIZE;
     }
+    inFlightCalls.insert(id, call);
 
-    pendingMethodId = method->index();
-    this->controller=controller;
-    this->done=done;
-    this->response=response;
-    isPending = true;
-
-    len = req->ByteSize();
+    len = call.request->ByteSize();
     *((quint16*)(msg+0)) = qToBigEndian(quint16(PB_MSG_TYPE_REQUEST)); // type
-    *((quint16*)(msg+2)) = qToBigEndian(quint16(method->index())); // method id
+    *((quint16*)(msg+2)) = qToBigEndian(quint16(call.method->index())); // method id
     *((quint32*)(msg+4)) = qToBigEndian(quint32(len)); // len
+    if (hdrLen == PB_ID_HDR_SIZE)
+        *((quint32*)(msg+8)) = qToBigEndian(id); // request id
 
     // Avoid printing stats since it happens every couple of seconds
-    if (pendingMethodId != 13)
+    if (call.method->index() != 13)
     {
         qDebug("client(%s) sending %d bytes <----", __FUNCTION__, 
-                PB_HDR_SIZE + len);
-        BUFDUMP(msg, PB_HDR_SIZE);
+                hdrLen + len);
+        BUFDUMP(msg, hdrLen);
         qDebug("method = %d\n req = \n%s\n---->", 
-                method->index(), req->DebugString().c_str());
+                call.method->index(), call.request->DebugString().c_str());
     }
 
-    mpSocket->write(msg, PB_HDR_SIZE);
-    ret = req->SerializeToZeroCopyStream(outStream);
+    mpSocket->write(msg, hdrLen);
+    ret = call.request->SerializeToZeroCopyStream(outStream);
     Q_ASSERT(ret == true);
     Q_UNUSED(ret);
     outStream->Flush();
 }
 
 void PbRpcChannel::on_mpSocket_readyRead()
+{
+    //qDebug("%s: bytesAvail = %d", __FUNCTION__, mpSocket->bytesAvailable());
+
+    // There may be more than one reply if RPCs are pipelined
+    while (mpSocket->bytesAvailable() && processReply())
+        ;
+}
+
+// Returns true if a complete msg was received (and processed)
+bool PbRpcChannel::processReply()
 {
     uchar   *msg = (uchar*) &msgBuf;
+    int        hdrLen = (maxPendingRpcs > 1) ? PB_ID_HDR_SIZE : PB_HDR_SIZE;
     int        msgLen;
-    static bool parsing = false;
-    static quint16    type, method;
-    static quint32    len;
-
-    //qDebug("%s: bytesAvail = %d", __FUNCTION__, mpSocket->bytesAvailable());
+    RpcCall call;
+    QIODevice *blob = NULL;
 
     if (!parsing)
     {
         // Do we have an entire header? If not, we'll wait ...
-        if (mpSocket->bytesAvailable() < PB_HDR_SIZE)
+        if (mpSocket->bytesAvailable() < hdrLen)
         {
             qDebug("client: not enough data available for a complete header");
-            return;
+            return false;
         }
 
-        msgLen = mpSocket->read((char*)msg, PB_HDR_SIZE);
+        msgLen = mpSocket->read((char*)msg, hdrLen);
 
-        Q_ASSERT(msgLen == PB_HDR_SIZE);
+        Q_ASSERT(msgLen == hdrLen);
         Q_UNUSED(msgLen);
 
         type = qFromBigEndian<quint16>(msg+0);
         method = qFromBigEndian<quint16>(msg+2);
         len = qFromBigEndian<quint32>(msg+4);
+        requestId = (hdrLen == PB_ID_HDR_SIZE) ? 
+                        qFromBigEndian<quint32>(msg+8) : 0;
 
-        //BUFDUMP(msg, PB_HDR_SIZE);
+        //BUFDUMP(msg, hdrLen);
         //qDebug("type = %hu, method = %hu, len = %u", type, method, len);
 
+        cumLen = 0;
+        msgData.resize(0);
         parsing = true;
     }
 
-    switch (type)
+    // A default constructed (all NULL) call if we are not waiting for this
+    call = inFlightCalls.value(requestId);
+
+    if ((type == PB_MSG_TYPE_BINBLOB) && call.controller)
     {
-        case PB_MSG_TYPE_BINBLOB:
-        {
-            static quint32 cumLen = 0;
-            QIODevice *blob;
+        blob = static_cast<PbRpcController*>(call.controller)->binaryBlob();
+        Q_ASSERT(blob != NULL);
+    }
 
-            blob = static_cast<PbRpcController*>(controller)->binaryBlob();
-            Q_ASSERT(blob != NULL);
+    // Don't read beyond this msg - the next reply may follow right after
+    while ((cumLen < len) && mpSocket->bytesAvailable())
+    {
+        int l;
+
+        l = mpSocket->read((char*)msgBuf, 
+                           qMin(quint32(sizeof(msgBuf)), len - cumLen));
+        if (blob)
+            blob->write((char*)msgBuf, l);
+        else
+            msgData.append((char*)msgBuf, l);
+        cumLen += l;
+    }
 
-            while ((cumLen < len) && mpSocket->bytesAvailable())
-            {
-                int l;
+    if ((type != PB_MSG_TYPE_RESPONSE) && (type != PB_MSG_TYPE_NOTIFY))
+        qDebug("%s: msg type %d rcvd %d/%d", __PRETTY_FUNCTION__, 
+                type, cumLen, len);
 
-                l = mpSocket->read((char*)msgBuf, sizeof(msgBuf));
-                blob->write((char*)msgBuf, l);
-                cumLen += l;
-            }
+    if (cumLen < len)
+        return false;
 
-            qDebug("%s: bin blob rcvd %d/%d", __PRETTY_FUNCTION__, cumLen, len);
+    parsing = false;
 
-            if (cumLen < len)
-                return;
+    // Not a reply - pushed by the server for some earlier RPC
+    if (type == PB_MSG_TYPE_NOTIFY)
+    {
+        emit notification(method, msgData);
+        return true;
+    }
 
-            cumLen = 0;
+    if (!call.method)
+    {
+        qWarning("not waiting for response (request id %u)", requestId);
+        goto _error_exit;
+    }
 
-            if (!isPending)
-            {
-                qWarning("not waiting for response");
-                goto _error_exit2;
-            }
+    if (call.method->index() != method)
+    {
+        qWarning("invalid method id %d (expected = %d)", method, 
+            call.method->index());
+        goto _error_exit;
+    }
 
-            if (pendingMethodId != method)
-            {
-                qWarning("invalid method id %d (expected = %d)", method, 
-                    pendingMethodId);
-                goto _error_exit2;
-            }
+    inFlightCalls.remove(requestId);
 
+    switch (type)
+    {
+        case PB_MSG_TYPE_BINBLOB:
             break;
-        }
 
         case PB_MSG_TYPE_RESPONSE:
             //qDebug("client(%s) rcvd %d bytes", __FUNCTION__, msgLen);
             //BUFDUMP(msg, msgLen);
 
-            if (!isPending)
-            {
-                qWarning("not waiting for response");
-                goto _error_exit;
-            }
-
-            if (pendingMethodId != method)
-            {
-                qWarning("invalid method id %d (expected = %d)", method, 
-                    pendingMethodId);
-                goto _error_exit;
-            }
-
             if (len)
-                response->ParseFromBoundedZeroCopyStream(inStream, len);
+                call.response->ParseFromArray(msgData.constData(), len);
 
             // Avoid printing stats
             if (method != 13)
             {
                 qDebug("client(%s): Received Msg <---- ", __FUNCTION__);
                 qDebug("method = %d\nresp = \n%s\n---->",
-                        method, response->DebugString().c_str());
+                        method, call.response->DebugString().c_str());
             }
 
-            if (!response->IsInitialized())
+            if (!call.response->IsInitialized())
             {
                 qWarning("RpcChannel: missing required fields in response <----");
-                qDebug("resp = \n%s", response->DebugString().c_str());
+                qDebug("resp = \n%s", call.response->DebugString().c_str());
                 qDebug("error = \n%s\n--->", 
-                        response->InitializationErrorString().c_str());
+                        call.response->InitializationErrorString().c_str());
 
-                controller->SetFailed("Required fields missing");
+                call.controller->SetFailed("Required fields missing");
             }
             break;
 
         case PB_MSG_TYPE_ERROR:
-        {
-            static quint32 cumLen = 0;
-            static QByteArray error;
-
-            while ((cumLen < len) && mpSocket->bytesAvailable())
-            {
-                int l;
-
-                l = mpSocket->read((char*)msgBuf, sizeof(msgBuf));
-                error.append(QByteArray((char*)msgBuf,l));
-                cumLen += l;
-            }
-
-            qDebug("%s: error rcvd %d/%d", __PRETTY_FUNCTION__, cumLen, len);
-
-            if (cumLen < len)
-                return;
-
-            static_cast<PbRpcController*>(controller)->SetFailed(
-                    QString::fromUtf8(error, len));
-
-            cumLen = 0;
-            error.resize(0);
-
-            if (!isPending)
-            {
-                qWarning("not waiting for response");
-                goto _error_exit2;
-            }
-
-            if (pendingMethodId != method)
-            {
-                qWarning("invalid method id %d (expected = %d)", method, 
-                    pendingMethodId);
-                goto _error_exit2;
-            }
-
+            static_cast<PbRpcController*>(call.controller)->SetFailed(
+                    QString::fromUtf8(msgData, len));
             break;
-        }
 
         default:
             qFatal("%s: unexpected type %d", __PRETTY_FUNCTION__, type);
@@ -323,35 +323,24 @@ void PbRpcChannel::on_mpSocket_readyRead()
                 
     }
 
-    done->Run();
-
-    pendingMethodId = -1;
-    controller = NULL;
-    response = NULL;
-    isPending = false;
-    parsing = false;
+    call.done->Run();
 
-    if (pendingCallList.size())
+    while (pendingCallList.size() && (inFlightCalls.size() < maxPendingRpcs))
     {
         RpcCall call = pendingCallList.takeFirst();
         qDebug("RpcChannel: executing queued method <----\n"
                "method = %d\n"
                "req = \n%s\n---->", 
                 call.method->index(), call.request->DebugString().c_str());
-        CallMethod(call.method, call.controller, call.request, call.response,
-                call.done);
+        sendCall(call);
     }
 
-    return;
+    return true;
 
 _error_exit:
-    inStream->Skip(len);
-_error_exit2:
-    parsing = false;
     qDebug("client(%s) discarding received msg <----", __FUNCTION__);
-    qDebug("method = %d\nreq = \n%s\n---->",
-            method, response->DebugString().c_str());
-    return;
+    qDebug("method = %d, type = %d, len = %d\n---->", method, type, len);
+    return true;
 }
 
 void PbRpcChannel::on_mpSocket_stateChanged(
@@ -371,13 +360,12 @@ void PbRpcChannel::on_mpSocket_disconnected()
 {
     qDebug("In %s", __FUNCTION__);
 
-    pendingMethodId = -1;
-    controller = NULL;
-    response = NULL;
-    isPending = false;
-    // \todo convert parsing from static to data member
-    //parsing = false 
+    inFlightCalls.clear();
     pendingCallList.clear();
+    parsing = false;
+
+    // Request ids are renegotiated on the next connection
+    maxPendingRpcs = 1;
 
     emit disconnected();
 }
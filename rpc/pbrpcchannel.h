@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _PB_RPC_CHANNEL_H
 #define _PB_RPC_CHANNEL_H
 
+#include <QHash>
 #include <QTcpServer>
 #include <QTcpSocket>
 
@@ -35,23 +36,6 @@ class PbRpcChannel : public QObject, public ::google::protobuf::RpcChannel
 {
     Q_OBJECT
     
-    // If isPending is TRUE, then  controller, done, response
-    // and pendingMethodId correspond to the last method called by
-    // the service stub
-    bool            isPending;
-    int                pendingMethodId;
-
-    // controller, done, response are set to the corresponding values
-    // passed by the stub to CallMethod(). They are reset to NULL when
-    // we get a response back from the server in on_mpSocket_readyRead()
-    // after calling done->Run().
-
-    /*! \todo (MED) : change controller, done and response to references
-     instead of pointers? */
-    ::google::protobuf::RpcController    *controller;
-    ::google::protobuf::Closure            *done;
-    ::google::protobuf::Message            *response;
-
     typedef struct _RpcCall {
         const ::google::protobuf::MethodDescriptor    *method;
         ::google::protobuf::RpcController        *controller;
@@ -59,15 +43,32 @@ class PbRpcChannel : public QObject, public ::google::protobuf::RpcChannel
         ::google::protobuf::Message                *response;
         ::google::protobuf::Closure                *done;
     } RpcCall;
+
+    // Calls sent to the server and waiting for a reply, keyed by request
+    // id - the id is always 0 if request ids are not in use
+    QHash<quint32, RpcCall>    inFlightCalls;
+    int                maxPendingRpcs;
+    quint32            nextRequestId;
+
+    // Calls waiting for an inFlightCalls slot, sent in order
     QList<RpcCall>        pendingCallList;
 
+    // Header and data received so far of the msg being parsed
+    bool            parsing;
+    quint16            type, method;
+    quint32            len, requestId;
+    quint32            cumLen;
+    QByteArray        msgData;
+
     QHostAddress    mServerAddress;
     quint16            mServerPort;
     QTcpSocket        *mpSocket;
 
-    ::google::protobuf::io::CopyingInputStreamAdaptor  *inStream;
     ::google::protobuf::io::CopyingOutputStreamAdaptor *outStream;
 
+    void sendCall(const RpcCall &call);
+    bool processReply();
+
 public:
     PbRpcChannel(QHostAddress ip, quint16 port);
     ~PbRpcChannel();
@@ -82,6 +83,8 @@ public:
     QAbstractSocket::SocketState state() const
         { return mpSocket->state(); }    
 
+    void setMaxPendingRpcs(int count);
+
     void CallMethod(const ::google::protobuf::MethodDescriptor *method,
         ::google::protobuf::RpcController *controller,
         const ::google::protobuf::Message *req,
@@ -93,6 +96,7 @@ signals:
     void disconnected();
     void error(QAbstractSocket::SocketError socketError);
     void stateChanged(QAbstractSocket::SocketState socketState);
+    void notification(int methodId, QByteArray msg);
 
 private slots:
     void on_mpSocket_connected();
@@ -29,12 +29,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 **    - MSG_TYPE (2)
 **    - METHOD_ID (2)
 **    - LEN (4) [not including this header]
+**
+** RPC Header with Request Id (12) - used in both directions once a
+** checkVersion() reply allows more than one pending RPC; replies carry the
+** id of their request and may be out of order - the server executes RPCs
+** one at a time in order, but quick read-only ones (e.g. getStats())
+** don't wait for the executing RPCs to complete
+**    - MSG_TYPE (2)
+**    - METHOD_ID (2)
+**    - LEN (4) [not including this header]
+**    - REQUEST_ID (4)
 */
 #define PB_HDR_SIZE                8
+#define PB_ID_HDR_SIZE            12
+
+// Max RPCs a server allows a client to have outstanding
+#define PB_MAX_PENDING_RPCS       64
 
 #define PB_MSG_TYPE_REQUEST        1
 #define PB_MSG_TYPE_RESPONSE    2
 #define PB_MSG_TYPE_BINBLOB        3
 #define PB_MSG_TYPE_ERROR          4
+#define PB_MSG_TYPE_NOTIFY         5  // server to client, not a reply
 
 #endif
@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <google/protobuf/service.h>
 
 class QIODevice;
+class QObject;
 
 /*!
 PbRpcController takes ownership of the 'request' and 'response' messages and
@@ -36,6 +37,8 @@ public:
             ::google::protobuf::Message *response) { 
         request_ = request;
         response_ = response;
+        maxPending = 1;
+        conn = NULL;
         Reset(); 
     }
     ~PbRpcController() { delete request_; delete response_; }
@@ -70,15 +73,30 @@ public:
     bool Disconnect() const {
         return disconnect;
     }
+    // Number of RPCs the client may have outstanding after a checkVersion()
+    // reply - more than one switches the connection to request id headers
+    void SetMaxPendingRpcs(int count) {
+        maxPending = count;
+    }
+    int MaxPendingRpcs() const {
+        return maxPending;
+    }
 
     // srivatsp added
     QIODevice* binaryBlob() { return blob; };
     void setBinaryBlob(QIODevice *binaryBlob) { blob = binaryBlob; };
 
+    // Server side: the connection the RPC was received on - a QObject
+    // with a sendNotification(int methodId, QByteArray msg) slot
+    QObject* connection() { return conn; }
+    void setConnection(QObject *connection) { conn = connection; }
+
 private:
     bool failed;
     bool disconnect;
+    int maxPending;
     QIODevice *blob;
+    QObject *conn;
     QString errStr;
     ::google::protobuf::Message *request_;
     ::google::protobuf::Message *response_;
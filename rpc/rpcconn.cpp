@@ -29,8 +29,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 
 #include <QHostAddress>
+#include <QRunnable>
 #include <QString>
 #include <QTcpSocket>
+#include <QThreadPool>
 #include <QThreadStorage>
 #include <QtGlobal>
 #include <qendian.h>
@@ -38,24 +40,80 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include <stdio.h>
 #include <stdlib.h>
 
+// Pending replies (in bytes) beyond which we stop reading requests from
+// the client and drop notifications to it; reading resumes below the low mark
+static const qint64 kWriteHighWatermark = 1024*1024;
+static const qint64 kWriteLowWatermark = 256*1024;
+
+// Socket read buffer size while reading is paused - small enough for the
+// kernel socket buffers to fill up and the client to be flow controlled
+static const qint64 kPausedReadBufferSize = 64*1024;
+
 static QThreadStorage<QString*> connId;
 
+// Threads are shared by connections - set the id for each event handled
+static void setConnId(const QString &id)
+{
+    if (!connId.hasLocalData() || (*connId.localData() != id))
+        connId.setLocalData(new QString(id));
+}
+
+// Executes an RPC of a connection in a worker thread
+class RpcCallRunner : public QRunnable
+{
+public:
+    RpcCallRunner(const QString &id, ::google::protobuf::Service *service,
+            const ::google::protobuf::MethodDescriptor *methodDesc,
+            PbRpcController *controller, ::google::protobuf::Closure *done)
+        : id_(id), service_(service), methodDesc_(methodDesc),
+          controller_(controller), done_(done)
+    {
+    }
+
+    void run()
+    {
+        setConnId(id_);
+        service_->CallMethod(methodDesc_, controller_, controller_->request(),
+                controller_->response(), done_);
+    }
+
+private:
+    QString id_;
+    ::google::protobuf::Service *service_;
+    const ::google::protobuf::MethodDescriptor *methodDesc_;
+    PbRpcController *controller_;
+    ::google::protobuf::Closure *done_;
+};
+
 RpcConnection::RpcConnection(int socketDescriptor, 
-                             ::google::protobuf::Service *service)
+                             ::google::protobuf::Service *service,
+                             QThreadPool *workers,
+                             QThreadPool *quickWorkers,
+                             const QSet<QString> &quickMethods)
     : socketDescriptor(socketDescriptor),
-      service(service)
+      service(service),
+      workers(workers),
+      quickWorkers(quickWorkers),
+      quickMethods(quickMethods)
 {
-    inStream = NULL;
+    clientSock = NULL;
     outStream = NULL;
 
-    isPending = false;
-    pendingMethodId = -1; // don't care as long as isPending is false
+    executingCount = 0;
+    isClosed = false;
+    isReadPaused = false;
+
+    maxPendingRpcs = 1;
+    hasRequestId = false;
 
     isCompatCheckDone = false;
 }
 
 RpcConnection::~RpcConnection()
 { 
+    if (!clientSock)
+        return;
+
     qDebug("destroying connection to %s: %d", 
             clientSock->peerAddress().toString().toAscii().constData(),
             clientSock->peerPort());
@@ -66,7 +124,6 @@ RpcConnection::~RpcConnection()
         clientSock->waitForDisconnected();
     }
 
-    delete inStream;
     delete outStream;
 
     delete clientSock;
@@ -74,50 +131,109 @@ RpcConnection::~RpcConnection()
 
 void RpcConnection::start()
 {
-    QString id = QString("[%1:%2] ");
     clientSock = new QTcpSocket;
     if (!clientSock->setSocketDescriptor(socketDescriptor)) {
         qWarning("Unable to initialize TCP socket for incoming connection");
+        deleteLater();
         return;
     }
     qDebug("clientSock Thread = %p", clientSock->thread());
 
-    connId.setLocalData(new QString(id.arg(clientSock->peerAddress().toString())
-                                      .arg(clientSock->peerPort())));
+    id = QString("[%1:%2] ").arg(clientSock->peerAddress().toString())
+                            .arg(clientSock->peerPort());
+    setConnId(id);
 
     qDebug("accepting new connection from %s: %d", 
             clientSock->peerAddress().toString().toAscii().constData(),
             clientSock->peerPort());
-    inStream = new google::protobuf::io::CopyingInputStreamAdaptor(
-                            new PbQtInputStream(clientSock));
-    inStream->SetOwnsCopyingStream(true);
     outStream = new google::protobuf::io::CopyingOutputStreamAdaptor(
                             new PbQtOutputStream(clientSock));
     outStream->SetOwnsCopyingStream(true);
 
     connect(clientSock, SIGNAL(readyRead()), 
         this, SLOT(on_clientSock_dataAvail()));
+    connect(clientSock, SIGNAL(bytesWritten(qint64)), 
+        this, SLOT(on_clientSock_bytesWritten(qint64)));
     connect(clientSock, SIGNAL(disconnected()), 
         this, SLOT(on_clientSock_disconnected()));
     connect(clientSock, SIGNAL(error(QAbstractSocket::SocketError)), 
         this, SLOT(on_clientSock_error(QAbstractSocket::SocketError)));
 }
 
-void RpcConnection::writeHeader(char* header, quint16 type, quint16 method, 
-                                quint32 length)
+// Returns the size of the header written
+int RpcConnection::writeHeader(char* header, quint16 type, quint16 method, 
+                                quint32 length, quint32 requestId)
 {
     *((quint16*)(header+0)) = qToBigEndian(type);
     *((quint16*)(header+2)) = qToBigEndian(method);
     *((quint32*)(header+4)) = qToBigEndian(length);
+
+    if (!hasRequestId)
+        return PB_HDR_SIZE;
+
+    *((quint32*)(header+8)) = qToBigEndian(requestId);
+    return PB_ID_HDR_SIZE;
+}
+
+/*
+ Starts executing received RPCs in the order received - an RPC waits for
+ all earlier ones to complete, except a quick (read-only) RPC which runs
+ alongside them once replies carry request ids and may thus go out of order
+*/
+void RpcConnection::dispatchCall()
+{
+    while (!callQueue.isEmpty())
+    {
+        QueuedCall call = callQueue.first();
+        bool isQuick = quickMethods.contains(QString::fromStdString(
+                    call.methodDesc->name()));
+        QThreadPool *pool = isQuick ? quickWorkers : workers;
+
+        if (executingCount && !(isQuick && hasRequestId))
+            break;
+
+        callQueue.removeFirst();
+        executingCount++;
+
+        pool->start(new RpcCallRunner(id, service, call.methodDesc,
+                call.controller, google::protobuf::NewCallback(
+                    this, &RpcConnection::callDone, call.controller)));
+    }
+}
+
+// Called in the worker thread (or whichever thread the service completes
+// the RPC in) - the reply is sent from our own thread
+void RpcConnection::callDone(PbRpcController *controller)
+{
+    QMetaObject::invokeMethod(this, "callCompleted", Qt::QueuedConnection,
+            Q_ARG(PbRpcController*, controller));
+}
+
+void RpcConnection::callCompleted(PbRpcController *controller)
+{
+    setConnId(id);
+    executingCount--;
+
+    if (isClosed) {
+        pendingRpcs.remove(controller);
+        delete controller;
+        if (!executingCount)
+            deleteLater();
+        return;
+    }
+
+    sendRpcReply(controller);
+    dispatchCall();
 }
 
 void RpcConnection::sendRpcReply(PbRpcController *controller)
 {
     google::protobuf::Message *response = controller->response();
+    PendingRpc rpc = pendingRpcs.take(controller);
     QIODevice *blob;
-    char msgBuf[PB_HDR_SIZE];
+    char msgBuf[PB_ID_HDR_SIZE];
     char* const msg = &msgBuf[0];
-    int len;
+    int hdrLen, len;
 
     if (controller->Failed())
     {
@@ -125,8 +241,9 @@ void RpcConnection::sendRpcReply(PbRpcController *controller)
 
         qWarning("rpc failed (%s)", qPrintable(controller->ErrorString()));
         len = err.size();
-        writeHeader(msg, PB_MSG_TYPE_ERROR, pendingMethodId, len);
-        clientSock->write(msg, PB_HDR_SIZE);
+        hdrLen = writeHeader(msg, PB_MSG_TYPE_ERROR, rpc.methodId, len,
+                rpc.requestId);
+        clientSock->write(msg, hdrLen);
         clientSock->write(err.constData(), len);
 
         goto _exit;
@@ -138,17 +255,18 @@ void RpcConnection::sendRpcReply(PbRpcController *controller)
         len = blob->size();
         qDebug("is binary blob of len %d", len);
 
-        writeHeader(msg, PB_MSG_TYPE_BINBLOB, pendingMethodId, len);
-        clientSock->write(msg, PB_HDR_SIZE);
+        hdrLen = writeHeader(msg, PB_MSG_TYPE_BINBLOB, rpc.methodId, len,
+                rpc.requestId);
+        clientSock->write(msg, hdrLen);
 
         blob->seek(0);
         while (!blob->atEnd())
         {    
+            QByteArray chunk = blob->read(64*1024);
             int l;
 
-            len = blob->read(msg, sizeof(msgBuf));
-            l = clientSock->write(msg, len);
-            Q_ASSERT(l == len);
+            l = clientSock->write(chunk);
+            Q_ASSERT(l == chunk.size());
             Q_UNUSED(l);
         }
 
@@ -167,41 +285,89 @@ void RpcConnection::sendRpcReply(PbRpcController *controller)
     }
 
     len = response->ByteSize();
-    writeHeader(msg, PB_MSG_TYPE_RESPONSE, pendingMethodId, len);
+    hdrLen = writeHeader(msg, PB_MSG_TYPE_RESPONSE, rpc.methodId, len,
+            rpc.requestId);
 
     // Avoid printing stats since it happens once every couple of seconds
-    if (pendingMethodId != 13)
+    // and capture chunks since they are large and can come back to back
+    if ((rpc.methodId != 13) && (rpc.methodId != 16)
+            && (rpc.methodId != 17))
     {
         qDebug("Server(%s): sending %d bytes to client <----",
-            __FUNCTION__, len + PB_HDR_SIZE);
-        BUFDUMP(msg, 8);
+            __FUNCTION__, len + hdrLen);
+        BUFDUMP(msg, hdrLen);
         qDebug("method = %d\nreq = \n%s---->", 
-            pendingMethodId, response->DebugString().c_str());
+            rpc.methodId, response->DebugString().c_str());
     }
 
-    clientSock->write(msg, PB_HDR_SIZE);
+    clientSock->write(msg, hdrLen);
     response->SerializeToZeroCopyStream(outStream);
     outStream->Flush();
 
-    if (pendingMethodId == 15)
+    if (rpc.methodId == 15) {
         isCompatCheckDone = true;
 
+        // Replies from here on carry the request id - the client sends
+        // nothing else till it gets this reply, so both ends switch together
+        maxPendingRpcs = qBound(1, controller->MaxPendingRpcs(),
+                                PB_MAX_PENDING_RPCS);
+        hasRequestId = (maxPendingRpcs > 1);
+        if (hasRequestId)
+            qDebug("upto %d pending RPCs allowed", maxPendingRpcs);
+    }
+
 _exit:
     if (controller->Disconnect())
         clientSock->disconnectFromHost();
 
     delete controller;
-    isPending = false;
+}
+
+// Sends msg to the client outside of any RPC reply (e.g. pushed stats)
+void RpcConnection::sendNotification(int methodId, const QByteArray &msg)
+{
+    char hdr[PB_ID_HDR_SIZE];
+    int hdrLen;
+
+    if (clientSock->state() != QAbstractSocket::ConnectedState)
+        return;
+
+    // Don't queue up notifications for a client that isn't reading them
+    if (isClientSlow()) {
+        emit notificationDropped(methodId);
+        return;
+    }
+
+    hdrLen = writeHeader(hdr, PB_MSG_TYPE_NOTIFY, methodId, msg.size(), 0);
+    clientSock->write(hdr, hdrLen);
+    clientSock->write(msg);
+}
+
+bool RpcConnection::isClientSlow()
+{
+    return clientSock->bytesToWrite() > kWriteHighWatermark;
 }
 
 void RpcConnection::on_clientSock_disconnected()
 {
+    setConnId(id);
     qDebug("connection closed from %s: %d",
             clientSock->peerAddress().toString().toAscii().constData(),
             clientSock->peerPort());
 
+    foreach(QueuedCall call, callQueue) {
+        pendingRpcs.remove(call.controller);
+        delete call.controller;
+    }
+    callQueue.clear();
+
+    // The executing RPCs refer to us - delete once they complete
+    if (executingCount) {
+        isClosed = true;
+        return;
+    }
+
     deleteLater();
-    emit closed();
 }
 
 void RpcConnection::on_clientSock_error(QAbstractSocket::SocketError socketError)
@@ -212,42 +378,88 @@ void RpcConnection::on_clientSock_error(QAbstractSocket::SocketError socketError
 
 void RpcConnection::on_clientSock_dataAvail()
 {
-    uchar    msg[PB_HDR_SIZE];
+    setConnId(id);
+
+    // A client pipelining RPCs may send several requests back to back
+    while ((clientSock->state() == QAbstractSocket::ConnectedState)
+            && !isReadPaused)
+    {
+        // Stop reading requests till the client reads the replies we
+        // already have for it
+        if (isClientSlow()) {
+            qDebug("%lld bytes pending to client; pausing reads",
+                    clientSock->bytesToWrite());
+            isReadPaused = true;
+            clientSock->setReadBufferSize(kPausedReadBufferSize);
+            break;
+        }
+
+        if (!processRequest())
+            break;
+    }
+}
+
+void RpcConnection::on_clientSock_bytesWritten(qint64 /*bytes*/)
+{
+    if (!isReadPaused || (clientSock->bytesToWrite() > kWriteLowWatermark))
+        return;
+
+    setConnId(id);
+    qDebug("resuming reads");
+    isReadPaused = false;
+    clientSock->setReadBufferSize(0);
+    on_clientSock_dataAvail();
+}
+
+// Returns true if a complete request was available (and processed)
+bool RpcConnection::processRequest()
+{
+    uchar    msg[PB_ID_HDR_SIZE];
+    int      hdrLen = hasRequestId ? PB_ID_HDR_SIZE : PB_HDR_SIZE;
     int      msgLen;
     quint16 type, method;
-    quint32 len;
+    quint32 len, requestId = 0;
+    QByteArray data;
     const ::google::protobuf::MethodDescriptor    *methodDesc;
     ::google::protobuf::Message    *req, *resp;
     PbRpcController *controller;
+    PendingRpc rpc;
+    QueuedCall call;
     QString error;
     bool disconnect = false;
 
     // Do we have enough bytes for a msg header? 
     // If yes, peek into the header and get msg length
-    if (clientSock->bytesAvailable() < PB_HDR_SIZE)
-        return;
+    if (clientSock->bytesAvailable() < hdrLen)
+        return false;
 
-    msgLen = clientSock->peek((char*)msg, PB_HDR_SIZE);
-    if (msgLen != PB_HDR_SIZE) {
+    msgLen = clientSock->peek((char*)msg, hdrLen);
+    if (msgLen != hdrLen) {
         qWarning("asked to peek %d bytes, was given only %d bytes",
-                PB_HDR_SIZE, msgLen);
-        return;
+                hdrLen, msgLen);
+        return false;
     }
 
     len = qFromBigEndian<quint32>(&msg[4]);
 
     // Is the full msg available to read? If not, wait till such time
-    if (clientSock->bytesAvailable() < (PB_HDR_SIZE+len))
-        return;
+    if (clientSock->bytesAvailable() < (hdrLen+len))
+        return false;
 
-    msgLen = clientSock->read((char*)msg, PB_HDR_SIZE);
-    Q_ASSERT(msgLen == PB_HDR_SIZE);
+    msgLen = clientSock->read((char*)msg, hdrLen);
+    Q_ASSERT(msgLen == hdrLen);
 
     type = qFromBigEndian<quint16>(&msg[0]);
     method = qFromBigEndian<quint16>(&msg[2]);
     len = qFromBigEndian<quint32>(&msg[4]);
+    if (hasRequestId)
+        requestId = qFromBigEndian<quint32>(&msg[8]);
     //qDebug("type = %d, method = %d, len = %d", type, method, len);
 
+    // Read the msg as a whole so that nothing of the next one is consumed
+    data = clientSock->read(len);
+    Q_ASSERT(quint32(data.size()) == len);
+
     if (type != PB_MSG_TYPE_REQUEST)
     {
         qDebug("server(%s): unexpected msg type %d (expected %d)", __FUNCTION__,
@@ -281,26 +493,28 @@ void RpcConnection::on_clientSock_dataAvail()
         goto _error_exit;
     }
 
-    if (isPending)
+    if (pendingRpcs.size() >= maxPendingRpcs)
     {
         qDebug("server(%s): rpc pending, try again", __FUNCTION__);
-        error = QString("RPC %1() is pending; only one RPC allowed at a time; "
-                        "try again!").arg(QString::fromStdString(
-                            service->GetDescriptor()->method(
-                                pendingMethodId)->name()));
+        if (maxPendingRpcs == 1)
+            error = QString("RPC %1() is pending; only one RPC allowed at a "
+                            "time; try again!").arg(QString::fromStdString(
+                                service->GetDescriptor()->method(
+                                    pendingRpcs.constBegin().value().methodId)->name()));
+        else
+            error = QString("%1 RPCs pending; only %2 allowed at a time; "
+                            "try again!").arg(pendingRpcs.size())
+                                         .arg(maxPendingRpcs);
         goto _error_exit;
     }
 
-    pendingMethodId = method;
-    isPending = true;
-
     req = service->GetRequestPrototype(methodDesc).New();
     resp = service->GetResponsePrototype(methodDesc).New();
 
     if (len) {
-        bool ok = req->ParseFromBoundedZeroCopyStream(inStream, len);
+        bool ok = req->ParseFromArray(data.constData(), len);
         if (!ok)
-            qWarning("ParseFromBoundedZeroCopyStream fail "
+            qWarning("ParseFromArray fail "
                      "for method %d and len %d", method, len);
     }
 
@@ -313,17 +527,15 @@ void RpcConnection::on_clientSock_dataAvail()
                 method, req->DebugString().c_str(),
                 req->InitializationErrorString().c_str());
         error = QString("RPC %1() missing required fields in request - %2")
-                    .arg(QString::fromStdString(
-                                service->GetDescriptor()->method(
-                                    pendingMethodId)->name()),
+                    .arg(QString::fromStdString(methodDesc->name()),
                         QString(req->InitializationErrorString().c_str()));
         delete req;
         delete resp;
 
-        goto _error_exit2;
+        goto _error_exit;
     }
     
-    if (method != 13) {
+    if ((method != 13) && (method != 17)) {
         qDebug("Server(%s): successfully received/parsed msg <----", __FUNCTION__);
         qDebug("method = %d\n"
                "req = \n%s---->",
@@ -332,28 +544,31 @@ void RpcConnection::on_clientSock_dataAvail()
     }
 
     controller = new PbRpcController(req, resp);
+    controller->setConnection(this);
 
-    //qDebug("before service->callmethod()");
+    rpc.methodId = method;
+    rpc.requestId = requestId;
+    pendingRpcs.insert(controller, rpc);
 
-    service->CallMethod(methodDesc, controller, req, resp,
-        google::protobuf::NewCallback(this, &RpcConnection::sendRpcReply, 
-                                      controller));
+    call.methodDesc = methodDesc;
+    call.controller = controller;
+    callQueue.append(call);
+    dispatchCall();
 
-    return;
+    return true;
 
 _error_exit:
-    inStream->Skip(len);
-_error_exit2:
     qDebug("server(%s): return error %s for msg from client", __FUNCTION__,
             qPrintable(error));
-    pendingMethodId = method;
-    isPending = true;
     controller = new PbRpcController(NULL, NULL);
     controller->SetFailed(error);
     if (disconnect)
         controller->TriggerDisconnect();
+    rpc.methodId = method;
+    rpc.requestId = requestId;
+    pendingRpcs.insert(controller, rpc);
     sendRpcReply(controller);
-    return;
+    return true;
 }
 
 void RpcConnection::connIdMsgHandler(QtMsgType /*type*/, const char* msg)
@@ -21,55 +21,99 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #define _RPC_CONNECTION_H
 
 #include <QAbstractSocket>
+#include <QHash>
+#include <QList>
+#include <QMetaType>
+#include <QSet>
 
 // forward declarations
 class PbRpcController;
 class QTcpSocket;
+class QThreadPool;
 namespace google {
     namespace protobuf {
+        class MethodDescriptor;
         class Service;
         namespace io {
-            class CopyingInputStreamAdaptor;
             class CopyingOutputStreamAdaptor;
         }
     }
 }
 
+/*
+ A client connection - its socket is serviced by the event loop of the
+ (I/O) thread it is moved to, while its RPCs are executed by pools of
+ worker threads shared by all connections - quick methods by a pool of
+ their own. RPCs of a connection are executed one at a time in the order
+ received - except that once replies carry request ids, a quick (read-only)
+ RPC doesn't wait for the executing ones to complete (see dispatchCall()).
+*/
 class RpcConnection : public QObject
 {
     Q_OBJECT
 
 public:
-    RpcConnection(int socketDescriptor, ::google::protobuf::Service *service);
+    RpcConnection(int socketDescriptor, ::google::protobuf::Service *service,
+                  QThreadPool *workers, QThreadPool *quickWorkers,
+                  const QSet<QString> &quickMethods);
     virtual ~RpcConnection();
     static void connIdMsgHandler(QtMsgType type, const char* msg);
 
-private:
-    void writeHeader(char* header, quint16 type, quint16 method, 
-                     quint32 length);
-    void sendRpcReply(PbRpcController *controller);
+public slots:
+    void sendNotification(int methodId, const QByteArray &msg);
 
 signals:
-    void closed();
+    // A notification was not sent as the client is not keeping up
+    void notificationDropped(int methodId);
+
+private:
+    int writeHeader(char* header, quint16 type, quint16 method, 
+                     quint32 length, quint32 requestId);
+    bool processRequest();
+    void dispatchCall();
+    void callDone(PbRpcController *controller);
+    void sendRpcReply(PbRpcController *controller);
+    bool isClientSlow();
 
 private slots:
     void start();
+    void callCompleted(PbRpcController *controller);
     void on_clientSock_dataAvail();
+    void on_clientSock_bytesWritten(qint64 bytes);
     void on_clientSock_error(QAbstractSocket::SocketError socketError);
     void on_clientSock_disconnected();
 
 private:
     int socketDescriptor;
     QTcpSocket *clientSock;
+    QString id;
 
     ::google::protobuf::Service *service;
-    ::google::protobuf::io::CopyingInputStreamAdaptor  *inStream;
     ::google::protobuf::io::CopyingOutputStreamAdaptor *outStream;
 
-    bool isPending;
-    int pendingMethodId;
+    QThreadPool *workers;
+    QThreadPool *quickWorkers;
+    QSet<QString> quickMethods;
+    struct QueuedCall {
+        const ::google::protobuf::MethodDescriptor *methodDesc;
+        PbRpcController *controller;
+    };
+    QList<QueuedCall> callQueue; // received, waiting for the executing ones
+    int executingCount;
+    bool isClosed;               // delete once the executing RPCs are done
+    bool isReadPaused;
+
+    struct PendingRpc {
+        int methodId;
+        quint32 requestId;
+    };
+    QHash<PbRpcController*, PendingRpc> pendingRpcs;
+    int maxPendingRpcs;
+    bool hasRequestId;
 
     bool isCompatCheckDone;
 };
 
+Q_DECLARE_METATYPE(PbRpcController*)
+
 #endif
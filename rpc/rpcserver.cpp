@@ -23,23 +23,40 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include <QThread>
 
-// FIXME: QThreadX till we change minimum version of Qt from Qt4.3+ to Qt4.4+
-class QThreadX: public QThread
-{
-protected:
-    virtual ~QThreadX() { qDebug("QThreadX going down!"); }
-    void run() { exec(); }
-};
-
 RpcServer::RpcServer()
 {
+    int ioThreadCount = qBound(1, QThread::idealThreadCount()/2, 4);
+
     service = NULL; 
 
     qInstallMsgHandler(RpcConnection::connIdMsgHandler);
+    qRegisterMetaType<PbRpcController*>("PbRpcController*");
+
+    for (int i = 0; i < ioThreadCount; i++) {
+        QThread *thread = new QThread;
+
+        thread->start();
+        ioThreads.append(thread);
+    }
+    nextIoThread = 0;
+
+    workers.setMaxThreadCount(qMax(2, QThread::idealThreadCount()));
+    quickWorkers.setMaxThreadCount(qMax(2, QThread::idealThreadCount()/2));
+
+    qDebug("%d I/O threads, %d+%d worker threads", ioThreads.size(),
+            workers.maxThreadCount(), quickWorkers.maxThreadCount());
 }
 
 RpcServer::~RpcServer()
 { 
+    foreach(QThread *thread, ioThreads) {
+        thread->quit();
+        thread->wait();
+        delete thread;
+    }
+
+    workers.waitForDone();
+    quickWorkers.waitForDone();
 }
 
 bool RpcServer::registerService(::google::protobuf::Service *service, 
@@ -60,21 +77,26 @@ bool RpcServer::registerService(::google::protobuf::Service *service,
     return true;
 }
 
-void RpcServer::incomingConnection(int socketDescriptor)
+/*!
+ Sets the methods that complete quickly without blocking (e.g. those that
+ only read state) - these are executed by a separate pool of workers.
+ Applies to connections accepted after the call
+*/
+void RpcServer::setQuickMethods(const QStringList &methodNames)
 {
-    QThread *thread = new QThreadX; // FIXME:QThreadX pending Qt4.4+
-    RpcConnection *conn = new RpcConnection(socketDescriptor, service);
-
-    conn->moveToThread(thread);
-
-    connect(thread, SIGNAL(started()), conn, SLOT(start()));
+    quickMethods = methodNames.toSet();
+}
 
-    // NOTE: conn "self-destructs" after emitting closed
-    // use 'closed' to stop execution of the thread
-    connect(conn, SIGNAL(closed()), thread, SLOT(quit()));
+void RpcServer::incomingConnection(int socketDescriptor)
+{
+    QThread *thread = ioThreads.at(nextIoThread);
+    RpcConnection *conn = new RpcConnection(socketDescriptor, service,
+                                            &workers, &quickWorkers,
+                                            quickMethods);
 
-    // setup thread to "self-destruct" when it is done
-    connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+    nextIoThread = (nextIoThread + 1) % ioThreads.size();
 
-    thread->start();
+    // NOTE: conn "self-destructs" when the client disconnects
+    conn->moveToThread(thread);
+    QMetaObject::invokeMethod(conn, "start", Qt::QueuedConnection);
 }
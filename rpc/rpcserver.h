@@ -20,7 +20,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _RPC_SERVER_H
 #define _RPC_SERVER_H
 
+#include <QList>
+#include <QSet>
+#include <QStringList>
 #include <QTcpServer>
+#include <QThreadPool>
 
 // forward declaration
 namespace google {
@@ -28,7 +32,16 @@ namespace google {
         class Service;
     }
 }
+class QThread;
 
+/*
+ Connections are serviced by a small fixed set of I/O threads - each
+ running an event loop for the sockets of the connections assigned to it.
+ The RPCs themselves are executed by a bounded pool of worker threads so
+ that a slow RPC doesn't hold up the I/O of other connections. Quick RPCs
+ (see setQuickMethods()) have a pool of their own so that they are not
+ starved by slow ones - e.g. those that wait for transmit to start or stop
+*/
 class RpcServer : public QTcpServer
 {
     Q_OBJECT
@@ -39,12 +52,19 @@ public:
 
     bool registerService(::google::protobuf::Service *service,
         quint16 tcpPortNum);
+    void setQuickMethods(const QStringList &methodNames);
 
 protected:
     void incomingConnection(int socketDescriptor);
 
 private:
     ::google::protobuf::Service *service;
+
+    QList<QThread*> ioThreads;
+    int nextIoThread;
+    QThreadPool workers;
+    QThreadPool quickWorkers;
+    QSet<QString> quickMethods;
 };
 
 #endif
@@ -24,12 +24,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #include "../common/streambase.h"
 #include "../common/abstractprotocol.h"
 
+#include <QHash>
+#include <QSet>
 #include <QString>
 #include <QIODevice>
 
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include <string.h>
 
 AbstractPort::AbstractPort(int id, const char *device)
 {
@@ -43,16 +46,26 @@ AbstractPort::AbstractPort(int id, const char *device)
     data_.set_is_exclusive_control(false);
 
     isSendQueueDirty_ = false;
+    builder_ = new PacketListBuilder(this);
+    abortPacketListUpdate_ = false;
+    frameCacheSize_ = 0;
+    rateScale_ = 1.0;
     linkState_ = OstProto::LinkStateUnknown;
     minPacketSetSize_ = 1;
 
     maxStatsValue_ = ULLONG_MAX; // assume 64-bit stats
-    memset((void*) &stats_, 0, sizeof(stats_));
+    stats_ = newStatsBlock();
     resetStats();
 }
 
 AbstractPort::~AbstractPort()
 {
+    stopPacketListUpdate();
+    delete builder_;
+
+    qDeleteAll(frameCache_);
+    qDeleteAll(usedFrameCache_);
+    qDeleteAll(statsBlocks_);
 }    
 
 void AbstractPort::init()
@@ -76,6 +89,26 @@ bool AbstractPort::modify(const OstProto::Port &port)
     if (port.has_transmit_mode())
         data_.set_transmit_mode(port.transmit_mode());
 
+    // Takes effect from the next capture start
+    if (port.has_capture_max_size())
+        data_.set_capture_max_size(port.capture_max_size());
+    if (port.has_capture_max_duration())
+        data_.set_capture_max_duration(port.capture_max_duration());
+    if (port.has_capture_file_count())
+        data_.set_capture_file_count(port.capture_file_count());
+    if (port.has_capture_filter())
+        data_.set_capture_filter(port.capture_filter());
+    if (port.has_capture_snaplen())
+        data_.set_capture_snaplen(port.capture_snaplen());
+
+    if (port.has_is_tracking_stream_stats())
+    {
+        bool val = port.is_tracking_stream_stats();
+
+        if (setStreamStatsTracking(val))
+            data_.set_is_tracking_stream_stats(val);
+    }
+
     return ret;
 }    
 
@@ -96,8 +129,13 @@ StreamBase* AbstractPort::stream(int streamId)
     return NULL;
 }
 
+// NOTE: Stream mutators wait for any packet list build in progress first as
+// the builder uses the streams without any locking
+
 bool AbstractPort::addStream(StreamBase *stream)
 {
+    builder_->wait();
+
     streamList_.append(stream);
     isSendQueueDirty_ = true;
     return true;
@@ -105,6 +143,8 @@ bool AbstractPort::addStream(StreamBase *stream)
 
 bool AbstractPort::deleteStream(int streamId)
 {
+    builder_->wait();
+
     for (int i = 0; i < streamList_.size(); i++)
     {
         StreamBase *stream;
@@ -122,6 +162,163 @@ bool AbstractPort::deleteStream(int streamId)
     return false;
 }
 
+/*!
+ Deletes all streams (if deleteAll) or those with the given ids and then
+ adds the given streams - a stream with the id of an existing stream
+ replaces it in place. Takes ownership of the streams added.
+
+ Unlike a stream() lookup per stream, this is linear in the number of
+ streams - the stream ids in streams are expected to be unique.
+*/
+void AbstractPort::changeStreams(bool deleteAll, const QList<uint> &deleteIds,
+        const QList<StreamBase*> &streams)
+{
+    QHash<uint, StreamBase*> added;
+    QSet<uint> deleted = deleteIds.toSet();
+    QList<StreamBase*> list;
+
+    builder_->wait();
+
+    foreach(StreamBase *stream, streams)
+        added.insert(stream->id(), stream);
+
+    if (deleteAll)
+    {
+        qDeleteAll(streamList_);
+        streamList_.clear();
+    }
+
+    foreach(StreamBase *stream, streamList_)
+    {
+        StreamBase *replacement = added.take(stream->id());
+
+        if (replacement)
+        {
+            list.append(replacement);
+            delete stream;
+        }
+        else if (deleted.contains(stream->id()))
+            delete stream;
+        else
+            list.append(stream);
+    }
+
+    // New streams are appended in the given order
+    foreach(StreamBase *stream, streams)
+    {
+        if (added.contains(stream->id()))
+            list.append(stream);
+    }
+
+    streamList_ = list;
+    isSendQueueDirty_ = true;
+}
+
+bool AbstractPort::modifyStream(const OstProto::Stream &config)
+{
+    StreamBase *stream;
+
+    builder_->wait();
+
+    stream = this->stream(config.stream_id().id());
+    if (!stream)
+        return false;
+
+    stream->protoDataCopyFrom(config);
+    isSendQueueDirty_ = true;
+    return true;
+}
+
+/*!
+ Returns true if the rate of a continuous stream can be changed without
+ rebuilding the packet list (and hence while transmit is on) - possible
+ only if the stream is the only enabled stream and nothing but the rate is
+ being changed. Nothing is changed.
+*/
+bool AbstractPort::canModifyStreamRate(const OstProto::Stream &config)
+{
+    StreamBase *stream;
+    OstProto::Stream current, changed;
+    OstProto::StreamControl *control;
+    double oldPacketRate, oldBurstRate;
+    double oldRate, newRate;
+    int enabled = 0;
+
+    // Transmit is on - the packet list of a continuous stream is built
+    // quickly, anything else is rebuilding for too long to wait for
+    if (!builder_->wait(kRateChangeBuildWait))
+        return false;
+
+    stream = this->stream(config.stream_id().id());
+    if (!stream || !stream->isEnabled() 
+            || (stream->sendMode() != StreamBase::e_sm_continuous))
+        return false;
+
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        if (streamList_.at(i)->isEnabled())
+            enabled++;
+    }
+    if (enabled != 1)
+        return false;
+
+    stream->protoDataCopyInto(current);
+
+    changed.CopyFrom(config);
+    control = changed.mutable_control();
+    if (current.control().has_packets_per_sec())
+        control->set_packets_per_sec(current.control().packets_per_sec());
+    else
+        control->clear_packets_per_sec();
+    if (current.control().has_bursts_per_sec())
+        control->set_bursts_per_sec(current.control().bursts_per_sec());
+    else
+        control->clear_bursts_per_sec();
+
+    if (changed.SerializeAsString() != current.SerializeAsString())
+        return false;
+
+    // Try out the new rate - the stream is left as it was
+    oldPacketRate = stream->packetRate();
+    oldBurstRate = stream->burstRate();
+    oldRate = stream->averagePacketRate();
+    if (config.control().has_packets_per_sec())
+        stream->setPacketRate(config.control().packets_per_sec());
+    if (config.control().has_bursts_per_sec())
+        stream->setBurstRate(config.control().bursts_per_sec());
+    newRate = stream->averagePacketRate();
+    stream->setPacketRate(oldPacketRate);
+    stream->setBurstRate(oldBurstRate);
+
+    return (oldRate > 0) && (newRate > 0);
+}
+
+/*!
+ Changes the rate of a continuous stream, if canModifyStreamRate(), by
+ scaling the gaps of the current packet list
+*/
+bool AbstractPort::modifyStreamRate(const OstProto::Stream &config)
+{
+    StreamBase *stream;
+    double oldRate;
+
+    if (!canModifyStreamRate(config))
+        return false;
+
+    // Change only the rate - the stream's protocols are left as is
+    stream = this->stream(config.stream_id().id());
+    oldRate = stream->averagePacketRate();
+    if (config.control().has_packets_per_sec())
+        stream->setPacketRate(config.control().packets_per_sec());
+    if (config.control().has_bursts_per_sec())
+        stream->setBurstRate(config.control().bursts_per_sec());
+
+    rateScale_ *= oldRate/stream->averagePacketRate();
+    setTransmitRateScale(rateScale_);
+
+    return true;
+}
+
 void AbstractPort::addNote(QString note)
 {
     QString notes = QString::fromStdString(data_.notes());
@@ -141,6 +338,64 @@ void AbstractPort::addNote(QString note)
 }
 
 void AbstractPort::updatePacketList()
+{
+    sortStreams();
+    clearPacketList();
+    rateScale_ = 1.0;
+    updateTxStreamStats();
+    buildPacketList();
+}
+
+/*!
+ Starts building the packet list in the background - the port's transmitter
+ may be started right after and sends the packets as they are built.
+
+ If the transmitter releases packets it has sent while the packet list is
+ still being built, the port is left dirty for the next transmit - else the
+ packet list is reused by the next transmit as usual.
+*/
+void AbstractPort::startPacketListUpdate()
+{
+    stopPacketListUpdate();
+
+    // Whatever the builder doesn't need to do itself is done here so that
+    // the stream list and rate scale are not changed in its thread
+    sortStreams();
+    clearPacketList();
+    rateScale_ = 1.0;
+    updateTxStreamStats();
+    builder_->start();
+}
+
+void AbstractPort::stopPacketListUpdate()
+{
+    abortPacketListUpdate_ = true;
+    builder_->wait();
+    abortPacketListUpdate_ = false;
+}
+
+/*!
+ Waits for the packet list update started by startPacketListUpdate() to
+ finish - transmit must not have been started meanwhile, so the packet
+ list is complete and the port is no longer dirty
+*/
+void AbstractPort::waitForPacketListUpdate()
+{
+    Q_ASSERT(!isTransmitOn());
+
+    builder_->wait();
+}
+
+void AbstractPort::PacketListBuilder::run()
+{
+    port_->buildPacketList();
+
+    // An aborted build or a list with released packets can't be reused
+    if (port_->abortPacketListUpdate_ || !port_->isPacketListComplete())
+        port_->setDirty();
+}
+
+void AbstractPort::buildPacketList()
 {
     switch(data_.transmit_mode())
     {
@@ -154,6 +409,128 @@ void AbstractPort::updatePacketList()
         Q_ASSERT(false); // Unreachable!!!
         break;
     }
+
+    finishPacketList();
+
+    // Whatever was not used by this rebuild is stale
+    foreach(StreamFrames *frames, frameCache_)
+    {
+        frameCacheSize_ -= frames->size;
+        delete frames;
+    }
+    frameCache_ = usedFrameCache_;
+    usedFrameCache_.clear();
+}
+
+// The packet list has the streams in the order of their ordinal values
+void AbstractPort::sortStreams()
+{
+    qSort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
+}
+
+// Streams whose frames will carry a signature - transmit is off here
+void AbstractPort::updateTxStreamStats()
+{
+    QList<uint> streamIds;
+
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        if (streamList_[i]->isEnabled() && streamList_[i]->isTrackingStats())
+            streamIds.append(streamList_[i]->id());
+    }
+
+    streamStats_.setTxStreams(streamIds);
+}
+
+AbstractPort::StreamFrames* AbstractPort::streamFrames(StreamBase *stream)
+{
+    OstProto::Stream content;
+    std::string key;
+    StreamFrames *frames;
+
+    // Fields that don't affect frame contents are excluded from the key
+    stream->protoDataCopyInto(content);
+    content.clear_stream_id();
+    content.clear_control();
+    content.mutable_core()->clear_name();
+    content.mutable_core()->clear_is_enabled();
+    content.mutable_core()->clear_ordinal();
+    content.SerializeToString(&key);
+
+    QByteArray cacheKey(key.data(), key.size());
+
+    frames = usedFrameCache_.value(cacheKey);
+    if (!frames)
+    {
+        frames = frameCache_.take(cacheKey);
+        if (!frames)
+        {
+            frames = new StreamFrames;
+            frames->isCacheable = !stream->isFrameValueRandom();
+            frames->size = 0;
+            frames->isTemplateCompiled = false;
+        }
+        usedFrameCache_.insert(cacheKey, frames);
+    }
+
+    return frames;
+}
+
+/*!
+ Same as StreamBase::frameValue() but returns a cached frame if available
+ and caches the frame otherwise (frames are cached in order of frameIndex,
+ except for a stream with random fields)
+
+ Frames not in the cache are generated from the stream's frame template
+ where possible
+
+ The stream stats signature, if any, is not cached - so that the cache
+ doesn't depend on stream control
+*/
+int AbstractPort::frameValue(StreamBase *stream, StreamFrames *frames,
+        uchar *buf, int bufMaxSize, int frameIndex)
+{
+    int len;
+
+    if (frameIndex < frames->frames.size())
+    {
+        const QByteArray &frame = frames->frames.at(frameIndex);
+
+        len = qMin(frame.size(), bufMaxSize);
+        memcpy(buf, frame.constData(), len);
+        goto _signature;
+    }
+
+    if (!frames->isTemplateCompiled)
+    {
+        frames->frameTemplate.compile(stream, bufMaxSize);
+        frames->isTemplateCompiled = true;
+    }
+
+    if (frames->frameTemplate.isValid())
+        len = frames->frameTemplate.frameValue(buf, bufMaxSize, frameIndex);
+    else
+        len = stream->frameValue(buf, bufMaxSize, frameIndex);
+
+    if (frames->isCacheable
+            && (frameIndex == frames->frames.size())
+            && ((frameCacheSize_ + len) <= kMaxFrameCacheSize))
+    {
+        if (len > 0)
+        {
+            frames->frames.append(QByteArray((const char*) buf, len));
+            frames->size += len;
+            frameCacheSize_ += len;
+        }
+        else
+            frames->frames.append(QByteArray());
+    }
+
+_signature:
+    if ((len > 0) && stream->isTrackingStats())
+        StreamStats::writeSignature(buf, len, id(), stream->id());
+
+    return len;
 }
 
 void AbstractPort::updatePacketListSequential()
@@ -163,10 +540,21 @@ void AbstractPort::updatePacketListSequential()
 
     qDebug("In %s", __FUNCTION__);
 
-    // First sort the streams by ordinalValue
-    qSort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
-
-    clearPacketList();
+    // Sent packets may be released while the list is being built unless
+    // the list loops - so let the transmitter know upfront if it does
+    for (int i = 0; i < streamList_.size(); i++)
+    {
+        if (!streamList_[i]->isEnabled())
+            continue;
+        if ((streamList_[i]->sendMode() == StreamBase::e_sm_continuous)
+                || (streamList_[i]->nextWhat() == StreamBase::e_nw_stop))
+            break;
+        if (streamList_[i]->nextWhat() == StreamBase::e_nw_goto_id)
+        {
+            setPacketListLoopMode(true, 0, 0);
+            break;
+        }
+    }
 
     for (int i = 0; i < streamList_.size(); i++)
     {
@@ -184,6 +572,9 @@ void AbstractPort::updatePacketListSequential()
             quint64 npy1 = 0, npy2 = 0;
             quint64 loopDelay;
             ulong frameVariableCount = streamList_[i]->frameVariableCount();
+            bool isContinuous = (streamList_[i]->sendMode() 
+                                    == StreamBase::e_sm_continuous);
+            StreamFrames *frames = streamFrames(streamList_[i]);
 
             // We derive n, x, y such that
             // n * x + y = total number of packets to be sent
@@ -233,6 +624,15 @@ void AbstractPort::updatePacketListSequential()
                 continue;
             }
 
+            // A continuous stream is a single packet set of x packets
+            // repeated till transmit is stopped - memory used doesn't
+            // depend on how long it runs
+            if (isContinuous)
+            {
+                n = 1;
+                y = 0;
+            }
+
             qDebug("\nframeVariableCount = %lu", frameVariableCount);
             qDebug("n = %lu, x = %lu, y = %lu, burstSize = %lu",
                     n, x, y, burstSize);
@@ -251,17 +651,21 @@ void AbstractPort::updatePacketListSequential()
             qDebug("npx2 = %" PRIu64, npx2);
             qDebug("npy2 = %" PRIu64 "\n", npy2);
 
-            if (n > 1)
+            if (isContinuous)
+                loopNextPacketSet(x, -1, 0, loopDelay);
+            else if (n > 1)
                 loopNextPacketSet(x, n, 0, loopDelay);
             else if (n == 0)
                 x = 0;
 
             for (uint j = 0; j < (x+y); j++)
             {
-                
+                if (abortPacketListUpdate_)
+                    goto _stop_no_more_pkts;
+
                 if (j == 0 || frameVariableCount > 1)
                 {
-                    len = streamList_[i]->frameValue(
+                    len = frameValue(streamList_[i], frames,
                             pktBuf_, sizeof(pktBuf_), j);
                 }
                 if (len <= 0)
@@ -296,6 +700,10 @@ void AbstractPort::updatePacketListSequential()
                 }
             }
 
+            // Streams after a continuous stream are never reached
+            if (isContinuous)
+                goto _stop_no_more_pkts;
+
             switch(streamList_[i]->nextWhat())
             {
                 case ::OstProto::StreamControl::e_nw_stop:
@@ -350,13 +758,12 @@ void AbstractPort::updatePacketListInterleaved()
     QList<bool> isVariable;
     QList<QByteArray> pktBuf;
     QList<ulong> pktLen;
+    QList<StreamFrames*> frames;
 
     qDebug("In %s", __FUNCTION__);
 
-    // First sort the streams by ordinalValue
-    qSort(streamList_.begin(), streamList_.end(), StreamBase::StreamLessThan);
-
-    clearPacketList();
+    // Always loops - the actual loop delay is set at the end
+    setPacketListLoopMode(true, 0, 0);
 
     for (int i = 0; i < streamList_.size(); i++)
     {
@@ -460,6 +867,8 @@ void AbstractPort::updatePacketListInterleaved()
         pktCount.append(0);
         burstCount.append(0);
 
+        frames.append(streamFrames(streamList_[i]));
+
         if (streamList_[i]->isFrameVariable())
         {
             isVariable.append(true);
@@ -471,7 +880,7 @@ void AbstractPort::updatePacketListInterleaved()
             isVariable.append(false);
             pktBuf.append(QByteArray());
             pktBuf.last().resize(kMaxPktSize);
-            pktLen.append(streamList_[i]->frameValue(
+            pktLen.append(frameValue(streamList_[i], frames.last(),
                     (uchar*)pktBuf.last().data(), pktBuf.last().size(), 0));
         }
 
@@ -491,6 +900,9 @@ void AbstractPort::updatePacketListInterleaved()
     quint64 lastPktTxNsec = 0;
     do
     {
+        if (abortPacketListUpdate_)
+            break;
+
         for (int i = 0; i < numStreams; i++)
         {
             // If a packet is not scheduled yet, look at the next stream
@@ -502,8 +914,8 @@ void AbstractPort::updatePacketListInterleaved()
                 if (isVariable.at(i))
                 {
                     buf = pktBuf_;
-                    len = streamList_[i]->frameValue(pktBuf_, sizeof(pktBuf_), 
-                            pktCount[i]);
+                    len = frameValue(streamList_[i], frames.at(i),
+                            pktBuf_, sizeof(pktBuf_), pktCount[i]);
                 }
                 else
                 {
@@ -559,36 +971,126 @@ void AbstractPort::updatePacketListInterleaved()
     isSendQueueDirty_ = false;
 }
 
+// Difference of a counter since the epoch - NIC counters may wrap around
+#define EPOCH_DELTA(field) \
+    ((current.field >= epochStats_.field) ? \
+        current.field - epochStats_.field : \
+        current.field + (maxStatsValue_ - epochStats_.field))
+
 void AbstractPort::stats(PortStats *stats)
 {
-    stats->rxPkts = (stats_.rxPkts >= epochStats_.rxPkts) ?
-                        stats_.rxPkts - epochStats_.rxPkts :
-                        stats_.rxPkts + (maxStatsValue_ - epochStats_.rxPkts);
-    stats->rxBytes = (stats_.rxBytes >= epochStats_.rxBytes) ?
-                        stats_.rxBytes - epochStats_.rxBytes :
-                        stats_.rxBytes + (maxStatsValue_ - epochStats_.rxBytes);
-    stats->rxPps = stats_.rxPps; 
-    stats->rxBps = stats_.rxBps; 
-
-    stats->txPkts = (stats_.txPkts >= epochStats_.txPkts) ?
-                        stats_.txPkts - epochStats_.txPkts :
-                        stats_.txPkts + (maxStatsValue_ - epochStats_.txPkts);
-    stats->txBytes = (stats_.txBytes >= epochStats_.txBytes) ?
-                        stats_.txBytes - epochStats_.txBytes :
-                        stats_.txBytes + (maxStatsValue_ - epochStats_.txBytes);
-    stats->txPps = stats_.txPps; 
-    stats->txBps = stats_.txBps; 
-
-    stats->rxDrops = (stats_.rxDrops >= epochStats_.rxDrops) ?
-                        stats_.rxDrops - epochStats_.rxDrops :
-                        stats_.rxDrops + (maxStatsValue_ - epochStats_.rxDrops);
-    stats->rxErrors = (stats_.rxErrors >= epochStats_.rxErrors) ?
-                        stats_.rxErrors - epochStats_.rxErrors :
-                        stats_.rxErrors + (maxStatsValue_ - epochStats_.rxErrors);
-    stats->rxFifoErrors = (stats_.rxFifoErrors >= epochStats_.rxFifoErrors) ?
-                        stats_.rxFifoErrors - epochStats_.rxFifoErrors :
-                        stats_.rxFifoErrors + (maxStatsValue_ - epochStats_.rxFifoErrors);
-    stats->rxFrameErrors = (stats_.rxFrameErrors >= epochStats_.rxFrameErrors) ?
-                        stats_.rxFrameErrors - epochStats_.rxFrameErrors :
-                        stats_.rxFrameErrors + (maxStatsValue_ - epochStats_.rxFrameErrors);
+    PortStats current;
+
+    snapshotStats(&current);
+
+    stats->rxPkts = EPOCH_DELTA(rxPkts);
+    stats->rxBytes = EPOCH_DELTA(rxBytes);
+    stats->rxPps = current.rxPps; 
+    stats->rxBps = current.rxBps; 
+
+    stats->txPkts = EPOCH_DELTA(txPkts);
+    stats->txBytes = EPOCH_DELTA(txBytes);
+    stats->txPps = current.txPps; 
+    stats->txBps = current.txBps; 
+
+    stats->rxDrops = EPOCH_DELTA(rxDrops);
+    stats->rxErrors = EPOCH_DELTA(rxErrors);
+    stats->rxFifoErrors = EPOCH_DELTA(rxFifoErrors);
+    stats->rxFrameErrors = EPOCH_DELTA(rxFrameErrors);
+
+    stats->txDrops = EPOCH_DELTA(txDrops);
+    stats->txErrors = EPOCH_DELTA(txErrors);
+
+    // Maintained by us (not the NIC) - so never wrap around
+    stats->capKernelDrops = current.capKernelDrops - epochStats_.capKernelDrops;
+    stats->capRingDrops = current.capRingDrops - epochStats_.capRingDrops;
+}
+
+#undef EPOCH_DELTA
+
+void AbstractPort::resetStats()
+{
+    snapshotStats(&epochStats_);
+    rateMeter_.reset();
+}
+
+/*!
+ Returns a new stats block for a thread that updates the port stats -
+ to be called only while setting up the port (constructor or init())
+ before the port's threads are started; the block is owned by the port
+*/
+AbstractPort::StatsBlock* AbstractPort::newStatsBlock()
+{
+    StatsBlock *block = new StatsBlock;
+
+    statsBlocks_.append(block);
+    return block;
+}
+
+// Sum of the stats blocks of all threads - a counter is usually updated
+// by only one of them
+void AbstractPort::snapshotStats(PortStats *stats)
+{
+    const int kCounterCount = sizeof(PortStats)/sizeof(quint64);
+    quint64 *sum = (quint64*) stats;
+
+    memset(stats, 0, sizeof(*stats));
+    foreach(const StatsBlock *block, statsBlocks_)
+    {
+        PortStats blockStats;
+        const quint64 *counter = (const quint64*) &blockStats;
+
+        block->read(&blockStats);
+        for (int i = 0; i < kCounterCount; i++)
+            sum[i] += counter[i];
+    }
+}
+
+/*!
+ Samples the port counters for the rate meter - to be called by the
+ stats monitor right after it updates the counters; the per second
+ rates (rxPps etc.) are also updated
+*/
+void AbstractPort::sampleRates()
+{
+    PortStats current;
+    quint64 counter[RateMeter::kCounterCount];
+    quint64 rate[RateMeter::kCounterCount];
+
+    snapshotStats(&current);
+    counter[RateMeter::kRxPkts] = current.rxPkts;
+    counter[RateMeter::kRxBytes] = current.rxBytes;
+    counter[RateMeter::kTxPkts] = current.txPkts;
+    counter[RateMeter::kTxBytes] = current.txBytes;
+
+    rateMeter_.addSample(counter, maxStatsValue_);
+
+    if (rateMeter_.perSecondRates(rate))
+    {
+        PortStats *stats = stats_->beginUpdate();
+
+        stats->rxPps = rate[RateMeter::kRxPkts];
+        stats->rxBps = rate[RateMeter::kRxBytes];
+        stats->txPps = rate[RateMeter::kTxPkts];
+        stats->txBps = rate[RateMeter::kTxBytes];
+        stats_->endUpdate();
+    }
+}
+
+AbstractPort::StatsBlock::StatsBlock()
+{
+    seq_ = 0;
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+void AbstractPort::StatsBlock::read(PortStats *stats) const
+{
+    quint32 seq;
+
+    do
+    {
+        seq = __atomic_load_n(&seq_, __ATOMIC_ACQUIRE);
+        memcpy(stats, &stats_, sizeof(*stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || (seq != __atomic_load_n(&seq_, __ATOMIC_RELAXED)));
 }
@@ -20,9 +20,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _SERVER_ABSTRACT_PORT_H
 #define _SERVER_ABSTRACT_PORT_H
 
+#include <QByteArray>
+#include <QHash>
 #include <QList>
+#include <QSharedPointer>
+#include <QThread>
 #include <QtGlobal>
 
+#include "ratemeter.h"
+#include "startbarrier.h"
+#include "streamstats.h"
+#include "../common/frametemplate.h"
 #include "../common/protocol.pb.h"
 
 class StreamBase;
@@ -47,6 +55,44 @@ public:
         quint64    txBytes;
         quint64    txPps;
         quint64    txBps;
+
+        quint64    txDrops;
+        quint64    txErrors;
+
+        quint64    capKernelDrops; // dropped by the kernel while capturing
+        quint64    capRingDrops;   // capture buffer full
+    };
+
+    // Stats updated by a single thread - a stats monitor, a transmitter,
+    // a capturer etc. The writer brackets its updates with beginUpdate()
+    // and endUpdate(), readers retry if the seqlock changes during read()
+    // - so the writer never waits and readers never see torn counters.
+    // Padded so that blocks of different writers don't share cache lines
+    class StatsBlock
+    {
+    public:
+        StatsBlock();
+
+        PortStats* beginUpdate() {
+            __atomic_store_n(&seq_, seq_ + 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            return &stats_;
+        }
+        void endUpdate() {
+            __atomic_store_n(&seq_, seq_ + 1, __ATOMIC_RELEASE);
+        }
+        // For the writer only - to read back what it wrote
+        const PortStats* stats() const { return &stats_; }
+
+        void read(PortStats *stats) const;
+
+    private:
+        static const int kCacheLineSize = 64;
+
+        char        padBefore_[kCacheLineSize];
+        quint32     seq_; // odd while an update is in progress
+        PortStats   stats_;
+        char        padAfter_[kCacheLineSize];
     };
 
     AbstractPort(int id, const char *device);
@@ -65,12 +111,18 @@ public:
     virtual OstProto::LinkState linkState() { return linkState_; }
     virtual bool hasExclusiveControl() = 0;
     virtual bool setExclusiveControl(bool exclusive) = 0;
+    virtual bool setStreamStatsTracking(bool enable) = 0;
 
     int streamCount() { return streamList_.size(); }
     StreamBase* streamAtIndex(int index);
     StreamBase* stream(int streamId);
     bool addStream(StreamBase *stream);
     bool deleteStream(int streamId);
+    void changeStreams(bool deleteAll, const QList<uint> &deleteIds,
+            const QList<StreamBase*> &streams);
+    bool modifyStream(const OstProto::Stream &stream);
+    bool canModifyStreamRate(const OstProto::Stream &stream);
+    bool modifyStreamRate(const OstProto::Stream &stream);
 
     bool isDirty() { return isSendQueueDirty_; }
     void setDirty() { isSendQueueDirty_ = true; }
@@ -82,9 +134,20 @@ public:
             int length) = 0;
     virtual void setPacketListLoopMode(bool loop, 
             quint64 secDelay, quint64 nsecDelay) = 0;
+    virtual void finishPacketList() = 0;
+    // True if the list has all its packets i.e. none have been released
+    // by the transmitter (only once the list is finished)
+    virtual bool isPacketListComplete() = 0;
+    virtual void setTransmitRateScale(double scale) = 0;
     void updatePacketList();
+    void startPacketListUpdate();
+    void stopPacketListUpdate();
+    void waitForPacketListUpdate();
 
     virtual void startTransmit() = 0;
+    // Starts transmit with the first packet held till barrier is released
+    // - to start transmit on multiple ports together
+    virtual void armTransmit(QSharedPointer<StartBarrier> barrier) = 0;
     virtual void stopTransmit() = 0;
     virtual bool isTransmitOn() = 0;
 
@@ -92,9 +155,24 @@ public:
     virtual void stopCapture() = 0;
     virtual bool isCaptureOn() = 0;
     virtual QIODevice* captureData() = 0;
+    virtual bool captureChunk(quint64 offset, int maxLength, bool compress,
+            OstProto::CaptureChunk *chunk) = 0;
 
     void stats(PortStats *stats);
-    void resetStats() { epochStats_ = stats_; }
+    void resetStats();
+
+    void setRateWindows(const QList<int> &msecWindows) {
+        rateMeter_.setWindows(msecWindows);
+    }
+    void sampleRates();
+    QList<RateMeter::WindowRates> windowRates() {
+        return rateMeter_.windowRates();
+    }
+
+    void streamStats(OstProto::StreamStatsList *list) {
+        streamStats_.protoDataCopyInto(id(), list);
+    }
+    void resetStreamStats() { streamStats_.clear(); }
 
 protected:
     void addNote(QString note);
@@ -107,12 +185,55 @@ protected:
     OstProto::LinkState     linkState_;
     ulong minPacketSetSize_;
 
+    StatsBlock* newStatsBlock();
+
     quint64 maxStatsValue_;
-    struct PortStats    stats_;
-    //! \todo Need lock for stats access/update
+    StatsBlock          *stats_; // of the thread that calls sampleRates()
+    RateMeter           rateMeter_;
+    StreamStats         streamStats_;
 
 private:
+    // Builds the packet list in the background so that transmit can start
+    // right away and consume the packet list as it is being built
+    class PacketListBuilder: public QThread
+    {
+    public:
+        PacketListBuilder(AbstractPort *port) { port_ = port; }
+        void run();
+    private:
+        AbstractPort *port_;
+    };
+
+    void buildPacketList();
+    void sortStreams();
+    void updateTxStreamStats();
+
+    // Frames of each stream are cached across packet list rebuilds keyed
+    // by the stream's contents (except stream control) - so a rebuild has
+    // to generate frames only for new or changed streams. Frames of streams
+    // with random fields are not cached so that they don't repeat
+    struct StreamFrames
+    {
+        QList<QByteArray> frames;
+        bool isCacheable;
+        qint64 size;
+        FrameTemplate frameTemplate; // for frames not in the cache
+        bool isTemplateCompiled;
+    };
+    static const qint64 kMaxFrameCacheSize = 128*1024*1024;
+    StreamFrames* streamFrames(StreamBase *stream);
+    int frameValue(StreamBase *stream, StreamFrames *frames, 
+            uchar *buf, int bufMaxSize, int frameIndex);
+
+    QHash<QByteArray, StreamFrames*> frameCache_; // built by last rebuild
+    QHash<QByteArray, StreamFrames*> usedFrameCache_; // used by this one
+    qint64 frameCacheSize_;
+
     bool    isSendQueueDirty_;
+    PacketListBuilder *builder_;
+    volatile bool abortPacketListUpdate_;
+    static const int kRateChangeBuildWait = 1000; // msec
+    double  rateScale_; // of the current packet list
 
     static const int kMaxPktSize = 16384;
     uchar   pktBuf_[kMaxPktSize];
@@ -120,6 +241,9 @@ private:
     /*! \note StreamBase::id() and index into streamList[] are NOT same! */
     QList<StreamBase*>  streamList_;
 
+    void snapshotStats(PortStats *stats);
+
+    QList<StatsBlock*>  statsBlocks_;
     struct PortStats    epochStats_;
 
 };
@@ -66,7 +66,12 @@ BsdPort::BsdPort(int id, const char *device)
     qDebug("adding dev to all ports list <%s>", device);
     allPorts_.append(this);
 
+#ifdef Q_OS_MAC
+    // struct if_data counters are 32 bit on OS X
+    maxStatsValue_ = kMaxValue32;
+#else
     maxStatsValue_ = ULONG_MAX;
+#endif
 }
 
 BsdPort::~BsdPort()
@@ -145,7 +150,7 @@ void BsdPort::StatsMonitor::run()
 {
     int mib[] = {CTL_NET, PF_ROUTE, 0, 0, NET_RT_IFLIST, 0};
     const int mibLen = sizeof(mib)/sizeof(mib[0]);
-    QHash<uint, PortStats*> portStats;
+    QHash<uint, StatsBlock*> portStats;
     QHash<uint, OstProto::LinkState*> linkState;
     int sd;
     QByteArray buf;
@@ -200,7 +205,7 @@ void BsdPort::StatsMonitor::run()
                 if (strncmp(port->name(), sdl->sdl_data, sdl->sdl_nlen) == 0)
                 {
                     Q_ASSERT(ifm->ifm_index == sdl->sdl_index);
-                    portStats[uint(ifm->ifm_index)] = &(port->stats_);
+                    portStats[uint(ifm->ifm_index)] = port->stats_;
                     linkState[uint(ifm->ifm_index)] = &(port->linkState_);
 
                     // Set promisc mode, if not already set
@@ -272,16 +277,17 @@ void BsdPort::StatsMonitor::run()
         while (p < end)
         {
             struct if_msghdr *ifm = (struct if_msghdr*) p;
-            AbstractPort::PortStats *stats;
+            AbstractPort::StatsBlock *block;
 
             if (ifm->ifm_type != RTM_IFINFO)
                 goto _next;
 
-            stats = portStats[ifm->ifm_index];
-            if (stats)
+            block = portStats[ifm->ifm_index];
+            if (block)
             {
                 struct if_data *ifd = &(ifm->ifm_data);
                 OstProto::LinkState *state = linkState[ifm->ifm_index];
+                AbstractPort::PortStats *stats;
                 u_long in_packets;
 
                 Q_ASSERT(state);
@@ -292,40 +298,30 @@ void BsdPort::StatsMonitor::run()
                 *state = (OstProto::LinkState) ifd->ifi_link_state;
 #endif
 
+                // Rates are computed by sampleRates() once all ports
+                // are updated
                 in_packets = ifd->ifi_ipackets + ifd->ifi_noproto;
-                stats->rxPps = 
-                    ((in_packets >= stats->rxPkts) ?
-                         in_packets - stats->rxPkts :
-                         in_packets + (kMaxValue32 - stats->rxPkts))
-                     / kRefreshFreq_;
-                stats->rxBps  = 
-                    ((ifd->ifi_ibytes >= stats->rxBytes) ?
-                         ifd->ifi_ibytes - stats->rxBytes :
-                         ifd->ifi_ibytes + (kMaxValue32 - stats->rxBytes))
-                     / kRefreshFreq_;
+                stats = block->beginUpdate();
                 stats->rxPkts  = in_packets;
                 stats->rxBytes = ifd->ifi_ibytes;
-                stats->txPps  = 
-                    ((ifd->ifi_opackets >= stats->txPkts) ?
-                         ifd->ifi_opackets - stats->txPkts :
-                         ifd->ifi_opackets + (kMaxValue32 - stats->txPkts))
-                     / kRefreshFreq_;
-                stats->txBps  = 
-                    ((ifd->ifi_obytes >= stats->txBytes) ?
-                         ifd->ifi_obytes - stats->txBytes :
-                         ifd->ifi_obytes + (kMaxValue32 - stats->txBytes))
-                     / kRefreshFreq_;
                 stats->txPkts  = ifd->ifi_opackets;
                 stats->txBytes = ifd->ifi_obytes;
 
                 stats->rxDrops = ifd->ifi_iqdrops;
                 stats->rxErrors = ifd->ifi_ierrors;
+
+                stats->txErrors = ifd->ifi_oerrors;
+                block->endUpdate();
             }
 _next:
             p += ifm->ifm_msglen;
         }
+
+        foreach(BsdPort* port, allPorts_)
+            port->sampleRates();
+
 _try_later:
-        QThread::sleep(kRefreshFreq_);
+        QThread::msleep(kRefreshInterval_);
     }
 
     portStats.clear();
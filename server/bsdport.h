@@ -46,7 +46,8 @@ protected:
         void stop();
         bool waitForSetupFinished(int msecs = 10000);
     private:
-        static const int kRefreshFreq_ = 1; // in seconds
+        // Short enough for the shortest rate window (see RateMeter)
+        static const int kRefreshInterval_ = 100; // in msec
         bool stop_;
         bool setupDone_;
     };
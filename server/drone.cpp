@@ -43,6 +43,12 @@ bool Drone::init()
 {
     Q_ASSERT(rpcServer);
 
+    // Read-only RPCs polled by clients mustn't wait behind those that
+    // block for a while (start/stop transmit or capture, port config)
+    rpcServer->setQuickMethods(QStringList()
+            << "getPortIdList" << "getPortConfig" << "getStats"
+            << "getStreamStats" << "getCaptureChunk" << "checkVersion");
+
     if (!rpcServer->registerService(service, myport ? myport : 7878))
     {
         //qCritical(qPrintable(rpcServer->errorString()));
@@ -30,17 +30,22 @@ win32 {
 }
 LIBS += -lm
 LIBS += -lprotobuf
-HEADERS += drone.h 
+HEADERS += drone.h statspublisher.h
 SOURCES += \
     drone_main.cpp \
     drone.cpp \
     portmanager.cpp \
     abstractport.cpp \
+    latencyhistogram.cpp \
+    ratemeter.cpp \
+    startbarrier.cpp \
+    streamstats.cpp \
     pcapport.cpp \
     bsdport.cpp \
     linuxport.cpp \
     winpcapport.cpp 
 SOURCES += myservice.cpp 
+SOURCES += statspublisher.cpp 
 SOURCES += pcapextra.cpp 
 
 QMAKE_DISTCLEAN += object_script.*
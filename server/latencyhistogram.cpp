@@ -0,0 +1,123 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "latencyhistogram.h"
+
+#include <math.h>
+#include <string.h>
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+void LatencyHistogram::add(quint64 value)
+{
+    buckets_[bucketIndex(value)]++;
+    count_++;
+}
+
+void LatencyHistogram::reset()
+{
+    count_ = 0;
+    memset(buckets_, 0, sizeof(buckets_));
+}
+
+/*!
+ Returns the value that percent% of the values are at or below - to within
+ the precision of the buckets (the middle of the bucket is returned)
+*/
+quint64 LatencyHistogram::percentile(double percent) const
+{
+    quint64 rank, seen = 0;
+
+    if (!count_)
+        return 0;
+
+    rank = quint64(ceil(count_ * qBound(0.0, percent, 100.0) / 100));
+    if (!rank)
+        rank = 1;
+
+    for (int i = 0; i < kBucketCount; i++)
+    {
+        seen += buckets_[i];
+        if (seen >= rank)
+            return (bucketMin(i) + bucketMax(i))/2;
+    }
+
+    return bucketMax(kBucketCount - 1); // unreachable
+}
+
+void LatencyHistogram::protoDataCopyInto(OstProto::Histogram *histogram) const
+{
+    histogram->set_count(count_);
+    histogram->set_p50(percentile(50));
+    histogram->set_p99(percentile(99));
+    histogram->set_p999(percentile(99.9));
+
+    for (int i = 0; i < kBucketCount; i++)
+    {
+        if (!buckets_[i])
+            continue;
+
+        histogram->add_bucket_min(bucketMin(i));
+        histogram->add_bucket_max(bucketMax(i));
+        histogram->add_bucket_count(buckets_[i]);
+    }
+}
+
+// Values below 2*kSubBucketHalfCount map to themselves; beyond that, each
+// power of 2 range [2^k, 2^(k+1)) is split into kSubBucketHalfCount
+// buckets of width 2^(k - kSubBucketBits + 1)
+int LatencyHistogram::bucketIndex(quint64 value)
+{
+    int msb = 63, shift;
+    int index;
+
+    if (value < quint64(2*kSubBucketHalfCount))
+        return int(value);
+
+    while (!(value & (quint64(1) << msb)))
+        msb--;
+    shift = msb - (kSubBucketBits - 1);
+
+    index = shift*kSubBucketHalfCount + int(value >> shift);
+
+    return qMin(index, kBucketCount - 1);
+}
+
+quint64 LatencyHistogram::bucketMin(int index)
+{
+    int shift = index/kSubBucketHalfCount - 1;
+
+    if (index < 2*kSubBucketHalfCount)
+        return quint64(index);
+
+    return quint64(index%kSubBucketHalfCount + kSubBucketHalfCount) << shift;
+}
+
+quint64 LatencyHistogram::bucketMax(int index)
+{
+    int shift = index/kSubBucketHalfCount - 1;
+
+    if (index < 2*kSubBucketHalfCount)
+        return quint64(index);
+
+    return bucketMin(index) + (quint64(1) << shift) - 1;
+}
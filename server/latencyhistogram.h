@@ -0,0 +1,59 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_LATENCY_HISTOGRAM_H
+#define _SERVER_LATENCY_HISTOGRAM_H
+
+#include <QtGlobal>
+
+#include "../common/protocol.pb.h"
+
+/*
+ Fixed size histogram of nsec values with log-linear (HDR style) buckets -
+ values below 128 have a bucket each, larger values are bucketed with a
+ relative error of at most 1/64. Values of ~137s and more are counted
+ in the last bucket.
+*/
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void add(quint64 value);
+    void reset();
+
+    quint64 count() const { return count_; }
+    quint64 percentile(double percent) const;
+
+    void protoDataCopyInto(OstProto::Histogram *histogram) const;
+
+private:
+    static const int kSubBucketBits = 7;
+    static const int kSubBucketHalfCount = 1 << (kSubBucketBits - 1);
+    static const int kBucketCount = 2048;
+
+    static int bucketIndex(quint64 value);
+    static quint64 bucketMin(int index);
+    static quint64 bucketMax(int index);
+
+    quint64 count_;
+    quint64 buckets_[kBucketCount];
+};
+
+#endif
@@ -21,129 +21,1325 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #ifdef Q_OS_LINUX
 
+#include "settings.h"
+
 #include <QByteArray>
+#include <QElapsedTimer>
 #include <QHash>
+#include <QStringList>
 #include <QTime>
 
+#include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <linux/rtnetlink.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/net_tstamp.h>
+#include <linux/rtnetlink.h>
+
+QList<LinuxPort*> LinuxPort::allPorts_;
+LinuxPort::StatsMonitor *LinuxPort::monitor_;
+
+const quint32 kMaxValue32 = 0xffffffff;
+const quint64 kMaxValue64 = 0xffffffffffffffffULL;
+
+#ifdef HAVE_IFLA_STATS64
+#define X_IFLA_STATS IFLA_STATS64
+typedef struct rtnl_link_stats64 x_rtnl_link_stats;
+#else
+#define X_IFLA_STATS IFLA_STATS
+typedef struct rtnl_link_stats x_rtnl_link_stats;
+#endif
+
+LinuxPort::LinuxPort(int id, const char *device)
+    : PcapPort(id, device) 
+{
+    isPromisc_ = true;
+    clearPromisc_ = false;
+
+    // We don't need per port Rx/Tx monitors for Linux
+    delete monitorRx_;
+    delete monitorTx_;
+    monitorRx_ = monitorTx_ = NULL;
+
+    // Replace the pcap transmitter with one or more workers that can
+    // use a TX ring
+    int workers = qBound(1, appSettings->value(kTxWorkersKey, 1).toInt(),
+                            kMaxTxWorkers);
+    QStringList cpus = appSettings->value(kTxWorkerCpusKey).toString()
+                            .split(',', QString::SkipEmptyParts);
+
+    delete transmitter_;
+    for (int i = 0; i < workers; i++)
+    {
+        PortTransmitter *worker = new PortTransmitter(device);
+
+        worker->setPacketListShare(i, workers);
+        worker->setStreamStats(&streamStats_);
+        worker->setDropStats(newStatsBlock());
+        if (i < cpus.size())
+            worker->setCpu(cpus.at(i).trimmed().toInt());
+        txWorkers_.append(worker);
+    }
+    transmitter_ = txWorkers_.at(0);
+
+    delete capturer_;
+    capturer_ = new PortCapturer(device, newStatsBlock());
+
+    // We have one monitor for both Rx/Tx of all ports
+    if (!monitor_)
+        monitor_ = new StatsMonitor();
+
+    data_.set_is_exclusive_control(hasExclusiveControl());
+    minPacketSetSize_ = 16;
+
+    qDebug("adding dev to all ports list <%s>", device);
+    allPorts_.append(this);
+
+    // A port can support either 32 or 64 bit stats - we will attempt
+    // to guess this for each port and initialize this variable at 
+    // run time when the counter wraps around
+    maxStatsValue_ = 0;
+}
+
+LinuxPort::~LinuxPort()
+{
+    qDebug("In %s", __FUNCTION__);
+
+    if (monitor_->isRunning())
+    {
+        monitor_->stop();
+        monitor_->wait();
+    }
+
+    if (clearPromisc_)
+    {
+        int sd = socket(AF_INET, SOCK_DGRAM, 0);
+        struct ifreq ifr;
+
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, name(), sizeof(ifr.ifr_name));
+
+        if (ioctl(sd, SIOCGIFFLAGS, &ifr) != -1) 
+        {
+            if (ifr.ifr_flags & IFF_PROMISC)
+            {
+                ifr.ifr_flags &= ~IFF_PROMISC;
+                if (ioctl(sd, SIOCSIFFLAGS, &ifr) == -1)
+                    qDebug("Failed clearing promisc flag. SIOCSIFFLAGS failed: %s",
+                        strerror(errno));
+            }
+        }
+        else
+            qDebug("Failed clearing promisc flag. SIOCGIFFLAGS failed: %s",
+                    strerror(errno));
+
+        close(sd);
+    }
+
+    // transmitter_ (the first worker) is deleted by PcapPort
+    while (txWorkers_.size() > 1)
+        delete txWorkers_.takeLast();
+}
+
+void LinuxPort::init()
+{
+    if (!monitor_->isRunning())
+        monitor_->start();
+
+    monitor_->waitForSetupFinished();
+
+    if (!isPromisc_)
+        addNote("Non Promiscuous Mode");
+}
+
+OstProto::LinkState LinuxPort::linkState()
+{
+    return linkState_; 
+}
+
+bool LinuxPort::hasExclusiveControl() 
+{
+    // TODO
+    return false;
+}
+
+bool LinuxPort::setExclusiveControl(bool /*exclusive*/) 
+{
+    // TODO
+    return false;
+}
+
+void LinuxPort::clearPacketList()
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+        worker->clearPacketList();
+    setPacketListLoopMode(false, 0, 0);
+}
+
+void LinuxPort::loopNextPacketSet(qint64 size, qint64 repeats,
+        long repeatDelaySec, long repeatDelayNsec)
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+        worker->loopNextPacketSet(size, repeats,
+                repeatDelaySec, repeatDelayNsec);
+}
+
+bool LinuxPort::appendToPacketList(long sec, long nsec, const uchar *packet,
+        int length)
+{
+    bool ret = true;
+
+    // Every worker needs to see every packet to keep track of time
+    foreach(PortTransmitter *worker, txWorkers_)
+    {
+        if (!worker->appendToPacketList(sec, nsec, packet, length))
+            ret = false;
+    }
+
+    return ret;
+}
+
+void LinuxPort::setPacketListLoopMode(bool loop, 
+        quint64 secDelay, quint64 nsecDelay)
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+        worker->setPacketListLoopMode(loop, secDelay, nsecDelay);
+}
+
+void LinuxPort::finishPacketList()
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+        worker->finishPacketList();
+}
+
+bool LinuxPort::isPacketListComplete()
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+    {
+        if (!worker->isPacketListComplete())
+            return false;
+    }
+
+    return true;
+}
+
+void LinuxPort::setTransmitRateScale(double scale)
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+        worker->setRateScale(scale);
+}
+
+void LinuxPort::startTransmit()
+{
+    quint64 startTime = 0;
+
+    // Workers are started one after the other, so give them a common
+    // start time for their packets to interleave as per the packet list
+    if (txWorkers_.size() > 1)
+        startTime = PortTransmitter::nsecTimeStamp() 
+                        + txWorkers_.size()*kTxWorkerStartLead;
+
+    foreach(PortTransmitter *worker, txWorkers_)
+    {
+        worker->setStartTime(startTime);
+        worker->start();
+    }
+}
+
+void LinuxPort::armTransmit(QSharedPointer<StartBarrier> barrier)
+{
+    // The barrier gives all workers a common start time
+    foreach(PortTransmitter *worker, txWorkers_)
+    {
+        worker->setStartTime(0);
+        worker->start(barrier, id());
+    }
+}
+
+void LinuxPort::stopTransmit()
+{
+    if (!isTransmitOn())
+    {
+        transmitter_->stop(); // FIXME: return error
+        return;
+    }
+
+    foreach(PortTransmitter *worker, txWorkers_)
+    {
+        if (worker->isRunning())
+            worker->stop();
+    }
+}
+
+bool LinuxPort::isTransmitOn()
+{
+    foreach(PortTransmitter *worker, txWorkers_)
+    {
+        if (worker->isRunning())
+            return true;
+    }
+
+    return false;
+}
+
+LinuxPort::PortTransmitter::PortTransmitter(const char *device)
+    : PcapPort::PortTransmitter(device)
+{
+    QString method = appSettings->value(kTxMethodKey, "auto")
+                                    .toString().toLower();
+
+    txMethod_ = kTxMethodPcap;
+    fd_ = -1;
+    cpu_ = -1;
+
+    tpVersion_ = -1;
+    tpHdrLen_ = 0;
+    ring_ = NULL;
+    ringSize_ = 0;
+    frameSize_ = 0;
+    frameCount_ = 0;
+    frameIndex_ = 0;
+    pendingFrames_ = 0;
+
+    memset(batch_, 0, sizeof(batch_));
+    batchCount_ = 0;
+    batchRetries_ = 0;
+    txTimeClock_ = CLOCK_TAI;
+    txTimeErrors_ = 0;
+    dropStats_ = NULL;
+
+    if (method == "pcap")
+        goto _pcap;
+
+    if (!setupTxSocket(device))
+        goto _pcap;
+
+    if (appSettings->value(kTxLaunchTimeKey, false).toBool())
+    {
+        // Launch time needs per packet control msgs, so no tx ring
+        if (setupTxTime(device))
+        {
+            txMethod_ = kTxMethodMmsg;
+            launchTimeLead_ = kLaunchTimeLead;
+            minPacingDelay_ = kLaunchTimeLead/2;
+
+            qDebug("%s: using sendmmsg with launch time to transmit", device);
+            return;
+        }
+        qWarning("%s: launch time not available, using software pacing",
+                device);
+    }
+
+    if ((method != "mmsg") && setupTxRing(device))
+        txMethod_ = kTxMethodRing;
+    else if (method != "ring")
+        txMethod_ = kTxMethodMmsg;
+    else
+    {
+        releaseTxSocket();
+        goto _pcap;
+    }
+
+    // Batching is pointless if we pace every few packets
+    minPacingDelay_ = kBatchPacingDelay;
+
+    qDebug("%s: using %s to transmit", device,
+            txMethod_ == kTxMethodRing ? "tx ring" : "sendmmsg");
+    return;
+
+_pcap:
+    qDebug("%s: using pcap to transmit", device);
+}
+
+LinuxPort::PortTransmitter::~PortTransmitter()
+{
+    releaseTxSocket();
+}
+
+void LinuxPort::PortTransmitter::run()
+{
+    if (cpu_ >= 0)
+    {
+        cpu_set_t cpuSet;
+
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu_, &cpuSet);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet))
+            qWarning("Unable to pin transmit thread to cpu %d", cpu_);
+    }
+
+    batchRetries_ = 0;
+
+    PcapPort::PortTransmitter::run();
+
+    if (batchRetries_)
+        qDebug("sendmmsg retried %llu times as the tx queue was full",
+                batchRetries_);
+}
+
+bool LinuxPort::PortTransmitter::setupTxSocket(const char *device)
+{
+    struct sockaddr_ll addr;
+
+    fd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd_ < 0)
+    {
+        qDebug("%s: unable to open packet socket (%s)", device,
+                strerror(errno));
+        return false;
+    }
+
+    if (appSettings->value(kTxQdiscBypassKey, false).toBool())
+    {
+#ifdef PACKET_QDISC_BYPASS
+        int bypass = 1;
+
+        if (setsockopt(fd_, SOL_PACKET, PACKET_QDISC_BYPASS,
+                    &bypass, sizeof(bypass)) < 0)
+            qDebug("%s: unable to bypass qdisc (%s)", device,
+                    strerror(errno));
+#else
+        qDebug("%s: qdisc bypass not supported", device);
+#endif
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = 0; // Tx only - we don't want any Rx on this socket
+    addr.sll_ifindex = if_nametoindex(device);
+    if (!addr.sll_ifindex)
+    {
+        qDebug("%s: unable to find ifindex (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    if (bind(fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        qDebug("%s: unable to bind packet socket (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    return true;
+
+_error:
+    releaseTxSocket();
+    return false;
+}
+
+/*!
+ Returns the kind ("etf" or "fq") of a qdisc of the interface that sends
+ packets as per their SO_TXTIME launch time - or an empty string if there
+ is none (other qdiscs ignore the launch time)
+*/
+static QByteArray findTxTimeQdisc(uint ifIndex)
+{
+    struct {
+        struct nlmsghdr nlh;
+        struct tcmsg tcm;
+    } req;
+    quint64 buf[4096]; // aligned for nlmsghdr
+    QByteArray kind;
+    bool done = false;
+    int fd;
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (fd < 0)
+        return kind;
+
+    memset(&req, 0, sizeof(req));
+    req.nlh.nlmsg_len = sizeof(req);
+    req.nlh.nlmsg_type = RTM_GETQDISC;
+    req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.tcm.tcm_family = AF_UNSPEC;
+
+    if (send(fd, &req, sizeof(req), 0) < 0)
+        goto _exit;
+
+    while (!done)
+    {
+        int len = recv(fd, buf, sizeof(buf), 0);
+        struct nlmsghdr *nlm = (struct nlmsghdr*) buf;
+
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (; NLMSG_OK(nlm, (uint)len); nlm = NLMSG_NEXT(nlm, len))
+        {
+            struct tcmsg *tcm = (struct tcmsg*) NLMSG_DATA(nlm);
+            struct rtattr *rta = (struct rtattr*)((char*)tcm
+                                    + NLMSG_ALIGN(sizeof(*tcm)));
+            int rtaLen = nlm->nlmsg_len - NLMSG_LENGTH(sizeof(*tcm));
+
+            if ((nlm->nlmsg_type == NLMSG_DONE)
+                    || (nlm->nlmsg_type == NLMSG_ERROR))
+            {
+                done = true;
+                break;
+            }
+
+            if ((nlm->nlmsg_type != RTM_NEWQDISC)
+                    || (uint(tcm->tcm_ifindex) != ifIndex))
+                continue;
+
+            // etf may be a child of mqprio/taprio - so look at all of them
+            for (; RTA_OK(rta, rtaLen); rta = RTA_NEXT(rta, rtaLen))
+            {
+                if (rta->rta_type != TCA_KIND)
+                    continue;
+                if (!strcmp((char*) RTA_DATA(rta), "etf")
+                        || (kind.isEmpty()
+                            && !strcmp((char*) RTA_DATA(rta), "fq")))
+                    kind = QByteArray((char*) RTA_DATA(rta));
+            }
+        }
+    }
+
+_exit:
+    close(fd);
+    return kind;
+}
+
+bool LinuxPort::PortTransmitter::setupTxTime(const char *device)
+{
+#ifdef SO_TXTIME
+    struct sock_txtime txTime;
+    QByteArray qdisc;
+
+    // Launch time is implemented by the qdisc
+    if (appSettings->value(kTxQdiscBypassKey, false).toBool())
+    {
+        qDebug("%s: launch time needs a qdisc", device);
+        return false;
+    }
+
+    // Any other qdisc accepts SO_TXTIME but sends the packets right away
+    qdisc = findTxTimeQdisc(if_nametoindex(device));
+    if (qdisc.isEmpty())
+    {
+        qDebug("%s: launch time needs an etf or fq qdisc", device);
+        return false;
+    }
+
+    // etf works with CLOCK_TAI, fq with CLOCK_MONOTONIC; packets that
+    // miss their launch time are dropped by etf - with an error reported
+    memset(&txTime, 0, sizeof(txTime));
+    txTime.clockid = (qdisc == "etf") ? CLOCK_TAI : CLOCK_MONOTONIC;
+    txTime.flags = SOF_TXTIME_REPORT_ERRORS;
+
+    if (setsockopt(fd_, SOL_SOCKET, SO_TXTIME, &txTime, sizeof(txTime)) < 0)
+    {
+        qDebug("%s: unable to set SO_TXTIME (%s)", device, strerror(errno));
+        return false;
+    }
+    txTimeClock_ = txTime.clockid;
+
+    qDebug("%s: launch time using %s qdisc", device, qdisc.constData());
+    return true;
+#else
+    qDebug("%s: SO_TXTIME not supported", device);
+    return false;
+#endif
+}
+
+bool LinuxPort::PortTransmitter::setupTxRing(const char *device)
+{
+    // TPACKET_V3 Tx ring needs kernel 4.11+; older kernels accept
+    // PACKET_VERSION V3 but fail PACKET_TX_RING, so fallback to V2
+    const int versions[] = { TPACKET_V3, TPACKET_V2 };
+    int discard = 1;
+    uint i;
+
+    frameSize_ = kTxRingFrameSize;
+    frameCount_ = (kTxRingBlockSize/kTxRingFrameSize) * kTxRingBlockCount;
+    ringSize_ = kTxRingBlockSize * kTxRingBlockCount;
+
+    for (i = 0; i < sizeof(versions)/sizeof(versions[0]); i++)
+    {
+        int ret;
+
+        if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION,
+                    &versions[i], sizeof(versions[i])) < 0)
+            continue;
+
+        if (versions[i] == TPACKET_V3)
+        {
+            struct tpacket_req3 req;
+
+            memset(&req, 0, sizeof(req));
+            req.tp_block_size = kTxRingBlockSize;
+            req.tp_block_nr = kTxRingBlockCount;
+            req.tp_frame_size = frameSize_;
+            req.tp_frame_nr = frameCount_;
+            ret = setsockopt(fd_, SOL_PACKET, PACKET_TX_RING,
+                    &req, sizeof(req));
+        }
+        else
+        {
+            struct tpacket_req req;
+
+            memset(&req, 0, sizeof(req));
+            req.tp_block_size = kTxRingBlockSize;
+            req.tp_block_nr = kTxRingBlockCount;
+            req.tp_frame_size = frameSize_;
+            req.tp_frame_nr = frameCount_;
+            ret = setsockopt(fd_, SOL_PACKET, PACKET_TX_RING,
+                    &req, sizeof(req));
+        }
+
+        if (ret == 0)
+        {
+            tpVersion_ = versions[i];
+            break;
+        }
+        qDebug("%s: PACKET_TX_RING failed for tpacket version %d (%s)",
+                device, versions[i], strerror(errno));
+    }
+
+    if (tpVersion_ < 0)
+        return false;
+
+    if (tpVersion_ == TPACKET_V3)
+        tpHdrLen_ = TPACKET3_HDRLEN - sizeof(struct sockaddr_ll);
+    else
+        tpHdrLen_ = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+    // Skip a malformed frame instead of stalling the ring on it
+    if (setsockopt(fd_, SOL_PACKET, PACKET_LOSS,
+                &discard, sizeof(discard)) < 0)
+        qDebug("%s: unable to set PACKET_LOSS (%s)", device, strerror(errno));
+
+    ring_ = (uchar*) mmap(NULL, ringSize_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd_, 0);
+    if (ring_ == MAP_FAILED)
+    {
+        qDebug("%s: unable to mmap tx ring (%s)", device, strerror(errno));
+        ring_ = NULL;
+        return false;
+    }
+
+    qDebug("%s: tpacket v%d tx ring with %u frames of %u bytes",
+            device, tpVersion_ + 1, frameCount_, frameSize_);
+    return true;
+}
+
+void LinuxPort::PortTransmitter::releaseTxSocket()
+{
+    if (ring_)
+        munmap(ring_, ringSize_);
+    ring_ = NULL;
+    tpVersion_ = -1;
+
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+}
+
+volatile quint32* LinuxPort::PortTransmitter::txFrameStatus(void *frame)
+{
+    if (tpVersion_ == TPACKET_V3)
+        return &((struct tpacket3_hdr*) frame)->tp_status;
+    else
+        return &((struct tpacket2_hdr*) frame)->tp_status;
+}
+
+int LinuxPort::PortTransmitter::kickTxRing()
+{
+    // Kernel transmits all frames marked TP_STATUS_SEND_REQUEST;
+    // we don't wait for it to finish - frames are reclaimed lazily
+    if (send(fd_, NULL, 0, MSG_DONTWAIT) < 0)
+    {
+        if ((errno != EAGAIN) && (errno != ENOBUFS) && (errno != EINTR))
+        {
+            qWarning("tx ring send failed (%s)", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+bool LinuxPort::PortTransmitter::waitForTxFrame(void *frame)
+{
+    struct pollfd pfd;
+
+    while (*txFrameStatus(frame) & (TP_STATUS_SEND_REQUEST|TP_STATUS_SENDING))
+    {
+        if (stop_)
+            return false;
+
+        // Ring is full - kick the kernel and wait for it to free up frames
+        if (kickTxRing() < 0)
+            return false;
+
+        pfd.fd = fd_;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        poll(&pfd, 1, 10 /* ms */);
+    }
+
+    return true;
+}
+
+int LinuxPort::PortTransmitter::transmitPacket(const uchar *packet,
+        int length, quint64 nsecDeadline)
+{
+    void *frame;
+
+    switch (txMethod_)
+    {
+    case kTxMethodMmsg:
+        // The packet stays in the sendQueue till the next flush, so
+        // we queue just a reference to it
+        batchIov_[batchCount_].iov_base = (void*) packet;
+        batchIov_[batchCount_].iov_len = length;
+        batch_[batchCount_].msg_hdr.msg_iov = &batchIov_[batchCount_];
+        batch_[batchCount_].msg_hdr.msg_iovlen = 1;
+        batchTxTime_[batchCount_] = nsecDeadline;
+
+        if (++batchCount_ == kMaxTxBatch)
+            return flushTxBatch();
+        return 0;
+
+    case kTxMethodRing:
+        if (uint(length) <= (frameSize_ - tpHdrLen_))
+            break;
+
+        // Send queued packets first so that packet order is preserved
+        flushTxRing();
+        // fall-through
+
+    case kTxMethodPcap:
+    default:
+        return PcapPort::PortTransmitter::transmitPacket(packet, length,
+                nsecDeadline);
+    }
+
+    frame = txFrame(frameIndex_);
+    if (!waitForTxFrame(frame))
+        return -1;
+
+    memcpy((uchar*)frame + tpHdrLen_, packet, length);
+    if (tpVersion_ == TPACKET_V3)
+    {
+        struct tpacket3_hdr *hdr = (struct tpacket3_hdr*) frame;
+
+        hdr->tp_next_offset = 0;
+        hdr->tp_len = hdr->tp_snaplen = length;
+    }
+    else
+    {
+        struct tpacket2_hdr *hdr = (struct tpacket2_hdr*) frame;
+
+        hdr->tp_len = hdr->tp_snaplen = length;
+    }
+
+    // Frame contents must be visible to the kernel before the status
+    __sync_synchronize();
+    *txFrameStatus(frame) = TP_STATUS_SEND_REQUEST;
+
+    frameIndex_ = (frameIndex_ + 1) % frameCount_;
+
+    // Don't wait for the ring to fill up before kicking the kernel
+    if (++pendingFrames_ >= (frameCount_/4))
+        return flushTxRing();
+
+    return 0;
+}
+
+int LinuxPort::PortTransmitter::transmitFlush()
+{
+    switch (txMethod_)
+    {
+    case kTxMethodRing:
+        return flushTxRing();
+    case kTxMethodMmsg:
+        return flushTxBatch();
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+int LinuxPort::PortTransmitter::flushTxRing()
+{
+    if (!pendingFrames_)
+        return 0;
+
+    pendingFrames_ = 0;
+    return kickTxRing();
+}
+
+int LinuxPort::PortTransmitter::flushTxBatch()
+{
+    int sent = 0;
+
+    if (launchTimeLead_)
+        setBatchTxTime();
+
+    while (sent < batchCount_)
+    {
+        int ret = sendmmsg(fd_, &batch_[sent], batchCount_ - sent, 0);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // EAGAIN => socket send buffer full, ENOBUFS => device queue
+            // full (likely with qdisc bypass) - wait for space instead of
+            // retrying right away
+            if (((errno == EAGAIN) || (errno == ENOBUFS)) && !stop_)
+            {
+                batchRetries_++;
+                waitForTxSpace(errno == ENOBUFS);
+                continue;
+            }
+
+            qWarning("sendmmsg failed (%s)", strerror(errno));
+            batchCount_ = 0;
+            return -1;
+        }
+        sent += ret;
+    }
+
+    batchCount_ = 0;
+
+    if (launchTimeLead_)
+        readTxTimeErrors();
+
+    return 0;
+}
+
+void LinuxPort::PortTransmitter::waitForTxSpace(bool isDeviceQueueFull)
+{
+    struct pollfd pfd;
+
+    // The socket is writable even when the device queue is full - so poll
+    // can't tell when that frees up; back off briefly instead
+    if (isDeviceQueueFull)
+    {
+        struct timespec delay = { 0, kTxRetryDelay };
+
+        nanosleep(&delay, NULL);
+        return;
+    }
+
+    pfd.fd = fd_;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+    poll(&pfd, 1, 10 /* ms */);
+}
+
+void LinuxPort::PortTransmitter::setBatchTxTime()
+{
+#ifdef SO_TXTIME
+    struct timespec now;
+    quint64 offset;
+
+    // Launch time is as per the qdisc's clock which (unlike our pacing
+    // clock) is NTP adjusted - so the offset is recalculated every batch
+    clock_gettime(txTimeClock_, &now);
+    offset = now.tv_sec*quint64(1e9) + now.tv_nsec - nsecTimeStamp();
+
+    for (int i = 0; i < batchCount_; i++)
+    {
+        struct msghdr *msg = &batch_[i].msg_hdr;
+        struct cmsghdr *cmsg;
+
+        msg->msg_control = batchCmsg_[i];
+        msg->msg_controllen = sizeof(batchCmsg_[i]);
+
+        cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(quint64));
+        *((quint64*) CMSG_DATA(cmsg)) = batchTxTime_[i] + offset;
+    }
+#endif
+}
+
+// Counts the packets dropped by the qdisc for missing their launch time
+// (or an invalid one) as tx drops
+void LinuxPort::PortTransmitter::readTxTimeErrors()
+{
+#ifdef SO_EE_ORIGIN_TXTIME
+    quint64 control[64]; // aligned for cmsghdr
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    quint64 errors = 0;
+
+    while (1)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        // The packet itself is not needed - it is truncated away
+        if (recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
 
-QList<LinuxPort*> LinuxPort::allPorts_;
-LinuxPort::StatsMonitor *LinuxPort::monitor_;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            struct sock_extended_err *err;
 
-const quint32 kMaxValue32 = 0xffffffff;
-const quint64 kMaxValue64 = 0xffffffffffffffffULL;
+            if ((cmsg->cmsg_level != SOL_PACKET)
+                    || (cmsg->cmsg_type != PACKET_TX_TIMESTAMP))
+                continue;
 
-#ifdef HAVE_IFLA_STATS64
-#define X_IFLA_STATS IFLA_STATS64
-typedef struct rtnl_link_stats64 x_rtnl_link_stats;
-#else
-#define X_IFLA_STATS IFLA_STATS
-typedef struct rtnl_link_stats x_rtnl_link_stats;
+            err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+            if (err->ee_origin == SO_EE_ORIGIN_TXTIME)
+                errors++;
+        }
+    }
+
+    if (errors)
+    {
+        AbstractPort::PortStats *stats;
+
+        if (!txTimeErrors_)
+            qWarning("packets missing their launch time are being dropped");
+        txTimeErrors_ += errors;
+
+        if (dropStats_)
+        {
+            stats = dropStats_->beginUpdate();
+            stats->txDrops += errors;
+            dropStats_->endUpdate();
+        }
+    }
 #endif
+}
 
-LinuxPort::LinuxPort(int id, const char *device)
-    : PcapPort(id, device) 
+// pcap savefile (usec timestamps) headers in host byte order
+struct PcapFileHeader
 {
-    isPromisc_ = true;
-    clearPromisc_ = false;
+    quint32 magic;
+    quint16 versionMajor;
+    quint16 versionMinor;
+    qint32 thisZone;
+    quint32 sigfigs;
+    quint32 snapLen;
+    quint32 linkType;
+};
+
+struct PcapPacketHeader
+{
+    quint32 tsSec;
+    quint32 tsUsec;
+    quint32 capLen;
+    quint32 len;
+};
+
+LinuxPort::PortCapturer::PortCapturer(const char *device,
+        AbstractPort::StatsBlock *stats)
+    : PcapPort::PortCapturer(device, stats), writer_(this)
+{
+    fd_ = -1;
+    ring_ = NULL;
+    ringSize_ = 0;
+    buffer_ = NULL;
+    head_ = tail_ = 0;
+    stopWriter_ = false;
+    rotatePos_ = 0;
+    file_ = NULL;
+}
 
-    // We don't need per port Rx/Tx monitors for Linux
-    delete monitorRx_;
-    delete monitorTx_;
-    monitorRx_ = monitorTx_ = NULL;
+LinuxPort::PortCapturer::~PortCapturer()
+{
+    releaseRxRing();
+}
 
-    // We have one monitor for both Rx/Tx of all ports
-    if (!monitor_)
-        monitor_ = new StatsMonitor();
+void LinuxPort::PortCapturer::run()
+{
+    uint block = 0;
 
-    data_.set_is_exclusive_control(hasExclusiveControl());
-    minPacketSetSize_ = 16;
+    qDebug("In %s", __PRETTY_FUNCTION__);
 
-    qDebug("adding dev to all ports list <%s>", device);
-    allPorts_.append(this);
+    if (!capFile_.isOpen())
+    {
+        qWarning("temp cap file is not open");
+        goto _exit;
+    }
 
-    // A port can support either 32 or 64 bit stats - we will attempt
-    // to guess this for each port and initialize this variable at 
-    // run time when the counter wraps around
-    maxStatsValue_ = 0;
+    if (!setupRxRing())
+    {
+        qDebug("%s: rx ring not available, using pcap", 
+                device_.toAscii().constData());
+        PcapPort::PortCapturer::run();
+        return;
+    }
+
+    file_ = startSegments();
+    if (!file_)
+    {
+        releaseRxRing();
+        goto _exit;
+    }
+
+    buffer_ = new uchar[kBufferSize];
+    head_ = tail_ = 0;
+    rotatePos_ = 0;
+    segmentSize_ = 0;
+    usecSegmentStart_ = 0;
+
+    stopWriter_ = false;
+    writer_.start();
+
+    state_ = kRunning;
+    while (!stop_)
+    {
+        struct tpacket_block_desc *desc = (struct tpacket_block_desc*)
+            (ring_ + block*kRxRingBlockSize);
+
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+                    & TP_STATUS_USER))
+        {
+            struct pollfd pfd;
+
+            pfd.fd = fd_;
+            pfd.events = POLLIN | POLLERR;
+            pfd.revents = 0;
+            poll(&pfd, 1, kMaxWriteDelay);
+
+            updateKernelDrops();
+            continue;
+        }
+
+        captureBlock(desc);
+
+        // Return the block to the kernel right away
+        __atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                __ATOMIC_RELEASE);
+        block = (block + 1) % kRxRingBlockCount;
+    }
+    qDebug("user requested capture stop\n");
+    updateKernelDrops();
+
+    __atomic_store_n(&stopWriter_, true, __ATOMIC_RELEASE);
+    writer_.wait();
+    file_->flush();
+
+    delete[] buffer_;
+    buffer_ = NULL;
+    releaseRxRing();
+    stop_ = false;
+
+_exit:
+    state_ = kFinished;
 }
 
-LinuxPort::~LinuxPort()
+bool LinuxPort::PortCapturer::setupRxRing()
 {
-    qDebug("In %s", __FUNCTION__);
+    QByteArray deviceName = device_.toAscii();
+    const char *device = deviceName.constData();
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    struct packet_mreq mreq;
+    int version = TPACKET_V3;
+
+    // No protocol till bind() - else the ring gets the packets of all
+    // interfaces till then
+    fd_ = socket(AF_PACKET, SOCK_RAW, 0);
+    if (fd_ < 0)
+    {
+        qDebug("%s: unable to open packet socket (%s)", device,
+                strerror(errno));
+        return false;
+    }
 
-    if (monitor_->isRunning())
+    if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION,
+                &version, sizeof(version)) < 0)
     {
-        monitor_->stop();
-        monitor_->wait();
+        qDebug("%s: tpacket v3 not supported (%s)", device, strerror(errno));
+        goto _error;
     }
 
-    if (clearPromisc_)
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = kRxRingBlockSize;
+    req.tp_block_nr = kRxRingBlockCount;
+    req.tp_frame_size = kRxRingFrameSize;
+    req.tp_frame_nr = (kRxRingBlockSize/kRxRingFrameSize) * kRxRingBlockCount;
+    req.tp_retire_blk_tov = kRxRingBlockTimeout;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0)
     {
-        int sd = socket(AF_INET, SOCK_DGRAM, 0);
-        struct ifreq ifr;
+        qDebug("%s: PACKET_RX_RING failed (%s)", device, strerror(errno));
+        goto _error;
+    }
 
-        memset(&ifr, 0, sizeof(ifr));
-        strncpy(ifr.ifr_name, name(), sizeof(ifr.ifr_name));
+    ringSize_ = kRxRingBlockSize * kRxRingBlockCount;
+    ring_ = (uchar*) mmap(NULL, ringSize_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, fd_, 0);
+    if (ring_ == MAP_FAILED)
+    {
+        qDebug("%s: unable to mmap rx ring (%s)", device, strerror(errno));
+        ring_ = NULL;
+        goto _error;
+    }
 
-        if (ioctl(sd, SIOCGIFFLAGS, &ifr) != -1) 
+    // The filter's return value is the snaplen - so the kernel truncates
+    // the packets; a filter is needed for the snaplen alone too
+    if (!filter_.isEmpty() || (snapLen_ < 65535))
+    {
+        pcap_t *dead = pcap_open_dead(DLT_EN10MB, snapLen_);
+        struct bpf_program program;
+        struct sock_fprog fprog;
+        int ret;
+
+        if (!compileFilter(dead, &program))
         {
-            if (ifr.ifr_flags & IFF_PROMISC)
+            pcap_close(dead);
+            goto _error;
+        }
+
+        fprog.len = program.bf_len;
+        fprog.filter = (struct sock_filter*) program.bf_insns;
+        ret = setsockopt(fd_, SOL_SOCKET, SO_ATTACH_FILTER,
+                    &fprog, sizeof(fprog));
+        pcap_freecode(&program);
+        pcap_close(dead);
+
+        if (ret < 0)
+        {
+            qDebug("%s: unable to attach capture filter (%s)", device,
+                    strerror(errno));
+            goto _error;
+        }
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = if_nametoindex(device);
+    if (!addr.sll_ifindex)
+    {
+        qDebug("%s: unable to find ifindex (%s)", device, strerror(errno));
+        goto _error;
+    }
+
+    if (bind(fd_, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+        qDebug("%s: unable to bind packet socket (%s)", device,
+                strerror(errno));
+        goto _error;
+    }
+
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.mr_ifindex = addr.sll_ifindex;
+    mreq.mr_type = PACKET_MR_PROMISC;
+    if (setsockopt(fd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                &mreq, sizeof(mreq)) < 0)
+        qDebug("%s: can't set promiscuous mode (%s)", device, 
+                strerror(errno));
+
+    qDebug("%s: tpacket v3 rx ring with %u blocks of %u bytes",
+            device, kRxRingBlockCount, kRxRingBlockSize);
+    return true;
+
+_error:
+    releaseRxRing();
+    return false;
+}
+
+void LinuxPort::PortCapturer::releaseRxRing()
+{
+    if (ring_)
+        munmap(ring_, ringSize_);
+    ring_ = NULL;
+
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+}
+
+void LinuxPort::PortCapturer::captureBlock(struct tpacket_block_desc *block)
+{
+    struct tpacket3_hdr *hdr = (struct tpacket3_hdr*)
+        ((uchar*) block + block->hdr.bh1.offset_to_first_pkt);
+
+    for (uint i = 0; i < block->hdr.bh1.num_pkts; i++)
+    {
+        PcapPacketHeader pktHeader;
+
+        pktHeader.tsSec = hdr->tp_sec;
+        pktHeader.tsUsec = hdr->tp_nsec/1000;
+        pktHeader.capLen = hdr->tp_snaplen;
+        pktHeader.len = hdr->tp_len;
+
+        if (isBounded())
+        {
+            quint64 usec = pktHeader.tsSec*quint64(1000000) 
+                                + pktHeader.tsUsec;
+
+            if (!usecSegmentStart_)
+                usecSegmentStart_ = usec;
+
+            // If the writer hasn't got to the last rotation yet, this
+            // segment just grows a little more
+            if (segmentSize_ 
+                    && isSegmentFull(segmentSize_, usec - usecSegmentStart_)
+                    && !__atomic_load_n(&rotatePos_, __ATOMIC_ACQUIRE))
             {
-                ifr.ifr_flags &= ~IFF_PROMISC;
-                if (ioctl(sd, SIOCSIFFLAGS, &ifr) == -1)
-                    qDebug("Failed clearing promisc flag. SIOCSIFFLAGS failed: %s",
-                        strerror(errno));
+                __atomic_store_n(&rotatePos_, head_, __ATOMIC_RELEASE);
+                segmentSize_ = 0;
+                usecSegmentStart_ = usec;
             }
         }
+
+        if (bufferPut(&pktHeader, sizeof(pktHeader),
+                    (uchar*) hdr + hdr->tp_mac, hdr->tp_snaplen))
+            segmentSize_ += sizeof(pktHeader) + hdr->tp_snaplen;
         else
-            qDebug("Failed clearing promisc flag. SIOCGIFFLAGS failed: %s",
-                    strerror(errno));
+        {
+            stats_->beginUpdate()->capRingDrops++;
+            stats_->endUpdate();
+        }
 
-        close(sd);
+        hdr = (struct tpacket3_hdr*) ((uchar*) hdr + hdr->tp_next_offset);
     }
 }
 
-void LinuxPort::init()
+// PACKET_STATISTICS are reset every time they are read
+void LinuxPort::PortCapturer::updateKernelDrops()
 {
-    if (!monitor_->isRunning())
-        monitor_->start();
+    struct tpacket_stats_v3 tpStats;
+    socklen_t len = sizeof(tpStats);
 
-    monitor_->waitForSetupFinished();
+    if (getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &tpStats, &len) == 0)
+    {
+        stats_->beginUpdate()->capKernelDrops += tpStats.tp_drops;
+        stats_->endUpdate();
+    }
+}
 
-    if (!isPromisc_)
-        addNote("Non Promiscuous Mode");
+bool LinuxPort::PortCapturer::bufferPut(const void *header, int headerLen,
+        const void *data, int dataLen)
+{
+    quint64 tail = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+    quint64 len = headerLen + dataLen;
+
+    if ((kBufferSize - (head_ - tail)) < len)
+        return false;
+
+    bufferCopy(head_, header, headerLen);
+    bufferCopy(head_ + headerLen, data, dataLen);
+    __atomic_store_n(&head_, head_ + len, __ATOMIC_RELEASE);
+
+    return true;
 }
 
-OstProto::LinkState LinuxPort::linkState()
+void LinuxPort::PortCapturer::bufferCopy(quint64 pos, const void *src,
+        int len)
 {
-    return linkState_; 
+    quint64 offset = pos % kBufferSize;
+    int first = qMin(quint64(len), kBufferSize - offset);
+
+    memcpy(buffer_ + offset, src, first);
+    if (len > first)
+        memcpy(buffer_, (const uchar*) src + first, len - first);
 }
 
-bool LinuxPort::hasExclusiveControl() 
+// Writer thread - writes out the buffer in chunks of kWriteChunkSize, or
+// whatever is available after kMaxWriteDelay or when capture is stopped
+void LinuxPort::PortCapturer::writeBuffer()
 {
-    // TODO
-    return false;
+    int idle = 0;
+
+    writeFileHeader();
+
+    while (1)
+    {
+        // Read stop before head so that we see everything put before stop
+        bool stop = __atomic_load_n(&stopWriter_, __ATOMIC_ACQUIRE);
+        quint64 head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+        quint64 rotatePos = __atomic_load_n(&rotatePos_, __ATOMIC_ACQUIRE);
+        quint64 pending;
+
+        if (rotatePos && (tail_ == rotatePos))
+        {
+            QFile *segment = nextSegment();
+
+            if (segment)
+            {
+                file_->flush();
+                file_ = segment;
+                writeFileHeader();
+            }
+            __atomic_store_n(&rotatePos_, 0, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        // Don't write past the start of the next segment
+        pending = (rotatePos ? rotatePos : head) - tail_;
+
+        if ((pending >= kWriteChunkSize) || (pending
+                    && (stop || rotatePos || (idle >= kMaxWriteDelay))))
+        {
+            quint64 offset = tail_ % kBufferSize;
+            qint64 size = qMin(qMin(pending, kBufferSize - offset),
+                                kWriteChunkSize);
+
+            if (file_->write((const char*) buffer_ + offset, size) != size)
+                qWarning("%s: error writing capture file (%s)",
+                        device_.toAscii().constData(),
+                        file_->errorString().toAscii().constData());
+            file_->flush(); // for captureChunk()
+
+            __atomic_store_n(&tail_, tail_ + size, __ATOMIC_RELEASE);
+            idle = 0;
+            continue;
+        }
+
+        if (stop)
+            break;
+
+        usleep(1000);
+        idle++;
+    }
 }
 
-bool LinuxPort::setExclusiveControl(bool /*exclusive*/) 
+void LinuxPort::PortCapturer::writeFileHeader()
 {
-    // TODO
-    return false;
+    PcapFileHeader fileHeader;
+
+    fileHeader.magic = 0xa1b2c3d4;
+    fileHeader.versionMajor = 2;
+    fileHeader.versionMinor = 4;
+    fileHeader.thisZone = 0;
+    fileHeader.sigfigs = 0;
+    fileHeader.snapLen = snapLen_;
+    fileHeader.linkType = 1; // Ethernet
+
+    Q_ASSERT(sizeof(fileHeader) == kPcapFileHeaderSize);
+    file_->write((const char*) &fileHeader, sizeof(fileHeader));
 }
 
 LinuxPort::StatsMonitor::StatsMonitor()
     : QThread()
 {
+    refreshInterval_ = qMax(int(kMinRefreshInterval_),
+            appSettings->value(kStatsPollIntervalKey,
+                                kDefaultRefreshInterval_).toInt());
     stop_ = false;
     setupDone_ = false;
     ioctlSocket_ = socket(AF_INET, SOCK_DGRAM, 0);
@@ -166,7 +1362,7 @@ void LinuxPort::StatsMonitor::run()
 
 void LinuxPort::StatsMonitor::procStats()
 {
-    PortStats **portStats;
+    StatsBlock **portStats;
     int fd;
     QByteArray buf;
     int len;
@@ -221,7 +1417,7 @@ void LinuxPort::StatsMonitor::procStats()
         return;
     }
 
-    portStats = (PortStats**) calloc(count, sizeof(PortStats));
+    portStats = (StatsBlock**) calloc(count, sizeof(StatsBlock*));
     Q_ASSERT(portStats != NULL);
 
     //
@@ -258,7 +1454,9 @@ void LinuxPort::StatsMonitor::procStats()
             {
                 if (strncmp(port->name(), p, int(q-p)) == 0)
                 {
-                    portStats[index] = &(port->stats_);
+                    portStats[index] = port->stats_;
+                    // /proc/net/dev counters are unsigned long
+                    port->maxStatsValue_ = ULONG_MAX;
 
                     if (setPromisc(port->name()))
                         port->clearPromisc_ = true;
@@ -319,6 +1517,7 @@ void LinuxPort::StatsMonitor::procStats()
             quint64 rxBytes, rxPkts;
             quint64 rxErrors, rxDrops, rxFifo, rxFrame;
             quint64 txBytes, txPkts;
+            uint txErrors, txDrops;
 
             // Skip interface name - we assume the number and order of ports
             // won't change since we parsed the output before we started polling
@@ -336,37 +1535,20 @@ void LinuxPort::StatsMonitor::procStats()
             sscanf(p, fmt,
                     &rxBytes, &rxPkts, &rxErrors, &rxDrops, &rxFifo, &rxFrame, 
                         &dummy, &dummy,
-                    &txBytes, &txPkts, &dummy, &dummy, &dummy, &dummy, &dummy, 
-                        &dummy);
+                    &txBytes, &txPkts, &txErrors, &txDrops, &dummy, &dummy, 
+                        &dummy, &dummy);
 
             if (index < count)
             {
-                AbstractPort::PortStats *stats = portStats[index];
-                if (stats)
+                AbstractPort::StatsBlock *block = portStats[index];
+                if (block)
                 {
-                    // TODO: fix the pps/Bps calc similar to netlink stats
-                    stats->rxPps = 
-                        ((rxPkts >= stats->rxPkts) ? 
-                                rxPkts - stats->rxPkts : 
-                                rxPkts + (kMaxValue32 - stats->rxPkts))
-                        / kRefreshFreq_;
-                    stats->rxBps = 
-                        ((rxBytes >= stats->rxBytes) ? 
-                                rxBytes - stats->rxBytes : 
-                                rxBytes + (kMaxValue32 - stats->rxBytes))
-                        / kRefreshFreq_;
+                    AbstractPort::PortStats *stats = block->beginUpdate();
+
+                    // Rates are computed by sampleRates() once all ports
+                    // are updated
                     stats->rxPkts  = rxPkts;
                     stats->rxBytes = rxBytes;
-                    stats->txPps = 
-                        ((txPkts >= stats->txPkts) ? 
-                                txPkts - stats->txPkts : 
-                                txPkts + (kMaxValue32 - stats->txPkts))
-                        / kRefreshFreq_;
-                    stats->txBps = 
-                        ((txBytes >= stats->txBytes) ? 
-                                txBytes - stats->txBytes : 
-                                txBytes + (kMaxValue32 - stats->txBytes))
-                        / kRefreshFreq_;
                     stats->txPkts  = txPkts;
                     stats->txBytes = txBytes;
 
@@ -374,6 +1556,10 @@ void LinuxPort::StatsMonitor::procStats()
                     stats->rxErrors = rxErrors;
                     stats->rxFifoErrors = rxFifo;
                     stats->rxFrameErrors = rxFrame;
+
+                    stats->txDrops = txDrops;
+                    stats->txErrors = txErrors;
+                    block->endUpdate();
                 }
             }
 
@@ -382,7 +1568,11 @@ void LinuxPort::StatsMonitor::procStats()
             p++;
             index++;
         }
-        QThread::sleep(kRefreshFreq_);
+
+        foreach(LinuxPort* port, allPorts_)
+            port->sampleRates();
+
+        QThread::msleep(refreshInterval_);
     }
 
     free(portStats);
@@ -390,10 +1580,13 @@ void LinuxPort::StatsMonitor::procStats()
 
 int LinuxPort::StatsMonitor::netlinkStats()
 {
-    QHash<uint, PortStats*> portStats;
+    QHash<uint, StatsBlock*> portStats;
     QHash<uint, quint64*> portMaxStatsValue;
     QHash<uint, OstProto::LinkState*> linkState;
-    int fd;
+    int fd, eventFd;
+    bool pollLinkState;
+    QElapsedTimer timer;
+    qint64 nextPoll;
     struct sockaddr_nl local;
     struct sockaddr_nl kernel;
     QByteArray buf;
@@ -568,10 +1761,12 @@ _retry:
         {
             if (strcmp(port->name(), ifname) == 0)
             {
-                portStats[uint(ifi->ifi_index)] = &(port->stats_);
+                portStats[uint(ifi->ifi_index)] = port->stats_;
                 portMaxStatsValue[uint(ifi->ifi_index)] = 
                         &(port->maxStatsValue_);
                 linkState[uint(ifi->ifi_index)] = &(port->linkState_);
+                port->linkState_ = ifi->ifi_flags & IFF_RUNNING ?
+                    OstProto::LinkStateUp : OstProto::LinkStateDown;
 
                 if (setPromisc(port->name()))
                     port->clearPromisc_ = true;
@@ -598,9 +1793,18 @@ _retry:
     qDebug("stats for %d ports setup", count);
     setupDone_ = true;
 
+    // Link state changes are notified by the kernel - if we can't
+    // listen to those, the link state is updated by the polls instead.
+    // Changes between the setup dump above and opening the event socket
+    // are not notified - so the first poll always updates the link state
+    eventFd = openLinkEventSocket();
+    pollLinkState = true;
+
     //
     // We are all set - Let's start polling for stats!
     //
+    timer.start();
+    nextPoll = 0;
     while (!stop_)
     {
         if (send(fd, (void*)&ifListReq, sizeof(ifListReq), 0) < 0)
@@ -660,72 +1864,40 @@ _retry_recv:
                 {
                     x_rtnl_link_stats *rtnlStats = 
                             (x_rtnl_link_stats*) RTA_DATA(rta);
-                    AbstractPort::PortStats *stats = portStats[ifi->ifi_index];
+                    AbstractPort::StatsBlock *block = portStats[ifi->ifi_index];
+                    AbstractPort::PortStats *stats;
                     quint64 *maxStatsValue = portMaxStatsValue[ifi->ifi_index];
                     OstProto::LinkState *state = linkState[ifi->ifi_index];
 
-                    if (!stats)
+                    if (!block)
                         break;
 
-                    if (rtnlStats->rx_packets >= stats->rxPkts) {
-                        stats->rxPps = (rtnlStats->rx_packets - stats->rxPkts)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->rxPkts > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->rxPps = ((*maxStatsValue - stats->rxPkts)
-                                            + rtnlStats->rx_packets)
-                                        / kRefreshFreq_;
-                    }
-
-                    if (rtnlStats->rx_bytes >= stats->rxBytes) {
-                        stats->rxBps = (rtnlStats->rx_bytes - stats->rxBytes)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->rxBytes > kMaxValue32 ?
+                    stats = block->beginUpdate();
+
+                    // A counter going down has wrapped around - the first
+                    // time it happens, guess from its last value whether
+                    // the port has 32 or 64 bit counters
+                    if (*maxStatsValue == 0) {
+                        quint64 last = 0;
+
+                        if (rtnlStats->rx_packets < stats->rxPkts)
+                            last = stats->rxPkts;
+                        else if (rtnlStats->rx_bytes < stats->rxBytes)
+                            last = stats->rxBytes;
+                        else if (rtnlStats->tx_packets < stats->txPkts)
+                            last = stats->txPkts;
+                        else if (rtnlStats->tx_bytes < stats->txBytes)
+                            last = stats->txBytes;
+
+                        if (last)
+                            *maxStatsValue = last > kMaxValue32 ?
                                 kMaxValue64 : kMaxValue32;
-                        }
-                        stats->rxBps = ((*maxStatsValue - stats->rxBytes)
-                                            + rtnlStats->rx_bytes)
-                                        / kRefreshFreq_;
                     }
 
+                    // Rates are computed by sampleRates() once all ports
+                    // are updated
                     stats->rxPkts  = rtnlStats->rx_packets;
                     stats->rxBytes = rtnlStats->rx_bytes;
-
-                    if (rtnlStats->tx_packets >= stats->txPkts) {
-                        stats->txPps = (rtnlStats->tx_packets - stats->txPkts)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->txPkts > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->txPps = ((*maxStatsValue - stats->txPkts)
-                                            + rtnlStats->tx_packets)
-                                        / kRefreshFreq_;
-                    }
-
-                    if (rtnlStats->tx_bytes >= stats->txBytes) {
-                        stats->txBps = (rtnlStats->tx_bytes - stats->txBytes)
-                                            / kRefreshFreq_;
-                    }
-                    else {
-                        if (*maxStatsValue == 0) {
-                            *maxStatsValue = stats->txBytes > kMaxValue32 ?
-                                kMaxValue64 : kMaxValue32;
-                        }
-                        stats->txBps = ((*maxStatsValue - stats->txBytes)
-                                            + rtnlStats->tx_bytes)
-                                        / kRefreshFreq_;
-                    }
-
                     stats->txPkts  = rtnlStats->tx_packets;
                     stats->txBytes = rtnlStats->tx_bytes;
 
@@ -739,9 +1911,14 @@ _retry_recv:
                                            + rtnlStats->rx_over_errors
                                            + rtnlStats->rx_frame_errors;
 
+                    stats->txDrops = rtnlStats->tx_dropped;
+                    stats->txErrors = rtnlStats->tx_errors;
+                    block->endUpdate();
+
                     Q_ASSERT(state);  
-                    *state = ifi->ifi_flags & IFF_RUNNING ?
-                        OstProto::LinkStateUp : OstProto::LinkStateDown;
+                    if (pollLinkState)
+                        *state = ifi->ifi_flags & IFF_RUNNING ?
+                            OstProto::LinkStateUp : OstProto::LinkStateDown;
 
                     break;
                 }
@@ -753,16 +1930,117 @@ _retry_recv:
         if (!done)
             goto _retry_recv;
 
+        foreach(LinuxPort* port, allPorts_)
+            port->sampleRates();
+
 _try_later:
-        QThread::sleep(kRefreshFreq_);
+        // Polls are at fixed intervals irrespective of how long a poll
+        // takes, but those missed (e.g. on suspend) are not caught up on
+        nextPoll = qMax(nextPoll + refreshInterval_, timer.elapsed());
+        pollLinkState = (eventFd < 0);
+        while (!stop_ && (timer.elapsed() < nextPoll))
+        {
+            if (!waitForLinkEvents(eventFd, 
+                        int(nextPoll - timer.elapsed()), linkState))
+                pollLinkState = true; // lost some - resync with next poll
+        }
     }
 
+    if (eventFd >= 0)
+        close(eventFd);
+
     portStats.clear();
     linkState.clear();
 
     return 0;
 }
 
+// Returns a netlink socket that receives link up/down (RTM_NEWLINK) events
+int LinuxPort::StatsMonitor::openLinkEventSocket()
+{
+    int fd;
+    struct sockaddr_nl local;
+
+    fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+    if (fd < 0)
+    {
+        qWarning("Unable to open netlink event socket (errno %d)", errno);
+        return -1;
+    }
+
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_LINK;
+
+    if (bind(fd, (struct sockaddr*) &local, sizeof(local)) < 0)
+    {
+        qWarning("Unable to bind netlink event socket (errno %d)", errno);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*!
+ Waits upto msecs for link events and updates the link state of the ports
+ as per those received - returns false if some events were lost
+*/
+bool LinuxPort::StatsMonitor::waitForLinkEvents(int fd, int msecs,
+        QHash<uint, OstProto::LinkState*> &linkState)
+{
+    struct pollfd pfd;
+    quint64 buf[1024]; // aligned for nlmsghdr
+    int len;
+
+    if (fd < 0)
+    {
+        QThread::msleep(msecs);
+        return true;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, msecs) <= 0)
+        return true;
+
+    while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+        struct nlmsghdr *nlm = (struct nlmsghdr*) buf;
+
+        while (NLMSG_OK(nlm, (uint)len))
+        {
+            struct ifinfomsg *ifi = (struct ifinfomsg*) NLMSG_DATA(nlm);
+            OstProto::LinkState *state;
+
+            if ((nlm->nlmsg_type == RTM_NEWLINK)
+                    || (nlm->nlmsg_type == RTM_DELLINK))
+            {
+                state = linkState.value(uint(ifi->ifi_index));
+                if (state)
+                {
+                    *state = (nlm->nlmsg_type == RTM_NEWLINK)
+                                && (ifi->ifi_flags & IFF_RUNNING) ?
+                        OstProto::LinkStateUp : OstProto::LinkStateDown;
+                    qDebug("link state change (%d): %d", ifi->ifi_index,
+                            *state);
+                }
+            }
+            nlm = NLMSG_NEXT(nlm, len);
+        }
+    }
+
+    // Socket receive buffer overflowed
+    if ((len < 0) && (errno == ENOBUFS))
+    {
+        qDebug("netlink link events lost");
+        return false;
+    }
+
+    return true;
+}
+
 int LinuxPort::StatsMonitor::setPromisc(const char * portName)
 { 
     struct ifreq ifr;
@@ -26,6 +26,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcapport.h"
 
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/if_packet.h>
+
 class LinuxPort : public PcapPort
 {
 public:
@@ -38,7 +42,161 @@ public:
     virtual bool hasExclusiveControl();
     virtual bool setExclusiveControl(bool exclusive);
 
+    virtual void clearPacketList();
+    virtual void loopNextPacketSet(qint64 size, qint64 repeats,
+            long repeatDelaySec, long repeatDelayNsec);
+    virtual bool appendToPacketList(long sec, long nsec, const uchar *packet, 
+            int length);
+    virtual void setPacketListLoopMode(bool loop, 
+            quint64 secDelay, quint64 nsecDelay);
+    virtual void finishPacketList();
+    virtual bool isPacketListComplete();
+    virtual void setTransmitRateScale(double scale);
+
+    virtual void startTransmit();
+    virtual void armTransmit(QSharedPointer<StartBarrier> barrier);
+    virtual void stopTransmit();
+    virtual bool isTransmitOn();
+
 protected:
+    // Transmits a batch of packets with a single syscall instead of one per
+    // packet - using a mmap'd PACKET_TX_RING or, failing that, sendmmsg()
+    class PortTransmitter: public PcapPort::PortTransmitter
+    {
+    public:
+        PortTransmitter(const char *device);
+        ~PortTransmitter();
+        void setCpu(int cpu) { cpu_ = cpu; }
+        // Packets dropped for missing their launch time are counted here -
+        // tx pkts/bytes are counted by the StatsMonitor (from netlink)
+        void setDropStats(AbstractPort::StatsBlock *stats) {
+            dropStats_ = stats;
+        }
+        void run();
+    protected:
+        virtual int transmitPacket(const uchar *packet, int length,
+                quint64 nsecDeadline);
+        virtual int transmitFlush();
+    private:
+        enum TxMethod
+        {
+            kTxMethodPcap,
+            kTxMethodMmsg,
+            kTxMethodRing
+        };
+
+        bool setupTxSocket(const char *device);
+        bool setupTxRing(const char *device);
+        bool setupTxTime(const char *device);
+        void releaseTxSocket();
+
+        void* txFrame(uint index) { return ring_ + index*frameSize_; }
+        volatile quint32* txFrameStatus(void *frame);
+        bool waitForTxFrame(void *frame);
+        int kickTxRing();
+        int flushTxRing();
+        int flushTxBatch();
+        void waitForTxSpace(bool isDeviceQueueFull);
+        void setBatchTxTime();
+        void readTxTimeErrors();
+
+        static const uint kTxRingFrameSize = 2048;
+        static const uint kTxRingBlockSize = 64*1024;
+        static const uint kTxRingBlockCount = 64;
+        static const int kMaxTxBatch = 256;
+        static const long kTxRetryDelay = 20000; // nsec
+        static const quint64 kBatchPacingDelay = 10000; // nsec
+        static const quint64 kLaunchTimeLead = 1000000; // nsec
+
+        TxMethod txMethod_;
+        int fd_;
+        int cpu_;
+
+        // PACKET_TX_RING
+        int tpVersion_;
+        uint tpHdrLen_;
+        uchar *ring_;
+        size_t ringSize_;
+        uint frameSize_;
+        uint frameCount_;
+        uint frameIndex_;
+        uint pendingFrames_;
+
+        // sendmmsg()
+        struct mmsghdr batch_[kMaxTxBatch];
+        struct iovec batchIov_[kMaxTxBatch];
+        int batchCount_;
+        quint64 batchRetries_; // sendmmsg() retries as the queue was full
+
+        // SO_TXTIME - launch time (as per nsecTimeStamp()) per batch entry
+        // converted to txTimeClock_ (that of the qdisc) when sent
+        int txTimeClock_;
+        quint64 txTimeErrors_; // packets that missed their launch time
+        AbstractPort::StatsBlock *dropStats_;
+        quint64 batchTxTime_[kMaxTxBatch];
+        quint64 batchCmsg_[kMaxTxBatch]
+                    [CMSG_SPACE(sizeof(quint64))/sizeof(quint64)];
+    };
+
+    // Captures using a mmap'd TPACKET_V3 PACKET_RX_RING - packets are
+    // copied as pcap records into a large buffer which a separate writer
+    // thread writes to the capture file in big chunks, so that a slow disk
+    // causes drops (capRingDrops) instead of stalling the capture thread
+    class PortCapturer: public PcapPort::PortCapturer
+    {
+    public:
+        PortCapturer(const char *device, AbstractPort::StatsBlock *stats);
+        ~PortCapturer();
+        void run();
+    private:
+        class Writer: public QThread
+        {
+        public:
+            Writer(PortCapturer *capturer) { capturer_ = capturer; }
+            void run() { capturer_->writeBuffer(); }
+        private:
+            PortCapturer *capturer_;
+        };
+
+        bool setupRxRing();
+        void releaseRxRing();
+        void captureBlock(struct tpacket_block_desc *block);
+        void updateKernelDrops();
+
+        // Single producer (capture thread), single consumer (writer)
+        bool bufferPut(const void *header, int headerLen,
+                const void *data, int dataLen);
+        void bufferCopy(quint64 pos, const void *src, int len);
+        void writeBuffer();
+        void writeFileHeader();
+
+        static const uint kRxRingFrameSize = 2048;
+        static const uint kRxRingBlockSize = 1024*1024;
+        static const uint kRxRingBlockCount = 64;
+        static const uint kRxRingBlockTimeout = 10; // msec
+        static const quint64 kBufferSize = 64*1024*1024;
+        static const quint64 kWriteChunkSize = 1024*1024;
+        static const int kMaxWriteDelay = 100; // msec
+
+        int fd_;
+        uchar *ring_;
+        size_t ringSize_;
+
+        uchar *buffer_;
+        quint64 head_; // written by the capture thread only
+        quint64 tail_; // written by the writer thread only
+        bool stopWriter_;
+        Writer writer_;
+
+        // Bounded capture - the capture thread decides where (in terms of
+        // buffer position) the next segment starts, the writer switches
+        // to the next segment file when it gets there
+        quint64 rotatePos_; // 0 if no rotation is pending
+        quint64 segmentSize_;
+        quint64 usecSegmentStart_;
+        QFile *file_; // used by the writer thread only
+    };
+
     class StatsMonitor: public QThread
     {
     public:
@@ -51,13 +209,26 @@ protected:
         int netlinkStats();
         void procStats();
         int setPromisc(const char* portName);
+        int openLinkEventSocket();
+        bool waitForLinkEvents(int fd, int msecs,
+                QHash<uint, OstProto::LinkState*> &linkState);
 
-        static const int kRefreshFreq_ = 1; // in seconds
+        // Short enough for the shortest rate window (see RateMeter)
+        static const int kDefaultRefreshInterval_ = 100; // in msec
+        static const int kMinRefreshInterval_ = 50; // in msec
+        int refreshInterval_;
         bool stop_;
         bool setupDone_;
         int ioctlSocket_;
     };
 
+    // Each worker has its own socket (and hence Tx queue as per XPS when
+    // pinned to a cpu) and sends every Nth packet of the packet list;
+    // transmitter_ is the first worker
+    static const int kMaxTxWorkers = 64;
+    static const quint64 kTxWorkerStartLead = 20000000; // nsec per worker
+    QList<PortTransmitter*> txWorkers_;
+
     bool isPromisc_;
     bool clearPromisc_;
     static QList<LinuxPort*> allPorts_;
@@ -30,14 +30,27 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #endif
 
 #include "../common/streambase.h"
+#include "../rpc/pbrpccommon.h"
 #include "../rpc/pbrpccontroller.h"
 #include "portmanager.h"
+#include "statspublisher.h"
 
+#include <QCoreApplication>
+#include <QMap>
+#include <QSet>
 #include <QStringList>
 
 
 extern char *version;
 
+static void setRate(OstProto::Rate *rate, const RateMeter::Rate &r)
+{
+    rate->set_current(r.current);
+    rate->set_min(r.min);
+    rate->set_max(r.max);
+    rate->set_avg(r.avg);
+}
+
 MyService::MyService()
 {
     PortManager *portManager = PortManager::instance();
@@ -51,6 +64,7 @@ MyService::MyService()
 
 MyService::~MyService()
 {
+    qDeleteAll(statsPublishers);
     while (!portLock.isEmpty())
         delete portLock.takeFirst();
     //! \todo Use a singleton destroyer instead 
@@ -299,23 +313,28 @@ void MyService::modifyStream(::google::protobuf::RpcController* controller,
         goto _invalid_port;
 
     if (portInfo[portId]->isTransmitOn())
-        goto _port_busy;
-
-    portLock[portId]->lockForWrite();
-    for (int i = 0; i < request->stream_size(); i++)
     {
-        StreamBase    *stream;
+        bool ok = true;
 
-        stream = portInfo[portId]->stream(request->stream(i).stream_id().id());
-        if (stream)
-        {
-            stream->protoDataCopyFrom(request->stream(i));
-            portInfo[portId]->setDirty();
-        }
+        // Only the rate of a continuous stream can be changed on the fly -
+        // check all the streams first so that either all change or none
+        portLock[portId]->lockForWrite();
+        for (int i = 0; ok && (i < request->stream_size()); i++)
+            ok = portInfo[portId]->canModifyStreamRate(request->stream(i));
+        for (int i = 0; ok && (i < request->stream_size()); i++)
+            ok = portInfo[portId]->modifyStreamRate(request->stream(i));
+        portLock[portId]->unlock();
+
+        if (!ok)
+            goto _port_busy;
+
+        done->Run();
+        return;
     }
 
-    if (portInfo[portId]->isDirty())
-        portInfo[portId]->updatePacketList();
+    portLock[portId]->lockForWrite();
+    for (int i = 0; i < request->stream_size(); i++)
+        portInfo[portId]->modifyStream(request->stream(i));
     portLock[portId]->unlock();
 
     //! \todo(LOW): fill-in response "Ack"????
@@ -334,11 +353,16 @@ _exit:
 
 void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
     const ::OstProto::PortIdList* request,
-    ::OstProto::Ack* /*response*/,
+    ::OstProto::Ack* response,
     ::google::protobuf::Closure* done)
 {
+    const int kStartBarrierTimeout = 2000; // msec
+    QSharedPointer<StartBarrier> barrier(new StartBarrier);
+
     qDebug("In %s", __PRETTY_FUNCTION__);
 
+    // Arm the transmitters of all the ports first and then release them
+    // together so that all the ports start transmitting at the same time
     for (int i = 0; i < request->port_id_size(); i++)
     {
         int portId;
@@ -348,11 +372,51 @@ void MyService::startTransmit(::google::protobuf::RpcController* /*controller*/,
             continue;     //! \todo (LOW): partial RPC?
 
         portLock[portId]->lockForWrite();
-        portInfo[portId]->startTransmit();
+        if (portInfo[portId]->isDirty() && !portInfo[portId]->isTransmitOn())
+            portInfo[portId]->startPacketListUpdate();
+        portInfo[portId]->armTransmit(barrier);
         portLock[portId]->unlock();
     }
 
-    //! \todo (LOW): fill-in response "Ack"????
+    // Transmitters not ready by now start as and when they are
+    if (!barrier->waitForAll(kStartBarrierTimeout))
+        qWarning("not all ports ready to transmit in %d msec; "
+                 "starting those that are", kStartBarrierTimeout);
+    barrier->release();
+
+    // Report how each port fared - a port that doesn't join the barrier
+    // is transmitting already
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        OstProto::PortResult *result = response->add_port_result();
+        int portId = request->port_id(i).id();
+        QString reason;
+
+        result->mutable_port_id()->CopyFrom(request->port_id(i));
+        if ((portId < 0) || (portId >= portInfo.size()))
+        {
+            result->set_status(OstProto::PortResult::kFailed);
+            result->set_error("invalid portid");
+            continue;
+        }
+
+        switch (barrier->memberState(portId, &reason))
+        {
+        case StartBarrier::kJoined:
+            result->set_status(OstProto::PortResult::kPending);
+            result->set_error(QString("not ready to transmit in %1 msec; "
+                        "will start when ready").arg(kStartBarrierTimeout)
+                    .toStdString());
+            break;
+        case StartBarrier::kWithdrawn:
+            result->set_status(OstProto::PortResult::kFailed);
+            result->set_error(reason.toStdString());
+            break;
+        default:
+            result->set_status(OstProto::PortResult::kOk);
+            break;
+        }
+    }
 
     done->Run();
 }
@@ -374,6 +438,7 @@ void MyService::stopTransmit(::google::protobuf::RpcController* /*controller*/,
 
         portLock[portId]->lockForWrite();
         portInfo[portId]->stopTransmit();
+        portInfo[portId]->stopPacketListUpdate();
         portLock[portId]->unlock();
     }
 
@@ -468,48 +533,80 @@ void MyService::getStats(::google::protobuf::RpcController* /*controller*/,
     for (int i = 0; i < request->port_id_size(); i++)
     {
         int     portId;
-        AbstractPort::PortStats stats;
-        OstProto::PortStats     *s;
-        OstProto::PortState     *st;
 
         portId = request->port_id(i).id();
         if ((portId < 0) || (portId >= portInfo.size()))
             continue;     //! \todo(LOW): partial rpc?
 
-        s = response->add_port_stats();
-        s->mutable_port_id()->set_id(request->port_id(i).id());
+        portStats(portId, response->add_port_stats());
+    }
+
+    done->Run();
+}
 
-        st = s->mutable_state(); 
+/*!
+ Fills in the stats of the port - with tryLock, returns false (and fills
+ in nothing) instead of waiting if the port is locked for a change
+*/
+bool MyService::portStats(int portId, OstProto::PortStats *s, bool tryLock)
+{
+    AbstractPort::PortStats stats;
+    QList<RateMeter::WindowRates> rates;
+    OstProto::PortState     *st;
+
+    if (!tryLock)
         portLock[portId]->lockForRead();
-        st->set_link_state(portInfo[portId]->linkState()); 
-        st->set_is_transmit_on(portInfo[portId]->isTransmitOn()); 
-        st->set_is_capture_on(portInfo[portId]->isCaptureOn()); 
+    else if (!portLock[portId]->tryLockForRead())
+        return false;
 
-        portInfo[portId]->stats(&stats);
-        portLock[portId]->unlock();
+    s->mutable_port_id()->set_id(portId);
+
+    st = s->mutable_state(); 
+    st->set_link_state(portInfo[portId]->linkState()); 
+    st->set_is_transmit_on(portInfo[portId]->isTransmitOn()); 
+    st->set_is_capture_on(portInfo[portId]->isCaptureOn()); 
+
+    portInfo[portId]->stats(&stats);
+    rates = portInfo[portId]->windowRates();
+    portLock[portId]->unlock();
 
 #if 0
-        if (portId == 2)
-            qDebug(">%llu", stats.rxPkts);
+    if (portId == 2)
+        qDebug(">%llu", stats.rxPkts);
 #endif
 
-        s->set_rx_pkts(stats.rxPkts);
-        s->set_rx_bytes(stats.rxBytes);
-        s->set_rx_pps(stats.rxPps);
-        s->set_rx_bps(stats.rxBps);
+    s->set_rx_pkts(stats.rxPkts);
+    s->set_rx_bytes(stats.rxBytes);
+    s->set_rx_pps(stats.rxPps);
+    s->set_rx_bps(stats.rxBps);
+
+    s->set_tx_pkts(stats.txPkts);
+    s->set_tx_bytes(stats.txBytes);
+    s->set_tx_pps(stats.txPps);
+    s->set_tx_bps(stats.txBps);
+
+    s->set_rx_drops(stats.rxDrops);
+    s->set_rx_errors(stats.rxErrors);
+    s->set_rx_fifo_errors(stats.rxFifoErrors);
+    s->set_rx_frame_errors(stats.rxFrameErrors);
+    s->set_tx_drops(stats.txDrops);
+    s->set_tx_errors(stats.txErrors);
 
-        s->set_tx_pkts(stats.txPkts);
-        s->set_tx_bytes(stats.txBytes);
-        s->set_tx_pps(stats.txPps);
-        s->set_tx_bps(stats.txBps);
+    s->set_cap_kernel_drops(stats.capKernelDrops);
+    s->set_cap_ring_drops(stats.capRingDrops);
+
+    foreach(const RateMeter::WindowRates &w, rates)
+    {
+        OstProto::WindowRates *r = s->add_window_rates();
 
-        s->set_rx_drops(stats.rxDrops);
-        s->set_rx_errors(stats.rxErrors);
-        s->set_rx_fifo_errors(stats.rxFifoErrors);
-        s->set_rx_frame_errors(stats.rxFrameErrors);
+        r->set_window_msec(w.msecWindow);
+        setRate(r->mutable_rx_pps(), w.rate[RateMeter::kRxPkts]);
+        setRate(r->mutable_rx_bps(), w.rate[RateMeter::kRxBytes]);
+        setRate(r->mutable_tx_pps(), w.rate[RateMeter::kTxPkts]);
+        setRate(r->mutable_tx_bps(), w.rate[RateMeter::kTxBytes]);
     }
 
-    done->Run();
+    return true;
 }
 
 void MyService::clearStats(::google::protobuf::RpcController* /*controller*/,
@@ -564,6 +661,14 @@ void MyService::checkVersion(::google::protobuf::RpcController* controller,
     // Compare only major and minor numbers
     if (client[0] == my[0] && client[1] == my[1]) {
         response->set_result(OstProto::VersionCompatibility::kCompatible);
+        if (request->max_pending_rpcs() > 1) {
+            int maxPending = qMin(request->max_pending_rpcs(),
+                                  uint(PB_MAX_PENDING_RPCS));
+
+            response->set_max_pending_rpcs(maxPending);
+            static_cast<PbRpcController*>(controller)->SetMaxPendingRpcs(
+                    maxPending);
+        }
     }
     else {
         response->set_result(OstProto::VersionCompatibility::kIncompatible);
@@ -579,3 +684,251 @@ _invalid_version:
     controller->SetFailed("invalid version information");
     done->Run();
 }
+
+void MyService::getCaptureChunk(::google::protobuf::RpcController* controller,
+    const ::OstProto::CaptureChunkRequest* request,
+    ::OstProto::CaptureChunk* response,
+    ::google::protobuf::Closure* done)
+{
+    // Keep the reply well within the protobuf message size limit
+    const int kMaxChunkSize = 8*1024*1024;
+    int portId;
+    bool ok;
+
+    //qDebug("In %s", __PRETTY_FUNCTION__);
+
+    portId = request->port_id().id();
+    if ((portId < 0) || (portId >= portInfo.size()))
+        goto _invalid_port;
+
+    response->mutable_port_id()->set_id(portId);
+
+    // Unlike getCaptureBuffer(), capture is not stopped
+    portLock[portId]->lockForRead();
+    response->set_is_capture_on(portInfo[portId]->isCaptureOn());
+    ok = portInfo[portId]->captureChunk(request->offset(),
+            qMin(request->max_length(), quint32(kMaxChunkSize)),
+            request->compress(), response);
+    portLock[portId]->unlock();
+
+    if (!ok)
+        goto _error;
+
+    done->Run();
+    return;
+
+_error:
+    controller->SetFailed("unable to read capture");
+    done->Run();
+    return;
+
+_invalid_port:
+    controller->SetFailed("invalid portid");
+    done->Run();
+}
+
+void MyService::getStreamStats(::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::StreamStatsList* response,
+    ::google::protobuf::Closure* done)
+{
+    //qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId;
+
+        portId = request->port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo(LOW): partial rpc?
+
+        portLock[portId]->lockForRead();
+        portInfo[portId]->streamStats(response);
+        portLock[portId]->unlock();
+    }
+
+    done->Run();
+}
+
+void MyService::clearStreamStats(::google::protobuf::RpcController* /*controller*/,
+    const ::OstProto::PortIdList* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    for (int i = 0; i < request->port_id_size(); i++)
+    {
+        int portId;
+
+        portId = request->port_id(i).id();
+        if ((portId < 0) || (portId >= portInfo.size()))
+            continue;     //! \todo (LOW): partial RPC?
+
+        portLock[portId]->lockForWrite();
+        portInfo[portId]->resetStreamStats();
+        portLock[portId]->unlock();
+    }
+
+    done->Run();
+}
+
+void MyService::subscribeStats(::google::protobuf::RpcController* controller,
+    const ::OstProto::StatsSubscription* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    const int kMinInterval = 100; // msec; also the granularity
+    const int kMaxInterval = 60000; // msec
+    QObject *connection;
+    int interval;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    connection = static_cast<PbRpcController*>(controller)->connection();
+    if (!connection)
+    {
+        controller->SetFailed("stats can't be pushed on this connection");
+        goto _exit;
+    }
+
+    publisherLock.lock();
+
+    // A connection has at most one subscription
+    foreach(StatsPublisher *publisher, statsPublishers)
+        publisher->removeSubscriber(connection);
+
+    // Subscribers at the same interval share a publisher - so round off
+    // the interval to limit the number of publishers
+    if (request->interval_msec())
+    {
+        StatsPublisher *publisher;
+
+        interval = qBound(kMinInterval, 
+                int((request->interval_msec() + kMinInterval/2)
+                        /kMinInterval*kMinInterval),
+                kMaxInterval);
+
+        publisher = statsPublishers.value(interval);
+        if (!publisher)
+        {
+            publisher = new StatsPublisher(this, 
+                    OstProto::OstService::descriptor()->FindMethodByName(
+                        "subscribeStats")->index(),
+                    interval);
+            // Publish from the main thread as worker threads come and go
+            publisher->moveToThread(QCoreApplication::instance()->thread());
+            statsPublishers.insert(interval, publisher);
+        }
+        publisher->addSubscriber(connection);
+        qDebug("stats subscribed at %d msec", interval);
+    }
+
+    publisherLock.unlock();
+
+_exit:
+    done->Run();
+}
+
+void MyService::applyPortConfig(::google::protobuf::RpcController* controller,
+    const ::OstProto::PortStreamsConfigList* request,
+    ::OstProto::Ack* /*response*/,
+    ::google::protobuf::Closure* done)
+{
+    // key: port id, value: index into request->port() - the locks are taken
+    // in port id order, so that concurrent calls can't deadlock
+    QMap<int, int> portIndex;
+    QList<QList<StreamBase*> > streams; // same index as request->port()
+    QList<int> portIds;
+    QString error;
+
+    qDebug("In %s", __PRETTY_FUNCTION__);
+
+    // Validate the request and create the new streams before locking
+    for (int i = 0; i < request->port_size(); i++)
+    {
+        const OstProto::PortStreamsConfig &config = request->port(i);
+        int portId = config.port_id().id();
+        QSet<uint> streamIds;
+
+        streams.append(QList<StreamBase*>());
+
+        if ((portId < 0) || (portId >= portInfo.size()))
+        {
+            error = QString("invalid port id %1").arg(portId);
+            goto _error_exit;
+        }
+        if (portIndex.contains(portId))
+        {
+            error = QString("port id %1 is repeated").arg(portId);
+            goto _error_exit;
+        }
+        portIndex.insert(portId, i);
+
+        for (int j = 0; j < config.stream_size(); j++)
+        {
+            uint streamId = config.stream(j).stream_id().id();
+            StreamBase *stream;
+
+            if (streamIds.contains(streamId))
+            {
+                error = QString("stream id %1 of port %2 is repeated")
+                            .arg(streamId).arg(portId);
+                goto _error_exit;
+            }
+            streamIds.insert(streamId);
+
+            stream = new StreamBase;
+            stream->protoDataCopyFrom(config.stream(j));
+            streams[i].append(stream);
+        }
+    }
+
+    portIds = portIndex.keys();
+    foreach(int portId, portIds)
+        portLock[portId]->lockForWrite();
+
+    foreach(int portId, portIds)
+    {
+        if (portInfo[portId]->isTransmitOn())
+        {
+            error = QString("Port Busy (port id %1)").arg(portId);
+            goto _unlock_exit;
+        }
+    }
+
+    foreach(int portId, portIds)
+    {
+        int i = portIndex.value(portId);
+        const OstProto::PortStreamsConfig &config = request->port(i);
+        QList<uint> deleteIds;
+
+        for (int j = 0; j < config.delete_stream_id_size(); j++)
+            deleteIds.append(config.delete_stream_id(j).id());
+
+        portInfo[portId]->changeStreams(config.replace_streams(), deleteIds,
+                streams[i]);
+        streams[i].clear(); // owned by the port now
+    }
+
+    // Each port builds its packet list in its own thread
+    foreach(int portId, portIds)
+        portInfo[portId]->startPacketListUpdate();
+    foreach(int portId, portIds)
+        portInfo[portId]->waitForPacketListUpdate();
+
+    foreach(int portId, portIds)
+        portLock[portId]->unlock();
+
+    done->Run();
+    return;
+
+_unlock_exit:
+    foreach(int portId, portIds)
+        portLock[portId]->unlock();
+_error_exit:
+    for (int i = 0; i < streams.size(); i++)
+        qDeleteAll(streams[i]);
+    controller->SetFailed(error.toStdString());
+    done->Run();
+}
@@ -22,13 +22,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "../common/protocol.pb.h"
 
+#include <QHash>
 #include <QList>
+#include <QMutex>
 #include <QReadWriteLock>
 
 #define MAX_PKT_HDR_SIZE            1536
 #define MAX_STREAM_NAME_SIZE        64
 
 class AbstractPort;
+class StatsPublisher;
 
 class MyService: public OstProto::OstService
 {
@@ -101,6 +104,31 @@ public:
         const ::OstProto::VersionInfo* request,
         ::OstProto::VersionCompatibility* response,
         ::google::protobuf::Closure* done);
+    virtual void getCaptureChunk(::google::protobuf::RpcController* controller,
+        const ::OstProto::CaptureChunkRequest* request,
+        ::OstProto::CaptureChunk* response,
+        ::google::protobuf::Closure* done);
+    virtual void getStreamStats(::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::StreamStatsList* response,
+        ::google::protobuf::Closure* done);
+    virtual void clearStreamStats(::google::protobuf::RpcController* controller,
+        const ::OstProto::PortIdList* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void subscribeStats(::google::protobuf::RpcController* controller,
+        const ::OstProto::StatsSubscription* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+    virtual void applyPortConfig(::google::protobuf::RpcController* controller,
+        const ::OstProto::PortStreamsConfigList* request,
+        ::OstProto::Ack* response,
+        ::google::protobuf::Closure* done);
+
+    /* Not RPCs - used by StatsPublisher */
+    int portCount() const { return portInfo.size(); }
+    bool portStats(int portId, OstProto::PortStats *stats,
+            bool tryLock = false);
 
 private:
     /* 
@@ -116,6 +144,10 @@ private:
     QList<AbstractPort*>    portInfo;
     QList<QReadWriteLock*>  portLock;
 
+    // key: push interval in msec
+    QHash<int, StatsPublisher*> statsPublishers;
+    QMutex                  publisherLock;
+
 };
 
 #endif
@@ -19,68 +19,83 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 
 #include "pcapport.h"
 
+#include "../common/streambase.h"
+
+#include <QElapsedTimer>
+#include <QFileInfo>
 #include <QtGlobal>
 
 #ifdef Q_OS_WIN32
 #include <windows.h>
 #endif
 
+#ifdef Q_OS_LINUX
+#include <sys/prctl.h>
+#include <time.h>
+#endif
+
 pcap_if_t *PcapPort::deviceList_ = NULL;
 
 
 #if defined(Q_OS_LINUX)
-typedef struct timeval TimeStamp;
-static void inline getTimeStamp(TimeStamp *stamp)
-{
-    gettimeofday(stamp, NULL);
-}
+// Sleeping is accurate only to a few 10s of usecs (timer slack, wakeup
+// latency) - waits longer than kSleepThreshold sleep till kSpinMargin
+// before the deadline and spin for the rest
+static const quint64 kSleepThreshold = 200000; // nsec
+static const quint64 kSpinMargin = 50000; // nsec
 
-// Returns time diff in usecs between end and start
-static long inline udiffTimeStamp(const TimeStamp *start, const TimeStamp *end)
+quint64 PcapPort::PortTransmitter::nsecTimeStamp()
 {
-    struct timeval diff;
-    long usecs;
-
-    timersub(end, start, &diff);
+    struct timespec now;
 
-    usecs = diff.tv_usec;
-    if (diff.tv_sec)
-        usecs += diff.tv_sec*1e6;
+#ifdef CLOCK_MONOTONIC_RAW
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &now);
+#endif
 
-    return usecs;
+    return now.tv_sec*quint64(1e9) + now.tv_nsec;
 }
 #elif defined(Q_OS_WIN32)
+// Default Win32 timer resolution is ~15.6ms, so don't sleep unless the
+// wait is much longer than that
+static const quint64 kSleepThreshold = 20000000; // nsec
+static const quint64 kSpinMargin = 16000000; // nsec
+
 static quint64 gTicksFreq;
-typedef LARGE_INTEGER TimeStamp;
-static void inline getTimeStamp(TimeStamp* stamp) 
+quint64 PcapPort::PortTransmitter::nsecTimeStamp() 
 {
-    QueryPerformanceCounter(stamp);
+    LARGE_INTEGER ticks;
+
+    QueryPerformanceCounter(&ticks);
+
+    // Split to avoid overflow of ticks*1e9
+    return (ticks.QuadPart/gTicksFreq)*quint64(1e9)
+        + (ticks.QuadPart%gTicksFreq)*quint64(1e9)/gTicksFreq;
 }
+#else
+static const quint64 kSleepThreshold = 20000000; // nsec
+static const quint64 kSpinMargin = 16000000; // nsec
 
-static long inline udiffTimeStamp(const TimeStamp *start, const TimeStamp *end) 
+quint64 PcapPort::PortTransmitter::nsecTimeStamp()
 {
-    if (end->QuadPart >= start->QuadPart)
-        return (end->QuadPart - start->QuadPart)*long(1e6)/gTicksFreq;
-    else
-    {
-        // FIXME: incorrect! what's the max value for this counter before
-        // it rolls over?
-        return (start->QuadPart)*long(1e6)/gTicksFreq;
-    }
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec*quint64(1e9) + now.tv_usec*quint64(1e3);
 }
-#else
-typedef int TimeStamp;
-static void inline getTimeStamp(TimeStamp*) {}
-static long inline udiffTimeStamp(const TimeStamp*, const TimeStamp*) { return 0; }
 #endif
 
 PcapPort::PcapPort(int id, const char *device)
     : AbstractPort(id, device)
 {
-    monitorRx_ = new PortMonitor(device, kDirectionRx, &stats_);
-    monitorTx_ = new PortMonitor(device, kDirectionTx, &stats_);
+    monitorRx_ = new PortMonitor(device, kDirectionRx, newStatsBlock());
+    monitorTx_ = new PortMonitor(device, kDirectionTx, newStatsBlock());
     transmitter_ = new PortTransmitter(device);
-    capturer_ = new PortCapturer(device);
+    transmitter_->setStreamStats(&streamStats_);
+    capturer_ = new PortCapturer(device, newStatsBlock());
+    streamStatsReceiver_ = new StreamStatsReceiver(device, &streamStats_);
 
     if (!monitorRx_->handle() || !monitorTx_->handle())
         isUsable_ = false;
@@ -114,10 +129,18 @@ PcapPort::PcapPort(int id, const char *device)
 void PcapPort::init()
 {
     if (!monitorTx_->isDirectional())
-        transmitter_->useExternalStats(&stats_);
+    {
+        // Tx stats are counted by the transmitter instead
+        AbstractPort::StatsBlock *txStats = newStatsBlock();
+
+        transmitter_->useExternalStats(txStats);
+        monitorTx_->setExternalStats(txStats);
+    }
 
     transmitter_->setHandle(monitorRx_->handle());
 
+    monitorRx_->setRatePort(this);
+
     updateNotes();
 
     monitorRx_->start();
@@ -133,6 +156,10 @@ PcapPort::~PcapPort()
     if (monitorTx_)
         monitorTx_->stop();
 
+    if (streamStatsReceiver_->isRunning())
+        streamStatsReceiver_->stop();
+    delete streamStatsReceiver_;
+
     delete capturer_;
     delete transmitter_;
 
@@ -145,6 +172,16 @@ PcapPort::~PcapPort()
     delete monitorTx_;
 }
 
+bool PcapPort::setStreamStatsTracking(bool enable)
+{
+    if (enable && !streamStatsReceiver_->isRunning())
+        streamStatsReceiver_->start();
+    else if (!enable && streamStatsReceiver_->isRunning())
+        streamStatsReceiver_->stop();
+
+    return true;
+}
+
 void PcapPort::updateNotes()
 {
     QString notes;
@@ -168,7 +205,7 @@ void PcapPort::updateNotes()
 }
 
 PcapPort::PortMonitor::PortMonitor(const char *device, Direction direction,
-        AbstractPort::PortStats *stats)
+        AbstractPort::StatsBlock *stats)
 {
     int ret;
     char errbuf[PCAP_ERRBUF_SIZE] = "";
@@ -180,6 +217,8 @@ PcapPort::PortMonitor::PortMonitor(const char *device, Direction direction,
     noLocalCapture = true;
     stats_ = stats;
     stop_ = false;
+    externalStats_ = NULL;
+    ratePort_ = NULL;
 
 _retry:
 #ifdef Q_OS_WIN32
@@ -190,11 +229,11 @@ _retry:
     if (noLocalCapture)
         flags |= PCAP_OPENFLAG_NOCAPTURE_LOCAL;
 
-    handle_ = pcap_open(device, 64 /* FIXME */, flags,
+    handle_ = pcap_open(device, kSnapLen, flags,
                 1000 /* ms */, NULL, errbuf);
 #else
-    handle_ = pcap_open_live(device, 64 /* FIXME */, int(isPromisc_),
-                1000 /* ms */, errbuf);
+    handle_ = pcap_open_live(device, kSnapLen, int(isPromisc_),
+                kRateSampleInterval, errbuf);
 #endif
 
     if (handle_ == NULL)
@@ -258,47 +297,34 @@ PcapPort::PortMonitor::~PortMonitor()
 
 void PcapPort::PortMonitor::run()
 {
+    QElapsedTimer sampleTimer;
+
+    sampleTimer.start();
     while (!stop_)
     {
         int ret;
-        struct pcap_pkthdr *hdr;
-        const uchar *data;
 
-        ret = pcap_next_ex(handle_, &hdr, &data);
-        switch (ret)
-        {
-            case 1:
-                switch (direction_)
-                {
-                case kDirectionRx:
-                    stats_->rxPkts++;
-                    stats_->rxBytes += hdr->len;
-                    break;
+        // Count all packets available with one call instead of one
+        // pcap_next_ex() call per packet
+        ret = pcap_dispatch(handle_, -1, countPacket, (uchar*) this);
 
-                case kDirectionTx:
-                    if (isDirectional_)
-                    {
-                        stats_->txPkts++;
-                        stats_->txBytes += hdr->len;
-                    }
-                    break;
+        if (ratePort_ && (sampleTimer.elapsed() >= kRateSampleInterval))
+        {
+            ratePort_->sampleRates();
+            sampleTimer.restart();
+        }
 
-                default:
-                    Q_ASSERT(false);
-                }
+        if (ret >= 0)
+            continue;
 
-                //! \todo TODO pkt/bit rates
-                break;
-            case 0:
-                //qDebug("%s: timeout. continuing ...", __PRETTY_FUNCTION__);
-                continue;
+        switch (ret)
+        {
             case -1:
                 qWarning("%s: error reading packet (%d): %s", 
                         __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
                 break;
             case -2:
-                qWarning("%s: error reading packet (%d): %s", 
-                        __PRETTY_FUNCTION__, ret, pcap_geterr(handle_));
+                // pcap_breakloop() by stop()
                 break;
             default:
                 qFatal("%s: Unexpected return value %d", __PRETTY_FUNCTION__, ret);
@@ -306,6 +332,36 @@ void PcapPort::PortMonitor::run()
     }
 }
 
+void PcapPort::PortMonitor::countPacket(uchar *user, 
+        const struct pcap_pkthdr *hdr, const uchar* /*data*/)
+{
+    PortMonitor *monitor = (PortMonitor*) user;
+    AbstractPort::PortStats *stats;
+
+    switch (monitor->direction_)
+    {
+    case kDirectionRx:
+        stats = monitor->stats_->beginUpdate();
+        stats->rxPkts++;
+        stats->rxBytes += hdr->len;
+        monitor->stats_->endUpdate();
+        break;
+
+    case kDirectionTx:
+        if (monitor->isDirectional_)
+        {
+            stats = monitor->stats_->beginUpdate();
+            stats->txPkts++;
+            stats->txBytes += hdr->len;
+            monitor->stats_->endUpdate();
+        }
+        break;
+
+    default:
+        Q_ASSERT(false);
+    }
+}
+
 void PcapPort::PortMonitor::stop()
 {
     stop_ = true;
@@ -325,11 +381,23 @@ PcapPort::PortTransmitter::PortTransmitter(const char *device)
                 "This Win32 platform does not support performance counter");
 #endif
     state_ = kNotStarted;
+    publishedCount_ = 0;
+    releasedCount_ = 0;
+    listComplete_ = true;
     returnToQIdx_ = -1;
     loopDelay_ = 0;
+    shareIndex_ = 0;
+    shareCount_ = 1;
+    shareCounter_ = 0;
+    startTime_ = 0;
+    startMember_ = 0;
+    rateScale_ = 1.0;
+    minPacingDelay_ = 1000; // nsec - ~cost of a pcap_sendpacket()
+    launchTimeLead_ = 0;
     stop_ = false;
-    stats_ = new AbstractPort::PortStats;
+    stats_ = new AbstractPort::StatsBlock;
     usingInternalStats_ = true;
+    streamStats_ = NULL;
     handle_ = pcap_open_live(device, 64 /* FIXME */, 0, 1000 /* ms */, errbuf);
 
     if (handle_ == NULL)
@@ -355,14 +423,21 @@ PcapPort::PortTransmitter::~PortTransmitter()
 void PcapPort::PortTransmitter::clearPacketList()
 {
     Q_ASSERT(!isRunning());
-    // \todo lock for packetSequenceList
+
+    listLock_.lock();
     while(packetSequenceList_.size())
         delete packetSequenceList_.takeFirst();
+    publishedCount_ = 0;
+    releasedCount_ = 0;
+    listComplete_ = false;
+    listLock_.unlock();
 
     currentPacketSequence_ = NULL;
     repeatSequenceStart_ = -1;
     repeatSize_ = 0;
     packetCount_ = 0;
+    shareCounter_ = 0;
+    rateScale_ = 1.0;
 
     returnToQIdx_ = -1;
 
@@ -372,54 +447,63 @@ void PcapPort::PortTransmitter::clearPacketList()
 void PcapPort::PortTransmitter::loopNextPacketSet(qint64 size, qint64 repeats,
         long repeatDelaySec, long repeatDelayNsec)
 {
+    // All sequences so far are complete
+    publishPacketSequences(packetSequenceList_.size());
+
     currentPacketSequence_ = new PacketSequence;
     currentPacketSequence_->repeatCount_ = repeats;
-    currentPacketSequence_->usecDelay_ = repeatDelaySec * long(1e6) 
-                                            + repeatDelayNsec/1000;
+    currentPacketSequence_->nsecDelay_ = repeatDelaySec * quint64(1e9) 
+                                            + repeatDelayNsec;
 
     repeatSequenceStart_ = packetSequenceList_.size();
     repeatSize_ = size;
     packetCount_ = 0;
 
+    listLock_.lock();
     packetSequenceList_.append(currentPacketSequence_);
+    listLock_.unlock();
 }
 
 bool PcapPort::PortTransmitter::appendToPacketList(long sec, long nsec, 
         const uchar *packet, int length)
 {
     bool op = true;
+    bool keep = int(shareCounter_++ % shareCount_) == shareIndex_;
     pcap_pkthdr pktHdr;
 
     pktHdr.caplen = pktHdr.len = length;
     pktHdr.ts.tv_sec = sec;
-    pktHdr.ts.tv_usec = nsec/1000;
+    pktHdr.ts.tv_usec = nsec/kTsFractionNsec;
 
-    if (currentPacketSequence_ == NULL || 
-            !currentPacketSequence_->hasFreeSpace(2*sizeof(pcap_pkthdr)+length))
+    if (currentPacketSequence_ == NULL || (keep &&
+            !currentPacketSequence_->hasFreeSpace(2*sizeof(pcap_pkthdr)+length)))
     {
         if (currentPacketSequence_ != NULL)
         {
-            long usecs;
-
-            usecs = (pktHdr.ts.tv_sec 
-                        - currentPacketSequence_->lastPacket_->ts.tv_sec) 
-                            * long(1e6);
-            usecs += (pktHdr.ts.tv_usec 
-                        - currentPacketSequence_->lastPacket_->ts.tv_usec);
-            currentPacketSequence_->usecDelay_ = usecs;
+            currentPacketSequence_->nsecDelay_ = nsecDiff(
+                    currentPacketSequence_->lastTs_, pktHdr.ts);
         }
 
+        // Sequences of a packet set can be published only once the
+        // whole set is complete
+        if (repeatSize_ == 0)
+            publishPacketSequences(packetSequenceList_.size());
+
         //! \todo (LOW): calculate sendqueue size
         currentPacketSequence_ = new PacketSequence;
 
+        listLock_.lock();
         packetSequenceList_.append(currentPacketSequence_);
+        listLock_.unlock();
 
         // Validate that the pkt will fit inside the new currentSendQueue_
         Q_ASSERT(currentPacketSequence_->hasFreeSpace(
                     sizeof(pcap_pkthdr) + length));
     }
 
-    if (currentPacketSequence_->appendPacket(&pktHdr, (u_char*) packet) < 0)
+    if (!keep)
+        currentPacketSequence_->skipPacket(&pktHdr);
+    else if (currentPacketSequence_->appendPacket(&pktHdr, (u_char*) packet) < 0)
     {
         op = false;
     }
@@ -434,12 +518,12 @@ bool PcapPort::PortTransmitter::appendToPacketList(long sec, long nsec,
         Q_ASSERT(repeatSequenceStart_ >= 0);
         Q_ASSERT(repeatSequenceStart_ < packetSequenceList_.size());
 
-        if (currentPacketSequence_ != packetSequenceList_[repeatSequenceStart_])
+        if (currentPacketSequence_ != packetSequenceList_.at(repeatSequenceStart_))
         {
-            PacketSequence *start = packetSequenceList_[repeatSequenceStart_];
+            PacketSequence *start = packetSequenceList_.at(repeatSequenceStart_);
 
-            currentPacketSequence_->usecDelay_ = start->usecDelay_;
-            start->usecDelay_ = 0;
+            currentPacketSequence_->nsecDelay_ = start->nsecDelay_;
+            start->nsecDelay_ = 0;
             start->repeatSize_ = 
                     packetSequenceList_.size() - repeatSequenceStart_;
         }
@@ -448,11 +532,88 @@ bool PcapPort::PortTransmitter::appendToPacketList(long sec, long nsec,
 
         // End current pktSeq and trigger a new pktSeq allocation for next pkt 
         currentPacketSequence_ = NULL;
+
+        publishPacketSequences(packetSequenceList_.size());
     }
 
     return op;
 }
 
+void PcapPort::PortTransmitter::finishPacketList()
+{
+    publishPacketSequences(packetSequenceList_.size());
+
+    listLock_.lock();
+    listComplete_ = true;
+    listChanged_.wakeAll();
+    listLock_.unlock();
+}
+
+bool PcapPort::PortTransmitter::isPacketListComplete()
+{
+    QMutexLocker locker(&listLock_);
+
+    return listComplete_ && (releasedCount_ == 0);
+}
+
+void PcapPort::PortTransmitter::publishPacketSequences(int count)
+{
+    QMutexLocker locker(&listLock_);
+
+    publishedCount_ = count;
+    listChanged_.wakeAll();
+
+    // Don't run too far ahead of the transmitter if it is releasing the
+    // sequences it has sent
+    while ((returnToQIdx_ < 0) && (state_ == kRunning)
+            && ((publishedCount_ - releasedCount_) >= kMaxPendingSequences))
+        listChanged_.wait(&listLock_, 100);
+}
+
+/*!
+ Returns false if there's no sequence at index and none is coming -
+ otherwise sequences is updated with all the sequences published so far,
+ which the transmitter uses without locking till it needs more
+*/
+bool PcapPort::PortTransmitter::waitForPacketSequence(int index,
+        QList<PacketSequence*> &sequences)
+{
+    // Queued packets must not wait for the builder
+    transmitFlush();
+
+    QMutexLocker locker(&listLock_);
+
+    while ((index >= publishedCount_) && !listComplete_ && !stop_)
+        listChanged_.wait(&listLock_, 100);
+
+    sequences = packetSequenceList_.mid(0, publishedCount_);
+
+    return (index < publishedCount_);
+}
+
+void PcapPort::PortTransmitter::releasePacketSequences(int index, int count)
+{
+    // Can't release if we may need to send these again
+    if ((returnToQIdx_ >= 0) || listComplete_)
+        return;
+
+    // Queued packets may refer to the sequences being released
+    transmitFlush();
+
+    QMutexLocker locker(&listLock_);
+
+    if (listComplete_)
+        return;
+
+    for (int i = index; i < (index + count); i++)
+    {
+        delete packetSequenceList_.at(i);
+        packetSequenceList_[i] = NULL;
+    }
+    releasedCount_ += count;
+    listChanged_.wakeAll();
+}
+
 void PcapPort::PortTransmitter::setHandle(pcap_t *handle)
 {
     if (usingInternalHandle_)
@@ -461,7 +622,7 @@ void PcapPort::PortTransmitter::setHandle(pcap_t *handle)
     usingInternalHandle_ = false;
 }
 
-void PcapPort::PortTransmitter::useExternalStats(AbstractPort::PortStats *stats)
+void PcapPort::PortTransmitter::useExternalStats(AbstractPort::StatsBlock *stats)
 {
     if (usingInternalStats_)
         delete stats_;
@@ -471,8 +632,6 @@ void PcapPort::PortTransmitter::useExternalStats(AbstractPort::PortStats *stats)
 
 void PcapPort::PortTransmitter::run()
 {
-    //! \todo (MED) Stream Mode - continuous: define before implement
-
     // NOTE1: We can't use pcap_sendqueue_transmit() directly even on Win32
     // 'coz of 2 reasons - there's no way of stopping it before all packets
     // in the sendQueue are sent out and secondly, stats are available only
@@ -487,83 +646,125 @@ void PcapPort::PortTransmitter::run()
 
     const int kSyncTransmit = 1;
     int i;
-    long overHead = 0; // overHead should be negative or zero
-
-    qDebug("packetSequenceList_.size = %d", packetSequenceList_.size());
-    if (packetSequenceList_.size() <= 0)
-        goto _exit;
-
-    for(i = 0; i < packetSequenceList_.size(); i++) {
-        qDebug("sendQ[%d]: rptCnt = %d, rptSz = %d, usecDelay = %ld", i, 
+    quint64 deadline; // absolute time (nsec) at which next pkt is due
+    QList<PacketSequence*> sequences; // published ones
+
+    listLock_.lock();
+    qDebug("packetSequenceList_.size = %d (%s)", packetSequenceList_.size(),
+            listComplete_ ? "complete" : "being built");
+    for(i = 0; i < publishedCount_; i++) {
+        qDebug("sendQ[%d]: rptCnt = %d, rptSz = %d, nsecDelay = %llu", i, 
                 packetSequenceList_.at(i)->repeatCount_, 
                 packetSequenceList_.at(i)->repeatSize_,
-                packetSequenceList_.at(i)->usecDelay_);
-        qDebug("sendQ[%d]: pkts = %ld, usecDuration = %ld", i, 
+                packetSequenceList_.at(i)->nsecDelay_);
+        qDebug("sendQ[%d]: pkts = %ld, nsecDuration = %llu", i, 
                 packetSequenceList_.at(i)->packets_, 
-                packetSequenceList_.at(i)->usecDuration_);
+                packetSequenceList_.at(i)->nsecDuration_);
     }
+    listLock_.unlock();
+
+#ifdef Q_OS_LINUX
+    // Default timer slack of 50us makes nanosleep() overshoot
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+#endif
 
+    listLock_.lock();
     state_ = kRunning;
+    listChanged_.wakeAll();
+    listLock_.unlock();
+
+    // Sent packets of the last transmit were released - the port should
+    // have been marked dirty and the packet list rebuilt
+    if (releasedCount_)
+    {
+        qWarning("packet list is incomplete; not transmitting");
+        if (startBarrier_)
+            startBarrier_->withdraw(startMember_,
+                    "packet list is incomplete");
+        stop_ = false;
+        goto _exit;
+    }
+
+    if (!waitForPacketSequence(0, sequences))
+    {
+        if (startBarrier_)
+            startBarrier_->withdraw(startMember_, stop_ ?
+                    "transmit stopped" : "no packets to transmit");
+        stop_ = false;
+        goto _exit;
+    }
+
+    if (startBarrier_)
+    {
+        // Our first packet is ready - wait for the others being started
+        // along with us
+        startBarrier_->arrive(startMember_);
+        while (!startBarrier_->waitForRelease(100))
+        {
+            if (stop_)
+            {
+                stop_ = false;
+                goto _exit;
+            }
+        }
+        deadline = startBarrier_->startTime(nsecTimeStamp());
+    }
+    else
+        deadline = startTime_ ? startTime_ : nsecTimeStamp();
     i = 0;
-    while (i < packetSequenceList_.size())
+    while ((i < sequences.size()) || waitForPacketSequence(i, sequences))
     {
 
 _restart:
-        int rptSz  = packetSequenceList_.at(i)->repeatSize_;
-        int rptCnt = packetSequenceList_.at(i)->repeatCount_;
+        int rptSz  = sequences.at(i)->repeatSize_;
+        int rptCnt = sequences.at(i)->repeatCount_;
 
-        for (int j = 0; j < rptCnt; j++)
+        // A -ve repeat count (continuous mode) means repeat till stopped
+        for (quint64 j = 0; (rptCnt < 0) || (j < quint64(rptCnt)); j++)
         {
             for (int k = 0; k < rptSz; k++)
             {
                 int ret;
-                PacketSequence *seq = packetSequenceList_.at(i+k);
+                PacketSequence *seq = sequences.at(i+k);
 #ifdef Q_OS_WIN32
-                TimeStamp ovrStart, ovrEnd;
-
-                if (seq->usecDuration_ <= long(1e6)) // 1s
+                // Signatures need to be stamped per packet
+                if ((seq->nsecDuration_ <= quint64(1e9)) // 1s
+                        && (rateScale_ == 1.0)
+                        && !(streamStats_ && streamStats_->isTxTracking()))
                 {
-                    getTimeStamp(&ovrStart);
+                    waitUntil(deadline);
                     ret = pcap_sendqueue_transmit(handle_, 
                             seq->sendQueue_, kSyncTransmit);
                     if (ret >= 0)
                     {
-                        stats_->txPkts += seq->packets_;
-                        stats_->txBytes += seq->bytes_;
+                        AbstractPort::PortStats *stats = stats_->beginUpdate();
 
-                        getTimeStamp(&ovrEnd);
-                        overHead += seq->usecDuration_ 
-                            - udiffTimeStamp(&ovrStart, &ovrEnd);
-                        Q_ASSERT(overHead <= 0);
+                        stats->txPkts += seq->packets_;
+                        stats->txBytes += seq->bytes_;
+                        stats_->endUpdate();
+                        deadline += seq->nsecDuration_;
                     }
                     if (stop_)
                         ret = -2;
                 }
                 else
                 {
-                    ret = sendQueueTransmit(handle_, seq->sendQueue_, 
-                            overHead, kSyncTransmit);
+                    ret = sendQueueTransmit(seq, deadline,
+                            kSyncTransmit);
                 }
 #else
-                ret = sendQueueTransmit(handle_, seq->sendQueue_, 
-                            overHead, kSyncTransmit);
+                ret = sendQueueTransmit(seq, deadline,
+                            kSyncTransmit);
 #endif
 
                 if (ret >= 0)
                 {
-                    long usecs = seq->usecDelay_ + overHead; 
-                    if (usecs > 0) 
-                    {
-                        udelay(usecs);
-                        overHead = 0;
-                    }
-                    else
-                        overHead = usecs;
+                    // wait is deferred to the first pkt of the next seq
+                    deadline += scaled(seq->nsecDelay_);
                 }
                 else
                 {
                     qDebug("error %d in sendQueueTransmit()", ret);
-                    qDebug("overHead = %ld", overHead);
                     stop_ = false;
                     goto _exit;
                 }
@@ -571,30 +772,35 @@ _restart:
         }
 
         // Move to the next Packet Set
+        releasePacketSequences(i, rptSz);
         i += rptSz;
     }
 
-    if (returnToQIdx_ >= 0)
+    if (stop_)
     {
-        long usecs = loopDelay_ + overHead;
+        stop_ = false;
+        goto _exit;
+    }
 
-        if (usecs > 0)
-        {
-            udelay(usecs);
-            overHead = 0;
-        }
-        else
-            overHead = usecs;
+    if (returnToQIdx_ >= 0)
+    {
+        deadline += scaled(loopDelay_);
 
         i = returnToQIdx_;
         goto _restart;
     }
 
 _exit:
+    startBarrier_.clear();
+
+    listLock_.lock();
     state_ = kFinished;
+    listChanged_.wakeAll();
+    listLock_.unlock();
 }
 
-void PcapPort::PortTransmitter::start()
+void PcapPort::PortTransmitter::start(QSharedPointer<StartBarrier> barrier,
+        int member)
 {
     // FIXME: return error
     if (state_ == kRunning) {
@@ -602,11 +808,18 @@ void PcapPort::PortTransmitter::start()
         return;
     }
 
+    startBarrier_ = barrier;
+    startMember_ = member;
+    if (startBarrier_)
+        startBarrier_->join(member);
+
     state_ = kNotStarted;
     QThread::start();
 
+    listLock_.lock();
     while (state_ == kNotStarted)
-        QThread::msleep(10);
+        listChanged_.wait(&listLock_);
+    listLock_.unlock();
 }
 
 void PcapPort::PortTransmitter::stop()
@@ -628,17 +841,27 @@ bool PcapPort::PortTransmitter::isRunning()
     return (state_ == kRunning);
 }
 
-int PcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
-        pcap_send_queue *queue, long &overHead, int sync)
+int PcapPort::PortTransmitter::sendQueueTransmit(PacketSequence *seq,
+        quint64 &nsecDeadline, int sync)
 {
-    TimeStamp ovrStart, ovrEnd;
+    pcap_send_queue *queue = seq->sendQueue_;
     struct timeval ts;
     struct pcap_pkthdr *hdr = (struct pcap_pkthdr*) queue->buffer;
     char *end = queue->buffer + queue->len;
+    quint64 pacedDeadline = 0;
+    qint64 wallClockOffset = 0;
+    bool isStamping = streamStats_ && streamStats_->isTxTracking();
+    AbstractPort::PortStats *stats;
 
-    ts = hdr->ts;
+    ts = seq->firstTs_;
+
+    // Paced packets are stamped with when they are scheduled to be sent -
+    // mapped from our (monotonic) clock to the wall clock used by stream
+    // stats; the offset is refreshed per sequence to follow clock slew
+    if (isStamping && sync)
+        wallClockOffset = qint64(StreamStats::nsecWallClock()
+                                    - nsecTimeStamp());
 
-    getTimeStamp(&ovrStart);
     while((char*) hdr < end)
     {
         uchar *pkt = (uchar*)hdr + sizeof(*hdr);
@@ -646,31 +869,48 @@ int PcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
 
         if (sync)
         {
-            long usec = (hdr->ts.tv_sec - ts.tv_sec) * 1000000 +
-                (hdr->ts.tv_usec - ts.tv_usec);
-
-            getTimeStamp(&ovrEnd);
+            nsecDeadline += scaled(nsecDiff(ts, hdr->ts));
+            ts = hdr->ts;
 
-            overHead -= udiffTimeStamp(&ovrStart, &ovrEnd);
-            Q_ASSERT(overHead <= 0);
-            usec += overHead;
-            if (usec > 0)
+            // Gaps smaller than what a wait can achieve are accumulated
+            // and the packets sent back to back - pacing is done once per
+            // such batch of packets instead of once per packet. Since the
+            // deadline is absolute, any time lost (or gained) is made up
+            // at the next pacing point without any explicit bookkeeping
+            if (nsecDeadline - pacedDeadline >= minPacingDelay_)
             {
-                udelay(usec);
-                overHead = 0;
-            }
-            else
-                overHead = usec;
+                quint64 wakeup = nsecDeadline - launchTimeLead_;
 
-            ts = hdr->ts;
-            getTimeStamp(&ovrStart);
+                if (nsecTimeStamp() < wakeup)
+                {
+                    transmitFlush();
+                    waitUntil(wakeup);
+                }
+                pacedDeadline = nsecDeadline;
+            }
         }
 
         Q_ASSERT(pktLen > 0);
 
-        pcap_sendpacket(p, pkt, pktLen);
-        stats_->txPkts++;
-        stats_->txBytes += pktLen;
+        if (isStamping)
+        {
+            quint64 nsecTxTime = 0;
+
+            // With launch time the packet leaves exactly at its deadline;
+            // without, within the pacing granularity of it - or now if we
+            // are running late
+            if (sync)
+                nsecTxTime = (launchTimeLead_ ? nsecDeadline
+                                : qMax(nsecDeadline, nsecTimeStamp()))
+                             + wallClockOffset;
+            streamStats_->stamp(pkt, pktLen, nsecTxTime);
+        }
+
+        transmitPacket(pkt, pktLen, nsecDeadline);
+        stats = stats_->beginUpdate();
+        stats->txPkts++;
+        stats->txBytes += pktLen;
+        stats_->endUpdate();
 
         // Step to the next packet in the buffer
         hdr = (struct pcap_pkthdr*) (pkt + pktLen);
@@ -678,52 +918,234 @@ int PcapPort::PortTransmitter::sendQueueTransmit(pcap_t *p,
 
         if (stop_)
         {
+            transmitFlush();
             return -2;
         }
     }
 
+    // Queued packets are flushed only before a wait (or when the batch is
+    // full) - not at the end of every sequence, so that the packets of a
+    // short sequence repeated back to back are sent in as few batches
+
+    // Account for any packets skipped after the last one sent
+    if (sync)
+        nsecDeadline += scaled(nsecDiff(ts, seq->lastTs_));
+
+    // A sequence with none of our packets (see setPacketListShare()) must
+    // still take up its time and not hold up a stop
+    if (!seq->packets_)
+    {
+        if (sync && (nsecTimeStamp() < nsecDeadline))
+        {
+            transmitFlush();
+            waitUntil(nsecDeadline);
+        }
+        if (stop_)
+            return -2;
+    }
+
     return 0;
 }
 
-void PcapPort::PortTransmitter::udelay(long usec)
+int PcapPort::PortTransmitter::transmitPacket(const uchar *packet, int length,
+        quint64 /*nsecDeadline*/)
+{
+    return pcap_sendpacket(handle_, packet, length);
+}
+
+void PcapPort::PortTransmitter::waitUntil(quint64 nsecDeadline)
 {
-#if defined(Q_OS_WIN32)
-    LARGE_INTEGER tgtTicks;
-    LARGE_INTEGER curTicks;
+    quint64 now = nsecTimeStamp();
+
+    if (now >= nsecDeadline)
+        return;
 
-    QueryPerformanceCounter(&curTicks);
-    tgtTicks.QuadPart = curTicks.QuadPart + (usec*ticksFreq_)/1000000;
+    // Sleep for the bulk of a long wait in small enough chunks so that
+    // a stop request is not held up
+    while (!stop_ && (nsecDeadline - now) > kSleepThreshold)
+    {
+        quint64 nsec = qMin(nsecDeadline - now - kSpinMargin, quint64(1e8));
+#if defined(Q_OS_LINUX)
+        struct timespec delay;
 
-    while (curTicks.QuadPart < tgtTicks.QuadPart)
-        QueryPerformanceCounter(&curTicks);
-#elif defined(Q_OS_LINUX)
-    struct timeval delay, target, now;
+        delay.tv_sec = nsec/quint64(1e9);
+        delay.tv_nsec = nsec%quint64(1e9);
+        nanosleep(&delay, NULL);
+#else
+        QThread::usleep(nsec/1000);
+#endif
+        now = nsecTimeStamp();
+    }
 
-    //qDebug("usec delay = %ld", usec);
+    if (stop_)
+        return;
 
-    delay.tv_sec = 0;
-    delay.tv_usec = usec;
+    // Spin for the rest
+    while (now < nsecDeadline)
+        now = nsecTimeStamp();
+}
 
-    while (delay.tv_usec >= 1000000)
+PcapPort::StreamStatsReceiver::StreamStatsReceiver(const char *device,
+        StreamStats *streamStats)
+{
+    device_ = QString::fromAscii(device);
+    streamStats_ = streamStats;
+    handle_ = NULL;
+    tsFractionNsec_ = 1000;
+    stop_ = false;
+}
+
+/*!
+ Opens the device for nsec rx timestamps - from the NIC if it can timestamp
+ in sync with the system clock (the tx time in the signature is as per the
+ system clock), from the kernel otherwise
+*/
+pcap_t* PcapPort::StreamStatsReceiver::open(char *errbuf)
+{
+#ifdef PCAP_TSTAMP_PRECISION_NANO
+    pcap_t *handle;
+    int *types = NULL;
+    int count;
+    bool tryHwTimestamp = true;
+    bool isHwTimestamp;
+
+_retry:
+    isHwTimestamp = false;
+    handle = pcap_create(device_.toAscii().constData(), errbuf);
+    if (handle == NULL)
+        return NULL;
+
+    pcap_set_snaplen(handle, kSnapLen);
+    pcap_set_promisc(handle, 1);
+    pcap_set_timeout(handle, kReadTimeout);
+    pcap_set_tstamp_precision(handle, PCAP_TSTAMP_PRECISION_NANO);
+
+    if (tryHwTimestamp)
     {
-        delay.tv_sec++;
-        delay.tv_usec -= 1000000;
+        count = pcap_list_tstamp_types(handle, &types);
+        for (int i = 0; i < count; i++)
+        {
+            if (types[i] == PCAP_TSTAMP_ADAPTER)
+            {
+                isHwTimestamp = (pcap_set_tstamp_type(handle,
+                                    PCAP_TSTAMP_ADAPTER) == 0);
+                break;
+            }
+        }
+        if (types)
+            pcap_free_tstamp_types(types);
+        types = NULL;
     }
 
-    gettimeofday(&now, NULL);
-    timeradd(&now, &delay, &target);
+    // Warnings (+ve return values) are ok
+    if (pcap_activate(handle) < 0)
+    {
+        qstrncpy(errbuf, pcap_geterr(handle), PCAP_ERRBUF_SIZE);
+        pcap_close(handle);
+        if (isHwTimestamp)
+        {
+            qDebug("%s: unable to use NIC timestamps (%s)",
+                    device_.toAscii().constData(), errbuf);
+            tryHwTimestamp = false;
+            goto _retry;
+        }
+        return NULL;
+    }
 
-    do {
-        gettimeofday(&now, NULL);
-    } while (timercmp(&now, &target, <));
+    tsFractionNsec_ = (pcap_get_tstamp_precision(handle)
+                        == PCAP_TSTAMP_PRECISION_NANO) ? 1 : 1000;
+    streamStats_->setRxHwTimestamp(isHwTimestamp);
+
+    return handle;
 #else
-    QThread::usleep(usec);
-#endif 
+    tsFractionNsec_ = 1000;
+    streamStats_->setRxHwTimestamp(false);
+
+    return pcap_open_live(device_.toAscii().constData(), kSnapLen,
+                    1 /* promisc */, kReadTimeout, errbuf);
+#endif
 }
 
-PcapPort::PortCapturer::PortCapturer(const char *device)
+void PcapPort::StreamStatsReceiver::run()
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = "";
+    struct bpf_program program;
+    // Let the kernel drop frames without a signature
+    QString filter = QString("ether[len - %1:4] = 0x%2")
+                        .arg(kStreamSignatureSize)
+                        .arg(StreamStats::kMagic, 0, 16);
+
+    handle_ = open(errbuf);
+    if (handle_ == NULL)
+    {
+        qWarning("%s: Error opening port %s: %s", __FUNCTION__,
+                device_.toAscii().constData(), errbuf);
+        goto _exit;
+    }
+
+#ifndef Q_OS_WIN32
+    // Own transmitted frames are not received
+    if (pcap_setdirection(handle_, PCAP_D_IN) < 0)
+        qDebug("%s: unable to set direction (%s)",
+                device_.toAscii().constData(), pcap_geterr(handle_));
+#endif
+
+    if (pcap_compile(handle_, &program, filter.toAscii().data(),
+                1 /* optimize */, 0xffffffff /* netmask unknown */) == 0)
+    {
+        if (pcap_setfilter(handle_, &program) < 0)
+            qDebug("%s: unable to set filter (%s)",
+                    device_.toAscii().constData(), pcap_geterr(handle_));
+        pcap_freecode(&program);
+    }
+
+    while (!stop_)
+    {
+        if (pcap_dispatch(handle_, -1, receivePacket, (uchar*) this) == -1)
+        {
+            qWarning("%s: error reading packet: %s", __PRETTY_FUNCTION__,
+                    pcap_geterr(handle_));
+            break;
+        }
+    }
+
+    pcap_close(handle_);
+    handle_ = NULL;
+
+_exit:
+    stop_ = false;
+}
+
+void PcapPort::StreamStatsReceiver::stop()
+{
+    stop_ = true;
+    wait();
+}
+
+void PcapPort::StreamStatsReceiver::receivePacket(uchar *user,
+        const struct pcap_pkthdr *hdr, const uchar *data)
+{
+    StreamStatsReceiver *receiver = (StreamStatsReceiver*) user;
+
+    // Only whole frames have the signature at the end
+    if (hdr->caplen != hdr->len)
+        return;
+
+    receiver->streamStats_->receive(data, hdr->caplen,
+            hdr->ts.tv_sec*quint64(1e9)
+                + hdr->ts.tv_usec*receiver->tsFractionNsec_);
+}
+
+PcapPort::PortCapturer::PortCapturer(const char *device,
+        AbstractPort::StatsBlock *stats)
 {
     device_ = QString::fromAscii(device);
+    stats_ = stats;
+    maxSize_ = 0;
+    usecMaxDuration_ = 0;
+    fileCount_ = 1;
+    discardedSize_ = 0;
+    snapLen_ = 65535;
     stop_ = false;
     state_ = kNotStarted;
 
@@ -738,13 +1160,48 @@ PcapPort::PortCapturer::PortCapturer(const char *device)
 
 PcapPort::PortCapturer::~PortCapturer()
 {
+    qDeleteAll(segments_);
     capFile_.close();
 }
 
+void PcapPort::PortCapturer::setLimits(quint64 maxSize, 
+        quint64 usecMaxDuration, int fileCount)
+{
+    maxSize_ = maxSize;
+    usecMaxDuration_ = usecMaxDuration;
+    // Need at least one segment besides the one being written
+    fileCount_ = qMax(2, fileCount);
+}
+
+void PcapPort::PortCapturer::setFilter(const QString &filter, int snapLen)
+{
+    filter_ = filter;
+    snapLen_ = ((snapLen > 0) && (snapLen < 65535)) ? snapLen : 65535;
+}
+
+bool PcapPort::PortCapturer::compileFilter(pcap_t *handle, 
+        struct bpf_program *program)
+{
+    if (pcap_compile(handle, program, filter_.toAscii().data(), 
+                1 /* optimize */, 0xffffffff /* netmask unknown */) < 0)
+    {
+        qWarning("%s: invalid capture filter '%s' (%s)",
+                device_.toAscii().constData(), 
+                filter_.toAscii().constData(), pcap_geterr(handle));
+        return false;
+    }
+
+    return true;
+}
+
 void PcapPort::PortCapturer::run()
 {
     int flag = PCAP_OPENFLAG_PROMISCUOUS;
     char errbuf[PCAP_ERRBUF_SIZE] = "";
+    uint kernelDrops = 0;
+    QFile *dumpFile;
+    quint64 usecSegmentStart = 0;
+    struct bpf_program program;
     
     qDebug("In %s", __PRETTY_FUNCTION__);
 
@@ -754,7 +1211,7 @@ void PcapPort::PortCapturer::run()
         goto _exit;
     }
 _retry:
-    handle_ = pcap_open_live(device_.toAscii().constData(), 65535, 
+    handle_ = pcap_open_live(device_.toAscii().constData(), snapLen_, 
                     flag, 1000 /* ms */, errbuf);
 
     if (handle_ == NULL)
@@ -774,8 +1231,29 @@ _retry:
         }
     }
 
+    if (!filter_.isEmpty())
+    {
+        if (!compileFilter(handle_, &program))
+        {
+            pcap_close(handle_);
+            handle_ = NULL;
+            goto _exit;
+        }
+        if (pcap_setfilter(handle_, &program) < 0)
+            qWarning("%s: unable to set capture filter (%s)",
+                    device_.toAscii().constData(), pcap_geterr(handle_));
+        pcap_freecode(&program);
+    }
+
+    dumpFile = startSegments();
+    if (!dumpFile)
+    {
+        pcap_close(handle_);
+        handle_ = NULL;
+        goto _exit;
+    }
     dumpHandle_ = pcap_dump_open(handle_, 
-            capFile_.fileName().toAscii().constData());
+            dumpFile->fileName().toAscii().constData());
     state_ = kRunning;
     while (1)
     {
@@ -787,10 +1265,30 @@ _retry:
         switch (ret)
         {
             case 1:
+                if (isBounded())
+                {
+                    quint64 usec = hdr->ts.tv_sec*quint64(1000000)
+                                        + hdr->ts.tv_usec;
+
+                    if (!usecSegmentStart)
+                        usecSegmentStart = usec;
+                    if (isSegmentFull(pcap_dump_ftell(dumpHandle_),
+                                usec - usecSegmentStart)
+                            && (dumpFile = nextSegment()))
+                    {
+                        pcap_dump_close(dumpHandle_);
+                        dumpHandle_ = pcap_dump_open(handle_,
+                                dumpFile->fileName().toAscii().constData());
+                        usecSegmentStart = usec;
+                    }
+                }
                 pcap_dump((uchar*) dumpHandle_, hdr, data);
                 break;
             case 0:
-                // timeout: just go back to the loop
+                // timeout: just go back to the loop (after making what's
+                // captured so far available to captureChunk())
+                pcap_dump_flush(dumpHandle_);
+                updateKernelDrops(kernelDrops);
                 break;
             case -1:
                 qWarning("%s: error reading packet (%d): %s", 
@@ -807,6 +1305,7 @@ _retry:
             break;
         }
     }
+    updateKernelDrops(kernelDrops);
     pcap_dump_close(dumpHandle_);
     pcap_close(handle_);
     dumpHandle_ = NULL;
@@ -817,6 +1316,19 @@ _exit:
     state_ = kFinished;
 }
 
+// pcap_stats() drops are cumulative since the handle was opened
+void PcapPort::PortCapturer::updateKernelDrops(uint &lastDrops)
+{
+    struct pcap_stat ps;
+
+    if (pcap_stats(handle_, &ps) == 0)
+    {
+        stats_->beginUpdate()->capKernelDrops += ps.ps_drop - lastDrops;
+        stats_->endUpdate();
+        lastDrops = ps.ps_drop;
+    }
+}
+
 void PcapPort::PortCapturer::start()
 {
     // FIXME: return error
@@ -851,7 +1363,200 @@ bool PcapPort::PortCapturer::isRunning()
     return (state_ == kRunning);
 }
 
+bool PcapPort::PortCapturer::isSegmentFull(quint64 size, 
+        quint64 usecDuration)
+{
+    if (maxSize_ && (size >= maxSize_/fileCount_))
+        return true;
+    if (usecMaxDuration_ && (usecDuration >= usecMaxDuration_/fileCount_))
+        return true;
+    return false;
+}
+
+/*!
+ Returns the file to write the capture to - capFile_ itself unless the
+ capture is bounded
+*/
+QFile* PcapPort::PortCapturer::startSegments()
+{
+    segmentLock_.lock();
+    qDeleteAll(segments_);
+    segments_.clear();
+    discardedSize_ = 0;
+    if (!isBounded())
+    {
+        capFile_.resize(0);
+        capFile_.seek(0);
+    }
+    segmentLock_.unlock();
+
+    if (isBounded())
+        return nextSegment();
+
+    return &capFile_;
+}
+
+/*!
+ Returns a new segment file to continue the capture in and discards
+ the oldest segment if there are more than fileCount_
+*/
+QFile* PcapPort::PortCapturer::nextSegment()
+{
+    QTemporaryFile *segment = new QTemporaryFile();
+
+    if (!segment->open())
+    {
+        qWarning("Unable to open temp cap segment file");
+        delete segment;
+        return NULL;
+    }
+
+    QMutexLocker locker(&segmentLock_);
+
+    segments_.append(segment);
+    while (segments_.size() > fileCount_)
+    {
+        QTemporaryFile *oldest = segments_.takeFirst();
+
+        discardedSize_ += packetBytes(oldest);
+        delete oldest;
+    }
+
+    return segment;
+}
+
+/*!
+ Returns the captured packets - for a bounded capture this is the
+ retained segments concatenated into a single pcap file
+*/
 QFile* PcapPort::PortCapturer::captureFile()
 {
+    if (segments_.isEmpty())
+        return &capFile_;
+
+    capFile_.resize(0);
+    capFile_.seek(0);
+    for (int i = 0; i < segments_.size(); i++)
+    {
+        QTemporaryFile *segment = segments_.at(i);
+
+        // Every segment is a pcap file - keep only the first file header
+        if (!segment->seek(i ? kPcapFileHeaderSize : 0))
+            continue;
+
+        while (!segment->atEnd())
+        {
+            QByteArray chunk = segment->read(1024*1024);
+
+            if (chunk.isEmpty())
+                break;
+            capFile_.write(chunk);
+        }
+    }
+    capFile_.flush();
+
     return &capFile_;
 }
+
+/*!
+ Fills chunk with upto maxLength bytes of the capture starting at offset;
+ this can be called while the capture is on
+
+ A bounded capture is addressed as if all its segments (including the
+ discarded ones) were a single pcap file. A chunk doesn't span segments.
+ The data is mmap'ed rather than read so that it is copied only once -
+ into the reply
+*/
+bool PcapPort::PortCapturer::captureChunk(quint64 offset, int maxLength,
+        bool compress, OstProto::CaptureChunk *chunk)
+{
+    QMutexLocker locker(&segmentLock_);
+    QList<QFile*> files;
+    QFile *file = NULL;
+    QFile reader;
+    quint64 pos;
+    qint64 filePos = 0;
+    qint64 length = 0;
+    uchar *data;
+
+    if (segments_.isEmpty())
+        files.append(&capFile_);
+    else
+        foreach(QTemporaryFile *segment, segments_)
+            files.append(segment);
+
+    // The file header is the one of the first file; the packets follow
+    // with those in discarded segments skipped
+    pos = kPcapFileHeaderSize + discardedSize_;
+    if (offset < quint64(kPcapFileHeaderSize))
+    {
+        file = files.first();
+        filePos = offset;
+        length = kPcapFileHeaderSize - offset;
+    }
+    else if (offset < pos)
+        offset = pos;
+
+    for (int i = 0; i < files.size(); i++)
+    {
+        qint64 size = packetBytes(files.at(i));
+
+        if (!file && (offset < pos + size))
+        {
+            file = files.at(i);
+            filePos = kPcapFileHeaderSize + (offset - pos);
+            length = pos + size - offset;
+        }
+        pos += size;
+    }
+
+    if (QFileInfo(files.first()->fileName()).size() < kPcapFileHeaderSize)
+        pos = 0; // nothing captured yet, not even the file header
+
+    chunk->set_offset(offset);
+    chunk->set_total_size(pos);
+
+    length = qMin(length, qint64(maxLength));
+    if (!file || (length <= 0))
+        return true;
+
+    reader.setFileName(file->fileName());
+    if (!reader.open(QIODevice::ReadOnly))
+    {
+        qWarning("%s: unable to open capture file (%s)",
+                device_.toAscii().constData(),
+                reader.errorString().toAscii().constData());
+        return false;
+    }
+
+    data = reader.map(filePos, length);
+    if (!data)
+    {
+        qWarning("%s: unable to map capture file (%s)",
+                device_.toAscii().constData(),
+                reader.errorString().toAscii().constData());
+        return false;
+    }
+
+    if (compress)
+    {
+        QByteArray compressed = qCompress(data, length);
+
+        chunk->set_data(compressed.constData(), compressed.size());
+        chunk->set_is_compressed(true);
+    }
+    else
+        chunk->set_data((const char*) data, length);
+
+    reader.unmap(data);
+    return true;
+}
+
+// Returns the bytes of packets (i.e. excluding the file header) in file
+qint64 PcapPort::PortCapturer::packetBytes(const QFile *file)
+{
+    // Not file->size() which flushes file - it may be in use by the
+    // capture thread
+    return qMax(QFileInfo(file->fileName()).size() - kPcapFileHeaderSize,
+            qint64(0));
+}
@@ -20,8 +20,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>
 #ifndef _SERVER_PCAP_PORT_H
 #define _SERVER_PCAP_PORT_H
 
+#include <QMutex>
 #include <QTemporaryFile>
 #include <QThread>
+#include <QWaitCondition>
 #include <pcap.h>
 
 #include "abstractport.h"
@@ -37,6 +39,7 @@ public:
 
     virtual bool hasExclusiveControl() { return false; }
     virtual bool setExclusiveControl(bool /*exclusive*/) { return false; }
+    virtual bool setStreamStatsTracking(bool enable);
 
     virtual void clearPacketList() { 
         transmitter_->clearPacketList();
@@ -55,18 +58,41 @@ public:
     {
         transmitter_->setPacketListLoopMode(loop, secDelay, nsecDelay);
     }
+    virtual void finishPacketList() {
+        transmitter_->finishPacketList();
+    }
+    virtual bool isPacketListComplete() {
+        return transmitter_->isPacketListComplete();
+    }
+
+    virtual void setTransmitRateScale(double scale) {
+        transmitter_->setRateScale(scale);
+    }
 
     virtual void startTransmit() { 
-        Q_ASSERT(!isDirty());
         transmitter_->start(); 
     }
+    virtual void armTransmit(QSharedPointer<StartBarrier> barrier) {
+        transmitter_->start(barrier, id());
+    }
     virtual void stopTransmit()  { transmitter_->stop();  }
     virtual bool isTransmitOn() { return transmitter_->isRunning(); }
 
-    virtual void startCapture() { capturer_->start(); }
+    virtual void startCapture() {
+        capturer_->setLimits(quint64(data_.capture_max_size())*1024*1024,
+                quint64(data_.capture_max_duration())*1000000,
+                data_.capture_file_count());
+        capturer_->setFilter(QString::fromStdString(data_.capture_filter()),
+                data_.capture_snaplen());
+        capturer_->start();
+    }
     virtual void stopCapture()  { capturer_->stop(); }
     virtual bool isCaptureOn()  { return capturer_->isRunning(); }
     virtual QIODevice* captureData() { return capturer_->captureFile(); }
+    virtual bool captureChunk(quint64 offset, int maxLength, bool compress,
+            OstProto::CaptureChunk *chunk) {
+        return capturer_->captureChunk(offset, maxLength, compress, chunk);
+    }
 
 protected:
     enum Direction
@@ -79,7 +105,7 @@ protected:
     {
     public:
         PortMonitor(const char *device, Direction direction,
-                AbstractPort::PortStats *stats);
+                AbstractPort::StatsBlock *stats);
     ~PortMonitor();
         void run();
         void stop();
@@ -87,10 +113,28 @@ protected:
         Direction direction() { return direction_; }
         bool isDirectional() { return isDirectional_; }
         bool isPromiscuous() { return isPromisc_; }
+        // The Rx/Tx counters are updated for every packet, so either
+        // monitor can sample the rates of port
+        void setRatePort(AbstractPort *port) { ratePort_ = port; }
+        // Tx stats counted by the transmitter if not directional
+        void setExternalStats(const AbstractPort::StatsBlock *stats) {
+            externalStats_ = stats;
+        }
     protected:
-        AbstractPort::PortStats *stats_;
+        AbstractPort::StatsBlock *stats_;
+        const AbstractPort::StatsBlock *externalStats_;
         bool stop_;
     private:
+        static const int kRateSampleInterval = 100; // msec
+
+        // Only the packet length (from the pcap header) is needed, so
+        // have the kernel copy as little of each packet as possible
+        static const int kSnapLen = 1;
+
+        static void countPacket(uchar *user, const struct pcap_pkthdr *hdr,
+                const uchar *data);
+
+        AbstractPort *ratePort_;
         pcap_t *handle_;
         Direction direction_;
         bool isDirectional_;
@@ -105,18 +149,70 @@ protected:
         void clearPacketList();
         void loopNextPacketSet(qint64 size, qint64 repeats, 
             long repeatDelaySec, long repeatDelayNsec);
-        bool appendToPacketList(long sec, long usec, const uchar *packet, 
+        bool appendToPacketList(long sec, long nsec, const uchar *packet, 
             int length);
+        void finishPacketList();
+        bool isPacketListComplete();
         void setPacketListLoopMode(bool loop, quint64 secDelay, quint64 nsecDelay) {
             returnToQIdx_ = loop ? 0 : -1;
-            loopDelay_ = secDelay*long(1e6) + nsecDelay/1000;
+            loopDelay_ = secDelay*quint64(1e9) + nsecDelay;
+        }
+        // Keep only every count'th packet starting with the index'th one -
+        // used to split a packet list across multiple transmitters; the
+        // timing of the skipped packets is retained so that the combined
+        // rate of all the transmitters is that of the original list
+        void setPacketListShare(int index, int count) {
+            shareIndex_ = index;
+            shareCount_ = count;
+        }
+        // All gaps in the packet list are multiplied by this - can be
+        // changed while transmit is on; reset by clearPacketList()
+        void setRateScale(double scale) {
+            rateScale_ = scale;
+        }
+        // Absolute time (see nsecTimeStamp()) for the first packet; 0 means
+        // as soon as the transmitter is started
+        void setStartTime(quint64 nsecStartTime) {
+            startTime_ = nsecStartTime;
         }
         void setHandle(pcap_t *handle);
-        void useExternalStats(AbstractPort::PortStats *stats);
+        void useExternalStats(AbstractPort::StatsBlock *stats);
+        // Stamp stream stats signatures of frames before they are sent
+        void setStreamStats(StreamStats *streamStats) {
+            streamStats_ = streamStats;
+        }
         void run();
-        void start();
+        // Returns once the thread is running - the first packet is sent
+        // when the packet list has one and barrier (if any, joined as
+        // member) is released
+        void start(QSharedPointer<StartBarrier> barrier
+                        = QSharedPointer<StartBarrier>(), int member = 0);
         void stop();
         bool isRunning();
+
+        // Monotonic timestamp (nsec) used for pacing
+        static quint64 nsecTimeStamp();
+    protected:
+        // Per packet hooks used by sendQueueTransmit() - transmitPacket()
+        // may just queue the packet (packet data stays valid till the
+        // next flush), transmitFlush() is invoked whenever the queued
+        // packets must be on the wire (before any delay and at the end
+        // of a sendQueue); nsecDeadline is when the packet is due
+        virtual int transmitPacket(const uchar *packet, int length,
+                quint64 nsecDeadline);
+        virtual int transmitFlush() { return 0; }
+
+        // Gaps smaller than this (nsec) are not paced individually
+        quint64 minPacingDelay_;
+        // If non-zero, packets are handed over this much (nsec) before
+        // they are due - for a transmitPacket() that can schedule the
+        // packet itself (e.g. using a launch time)
+        quint64 launchTimeLead_;
+
+        AbstractPort::StatsBlock *stats_;
+        StreamStats *streamStats_;
+        pcap_t *handle_;
+        volatile bool stop_;
     private:
         enum State 
         {
@@ -125,18 +221,35 @@ protected:
             kFinished
         };
 
+        // Unit (in nsec) of the ts.tv_usec field of the pcap_pkthdr in our
+        // sendQueues - pcap_sendqueue_transmit() on Win32 needs usecs, we
+        // use nsecs everywhere else
+#ifdef Q_OS_WIN32
+        static const long kTsFractionNsec = 1000;
+#else
+        static const long kTsFractionNsec = 1;
+#endif
+        static qint64 nsecDiff(const struct timeval &start,
+                const struct timeval &end) {
+            return (end.tv_sec - start.tv_sec) * qint64(1e9)
+                    + (end.tv_usec - start.tv_usec) * kTsFractionNsec;
+        }
+
         class PacketSequence
         {
         public:
             PacketSequence() {
                 sendQueue_ = pcap_sendqueue_alloc(1*1024*1024);
                 lastPacket_ = NULL;
+                firstTs_.tv_sec = firstTs_.tv_usec = 0;
+                lastTs_ = firstTs_;
+                packetsSeen_ = 0;
                 packets_ = 0;
                 bytes_ = 0;
-                usecDuration_ = 0;
+                nsecDuration_ = 0;
                 repeatCount_ = 1;
                 repeatSize_ = 1;
-                usecDelay_ = 0;
+                nsecDelay_ = 0;
             }
             ~PacketSequence() {
                 pcap_sendqueue_destroy(sendQueue_);
@@ -147,15 +260,17 @@ protected:
                 else
                     return false;
             }
+            // Account for the time of a packet not in this sequence
+            void skipPacket(const struct pcap_pkthdr *pktHeader) {
+                if (packetsSeen_++)
+                    nsecDuration_ += nsecDiff(lastTs_, pktHeader->ts);
+                else
+                    firstTs_ = pktHeader->ts;
+                lastTs_ = pktHeader->ts;
+            }
             int appendPacket(const struct pcap_pkthdr *pktHeader, 
                     const uchar *pktData) {
-                if (lastPacket_) 
-                {
-                    usecDuration_ += (pktHeader->ts.tv_sec 
-                                        - lastPacket_->ts.tv_sec) * long(1e6);
-                    usecDuration_ += (pktHeader->ts.tv_usec 
-                                        - lastPacket_->ts.tv_usec);
-                }
+                skipPacket(pktHeader);
                 packets_++;
                 bytes_ += pktHeader->caplen;
                 lastPacket_ = (struct pcap_pkthdr *) 
@@ -164,48 +279,78 @@ protected:
             }
             pcap_send_queue *sendQueue_;
             struct pcap_pkthdr *lastPacket_;
+            struct timeval firstTs_; // first packet seen (sent or skipped)
+            struct timeval lastTs_; // last packet seen (sent or skipped)
+            long packetsSeen_;
             long packets_;
             long bytes_;
-            ulong usecDuration_;
+            quint64 nsecDuration_;
             int repeatCount_;
             int repeatSize_;
-            long usecDelay_;
+            quint64 nsecDelay_;
         };
 
-        void udelay(long usec);
-        int sendQueueTransmit(pcap_t *p, pcap_send_queue *queue, long &overHead,
+        // The packet list may be transmitted while it is still being built -
+        // a sequence can be transmitted once published by the builder and
+        // (unless the list loops) is released once transmitted
+        static const int kMaxPendingSequences = 16;
+        void publishPacketSequences(int count);
+        bool waitForPacketSequence(int index,
+                QList<PacketSequence*> &sequences);
+        void releasePacketSequences(int index, int count);
+
+        quint64 scaled(qint64 nsec) {
+            return (rateScale_ == 1.0) ? nsec : quint64(nsec * rateScale_);
+        }
+        void waitUntil(quint64 nsecDeadline);
+        int sendQueueTransmit(PacketSequence *seq, quint64 &nsecDeadline,
                     int sync);
 
         quint64 ticksFreq_;
         QList<PacketSequence*> packetSequenceList_;
+        QMutex listLock_;
+        QWaitCondition listChanged_;
+        int publishedCount_;
+        int releasedCount_;
+        volatile bool listComplete_;
         PacketSequence *currentPacketSequence_;
         int repeatSequenceStart_;
         quint64 repeatSize_;
         quint64 packetCount_;
 
+        int shareIndex_;
+        int shareCount_;
+        quint64 shareCounter_;
+        quint64 startTime_;
+        QSharedPointer<StartBarrier> startBarrier_;
+        int startMember_;
+        volatile double rateScale_;
+
         int returnToQIdx_;
         quint64 loopDelay_;
 
         bool usingInternalStats_;
-        AbstractPort::PortStats *stats_;
         bool usingInternalHandle_;
-        pcap_t *handle_;
-        volatile bool stop_;
         volatile State state_;
     };
 
     class PortCapturer: public QThread
     {
     public:
-        PortCapturer(const char *device);
+        PortCapturer(const char *device, AbstractPort::StatsBlock *stats);
         ~PortCapturer();
+        void setLimits(quint64 maxSize, quint64 usecMaxDuration, 
+                int fileCount);
+        void setFilter(const QString &filter, int snapLen);
         void run();
         void start();
         void stop();
         bool isRunning();
         QFile* captureFile();
+        bool captureChunk(quint64 offset, int maxLength, bool compress,
+                OstProto::CaptureChunk *chunk);
 
-    private:
+    protected:
         enum State 
         {
             kNotStarted,
@@ -213,23 +358,73 @@ protected:
             kFinished
         };
 
+        static const int kPcapFileHeaderSize = 24;
+
+        // A bounded capture is rotated over segment files of which only
+        // the last fileCount_ are retained
+        bool isBounded() { return maxSize_ || usecMaxDuration_; }
+        bool isSegmentFull(quint64 size, quint64 usecDuration);
+        QFile* startSegments();
+        QFile* nextSegment();
+
+        bool compileFilter(pcap_t *handle, struct bpf_program *program);
+        static qint64 packetBytes(const QFile *file);
+
         QString         device_;
+        AbstractPort::StatsBlock *stats_;
         volatile bool   stop_;
         QTemporaryFile  capFile_;
+        volatile State  state_;
+
+        quint64         maxSize_;
+        quint64         usecMaxDuration_;
+        int             fileCount_;
+        QList<QTemporaryFile*> segments_;
+        quint64         discardedSize_; // packet bytes in discarded segments
+        QMutex          segmentLock_;   // segments_ is read by captureChunk()
+
+        QString         filter_;
+        int             snapLen_;
+
+    private:
+        void updateKernelDrops(uint &lastDrops);
+
         pcap_t          *handle_;
         pcap_dumper_t   *dumpHandle_;
-        volatile State  state_;
+    };
+
+    // Matches received frames to streams using their signatures - needs
+    // whole frames, unlike the monitors, so is run only when asked for
+    class StreamStatsReceiver: public QThread
+    {
+    public:
+        StreamStatsReceiver(const char *device, StreamStats *streamStats);
+        void run();
+        void stop();
+    private:
+        static const int kSnapLen = 65535;
+        static const int kReadTimeout = 100; // msec
+
+        pcap_t* open(char *errbuf);
+        static void receivePacket(uchar *user, const struct pcap_pkthdr *hdr,
+                const uchar *data);
+
+        QString device_;
+        StreamStats *streamStats_;
+        pcap_t *handle_;
+        quint64 tsFractionNsec_; // unit of pcap_pkthdr.ts.tv_usec
+        volatile bool stop_;
     };
 
     PortMonitor     *monitorRx_;
     PortMonitor     *monitorTx_;
+    PortTransmitter *transmitter_;
+    PortCapturer    *capturer_;
+    StreamStatsReceiver *streamStatsReceiver_;
 
     void updateNotes();
 
 private:
-    PortTransmitter *transmitter_;
-    PortCapturer    *capturer_;
-
     static pcap_if_t *deviceList_;
 };
 
@@ -36,12 +36,18 @@ PortManager::PortManager()
     pcap_if_t *deviceList;
     pcap_if_t *device;
     char errbuf[PCAP_ERRBUF_SIZE];
+    QList<int> rateWindows;
 
     qDebug("Retrieving the device list from the local machine\n"); 
 
     if (pcap_findalldevs(&deviceList, errbuf) == -1)
         qDebug("Error in pcap_findalldevs_ex: %s\n", errbuf);
 
+    foreach(QString window, appSettings->value(kStatsRateWindowsKey,
+                "100,1000,10000").toString().split(',',
+                    QString::SkipEmptyParts))
+        rateWindows.append(window.trimmed().toInt());
+
     for(device = deviceList, i = 0; device != NULL; device = device->next, i++)
     {
         AbstractPort *port;
@@ -81,6 +87,7 @@ PortManager::PortManager()
             continue;
         }
 
+        port->setRateWindows(rateWindows);
         portList_.append(port);
     }
 
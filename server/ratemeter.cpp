@@ -0,0 +1,198 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "ratemeter.h"
+
+#include <QMutexLocker>
+
+#include <string.h>
+
+static const quint64 kNsecPerSec = 1000000000ULL;
+
+RateMeter::RateMeter()
+{
+    hasLast_ = false;
+    memset(last_, 0, sizeof(last_));
+    memset(total_, 0, sizeof(total_));
+    nsecHistory_ = kNsecPerSec;
+
+    timer_.start();
+}
+
+void RateMeter::setWindows(const QList<int> &msecWindows)
+{
+    QMutexLocker locker(&lock_);
+
+    windows_.clear();
+    nsecHistory_ = kNsecPerSec; // for perSecondRates()
+
+    foreach(int msec, msecWindows)
+    {
+        Window w;
+
+        if (msec <= 0)
+            continue;
+
+        memset(&w, 0, sizeof(w));
+        w.nsecWindow = msec*quint64(1000000);
+        windows_.append(w);
+
+        nsecHistory_ = qMax(nsecHistory_, w.nsecWindow);
+    }
+}
+
+/*!
+ Adds a sample of the (cumulative) port counters; maxValue is the value
+ after which the counters wrap around - 0 if not known, in which case
+ a counter going down is assumed to have been reset
+*/
+void RateMeter::addSample(const quint64 counter[kCounterCount],
+        quint64 maxValue)
+{
+    QMutexLocker locker(&lock_);
+    Sample sample;
+
+    sample.nsecTime = timer_.nsecsElapsed();
+    for (int i = 0; i < kCounterCount; i++)
+    {
+        if (hasLast_)
+        {
+            if (counter[i] >= last_[i])
+                total_[i] += counter[i] - last_[i];
+            else if (maxValue)
+                total_[i] += counter[i] + (maxValue - last_[i]);
+            else
+                total_[i] += counter[i];
+        }
+        last_[i] = counter[i];
+        sample.total[i] = total_[i];
+    }
+    hasLast_ = true;
+
+    // Retain the newest sample that is older than the longest window
+    // besides the ones in the window
+    samples_.append(sample);
+    while ((samples_.size() > 2) && ((sample.nsecTime
+                    - samples_.at(1).nsecTime) >= nsecHistory_))
+        samples_.removeFirst();
+
+    for (int i = 0; i < windows_.size(); i++)
+    {
+        Window &w = windows_[i];
+
+        if (!rateOver(w.nsecWindow, w.current))
+            continue;
+
+        for (int j = 0; j < kCounterCount; j++)
+        {
+            if (!w.count || (w.current[j] < w.min[j]))
+                w.min[j] = w.current[j];
+            if (!w.count || (w.current[j] > w.max[j]))
+                w.max[j] = w.current[j];
+            w.sum[j] += w.current[j];
+        }
+        w.count++;
+    }
+}
+
+/*!
+ Returns the rates over the last second - false if there aren't samples
+ for a second yet
+*/
+bool RateMeter::perSecondRates(quint64 rate[kCounterCount])
+{
+    QMutexLocker locker(&lock_);
+
+    return rateOver(kNsecPerSec, rate);
+}
+
+QList<RateMeter::WindowRates> RateMeter::windowRates()
+{
+    QMutexLocker locker(&lock_);
+    QList<WindowRates> list;
+
+    // Not sampled by this port's stats monitor
+    if (samples_.isEmpty())
+        return list;
+
+    foreach(const Window &w, windows_)
+    {
+        WindowRates rates;
+
+        rates.msecWindow = w.nsecWindow/1000000;
+        for (int i = 0; i < kCounterCount; i++)
+        {
+            rates.rate[i].current = w.current[i];
+            rates.rate[i].min = w.min[i];
+            rates.rate[i].max = w.max[i];
+            rates.rate[i].avg = w.count ? quint64(w.sum[i]/w.count) : 0;
+        }
+        list.append(rates);
+    }
+
+    return list;
+}
+
+/*!
+ Restarts the min/max/avg - the current rates are not affected
+*/
+void RateMeter::reset()
+{
+    QMutexLocker locker(&lock_);
+
+    for (int i = 0; i < windows_.size(); i++)
+    {
+        Window &w = windows_[i];
+
+        memset(w.min, 0, sizeof(w.min));
+        memset(w.max, 0, sizeof(w.max));
+        memset(w.sum, 0, sizeof(w.sum));
+        w.count = 0;
+    }
+}
+
+// Rate between the newest sample and the newest one that is at least
+// nsecWindow older; to be called with lock_ held
+bool RateMeter::rateOver(quint64 nsecWindow, quint64 rate[kCounterCount])
+{
+    const Sample *newest, *oldest = NULL;
+    quint64 nsecDelta;
+
+    if (samples_.isEmpty())
+        return false;
+
+    newest = &samples_.last();
+    for (int i = samples_.size() - 2; i >= 0; i--)
+    {
+        if ((newest->nsecTime - samples_.at(i).nsecTime) >= nsecWindow)
+        {
+            oldest = &samples_.at(i);
+            break;
+        }
+    }
+    if (!oldest)
+        return false;
+
+    nsecDelta = newest->nsecTime - oldest->nsecTime;
+    for (int i = 0; i < kCounterCount; i++)
+        rate[i] = quint64((newest->total[i] - oldest->total[i])
+                            * double(kNsecPerSec) / nsecDelta);
+
+    return true;
+}
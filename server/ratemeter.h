@@ -0,0 +1,100 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_RATE_METER_H
+#define _SERVER_RATE_METER_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QtGlobal>
+
+/*
+ Computes rx/tx packet and byte rates over sliding windows from
+ timestamped samples of the port counters - the windows can be shorter
+ than a second, so the counters need to be sampled (at least) as often
+ as the shortest window
+*/
+class RateMeter
+{
+public:
+    enum Counter
+    {
+        kRxPkts,
+        kRxBytes,
+        kTxPkts,
+        kTxBytes,
+        kCounterCount
+    };
+
+    struct Rate
+    {
+        quint64 current;    // over the last window
+        quint64 min;        // min, max and avg are of the current
+        quint64 max;        // rate as of every sample since reset()
+        quint64 avg;
+    };
+
+    struct WindowRates
+    {
+        int msecWindow;
+        Rate rate[kCounterCount];
+    };
+
+    RateMeter();
+
+    void setWindows(const QList<int> &msecWindows);
+
+    void addSample(const quint64 counter[kCounterCount], quint64 maxValue);
+    bool perSecondRates(quint64 rate[kCounterCount]);
+    QList<WindowRates> windowRates();
+    void reset();
+
+private:
+    struct Sample
+    {
+        quint64 nsecTime;
+        quint64 total[kCounterCount];
+    };
+
+    struct Window
+    {
+        quint64 nsecWindow;
+        quint64 current[kCounterCount];
+        quint64 min[kCounterCount];
+        quint64 max[kCounterCount];
+        double sum[kCounterCount];
+        quint64 count;
+    };
+
+    bool rateOver(quint64 nsecWindow, quint64 rate[kCounterCount]);
+
+    QMutex lock_;
+    QElapsedTimer timer_;
+
+    bool hasLast_;
+    quint64 last_[kCounterCount];   // counter values as of the last sample
+    quint64 total_[kCounterCount];  // .. and increments since the first
+
+    QList<Sample> samples_;         // oldest first
+    quint64 nsecHistory_;           // span of samples_ to retain
+    QList<Window> windows_;
+};
+
+#endif
@@ -31,4 +31,29 @@ extern QSettings *appSettings;
 const QString kPortListIncludeKey("PortList/Include");
 const QString kPortListExcludeKey("PortList/Exclude");
 
+//
+// Stats Section Keys
+//
+// RateWindows - comma separated list of windows (in msec) over which
+// rx/tx rates are computed (default 100,1000,10000)
+const QString kStatsRateWindowsKey("Stats/RateWindows");
+// PollInterval - msec between reads of the port counters (default 100,
+// minimum 50); Linux only
+const QString kStatsPollIntervalKey("Stats/PollInterval");
+
+//
+// Tx Section Keys (Linux only)
+//
+// Method - one of auto (default), ring, mmsg, pcap
+const QString kTxMethodKey("Tx/Method");
+const QString kTxQdiscBypassKey("Tx/QdiscBypass");
+// Workers - number of transmit threads per port (default 1)
+const QString kTxWorkersKey("Tx/Workers");
+// LaunchTime - hand packets to the kernel ahead of time with a SO_TXTIME
+// launch time instead of pacing in software; needs an etf (or fq) qdisc on
+// the port and is ignored with QdiscBypass
+const QString kTxLaunchTimeKey("Tx/LaunchTime");
+// WorkerCpus - comma separated list of cpus to pin the workers to
+const QString kTxWorkerCpusKey("Tx/WorkerCpus");
+
 #endif
@@ -0,0 +1,132 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "startbarrier.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+StartBarrier::StartBarrier()
+{
+    joined_ = 0;
+    arrived_ = 0;
+    released_ = false;
+    startTime_ = 0;
+}
+
+void StartBarrier::join(int member)
+{
+    QMutexLocker locker(&lock_);
+
+    members_[member].joined++;
+    joined_++;
+}
+
+/*!
+ Waits till all the joined transmitters have arrived (or withdrawn) -
+ returns false if some of them haven't by msecTimeout
+*/
+bool StartBarrier::waitForAll(int msecTimeout)
+{
+    QMutexLocker locker(&lock_);
+    QElapsedTimer timer;
+
+    // Every arrival wakes us - wait only for what is left of the timeout
+    timer.start();
+    while ((arrived_ < joined_) && (timer.elapsed() < msecTimeout))
+        changed_.wait(&lock_, msecTimeout - timer.elapsed());
+
+    return (arrived_ >= joined_);
+}
+
+void StartBarrier::release()
+{
+    QMutexLocker locker(&lock_);
+
+    released_ = true;
+    changed_.wakeAll();
+}
+
+/*!
+ Returns the outcome for member so far - and the reason it withdrew, if so
+*/
+StartBarrier::MemberState StartBarrier::memberState(int member,
+        QString *reason)
+{
+    QMutexLocker locker(&lock_);
+    Member m = members_.value(member);
+
+    if (!m.reason.isEmpty()) {
+        if (reason)
+            *reason = m.reason;
+        return kWithdrawn;
+    }
+
+    if (!m.joined)
+        return kNotJoined;
+
+    return (m.arrived >= m.joined) ? kArrived : kJoined;
+}
+
+void StartBarrier::arrive(int member)
+{
+    QMutexLocker locker(&lock_);
+
+    members_[member].arrived++;
+    arrived_++;
+    changed_.wakeAll();
+}
+
+void StartBarrier::withdraw(int member, const QString &reason)
+{
+    QMutexLocker locker(&lock_);
+
+    members_[member].joined--;
+    members_[member].reason = reason;
+    joined_--;
+    changed_.wakeAll();
+}
+
+bool StartBarrier::waitForRelease(int msecTimeout)
+{
+    QMutexLocker locker(&lock_);
+    QElapsedTimer timer;
+
+    // Arrivals wake us too - wait only for what is left of the timeout
+    timer.start();
+    while (!released_ && (timer.elapsed() < msecTimeout))
+        changed_.wait(&lock_, msecTimeout - timer.elapsed());
+
+    return released_;
+}
+
+/*!
+ Returns the common start time - or nsecNow for a transmitter that
+ arrived after the start time has gone by
+*/
+quint64 StartBarrier::startTime(quint64 nsecNow)
+{
+    QMutexLocker locker(&lock_);
+
+    Q_ASSERT(released_);
+    if (!startTime_)
+        startTime_ = nsecNow + kNsecStartLead;
+
+    return qMax(startTime_, nsecNow);
+}
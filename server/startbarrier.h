@@ -0,0 +1,90 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_START_BARRIER_H
+#define _SERVER_START_BARRIER_H
+
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <QtGlobal>
+
+/*
+ Holds back the first packet of a set of transmitters (of one or more
+ ports) till all of them are ready to send it, so that they start
+ together. Shared (using a QSharedPointer) by the thread starting the
+ transmitters and the transmitter threads.
+
+ Starting thread: join() for each transmitter started, waitForAll() and
+ then release(). Transmitter thread: arrive() once its first packet is
+ ready and waitForRelease() till released - or withdraw() with the reason
+ if it can't start.
+
+ Transmitters join as a member (the port id) so that the starting thread
+ can tell the outcome for each port from memberState() - a member with
+ more than one transmitter has withdrawn if any of them has.
+
+ The start time is fixed by the first transmitter to see the release - it
+ is kNsecStartLead ahead, in the clock of the transmitter, to allow all of
+ the others to wake up by then
+*/
+class StartBarrier
+{
+public:
+    static const quint64 kNsecStartLead = 2000000;
+
+    enum MemberState {
+        kNotJoined,
+        kJoined,     // not all of its transmitters have arrived yet
+        kArrived,
+        kWithdrawn
+    };
+
+    StartBarrier();
+
+    void join(int member);
+    bool waitForAll(int msecTimeout);
+    void release();
+    MemberState memberState(int member, QString *reason = NULL);
+
+    void arrive(int member);
+    void withdraw(int member, const QString &reason);
+    bool waitForRelease(int msecTimeout);
+    quint64 startTime(quint64 nsecNow);
+
+private:
+    struct Member
+    {
+        Member() : joined(0), arrived(0) {}
+        int joined;
+        int arrived;
+        QString reason; // of the last withdrawal, if any
+    };
+
+    QMutex lock_;
+    QWaitCondition changed_;
+    QHash<int, Member> members_;
+    int joined_;
+    int arrived_;
+    bool released_;
+    quint64 startTime_;
+};
+
+#endif
@@ -0,0 +1,186 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "statspublisher.h"
+
+#include "myservice.h"
+
+#include <QTimer>
+
+StatsPublisher::StatsPublisher(MyService *service, int methodId,
+        int msecInterval)
+{
+    service_ = service;
+    methodId_ = methodId;
+
+    timer_ = new QTimer(this);
+    timer_->setInterval(msecInterval);
+    connect(timer_, SIGNAL(timeout()), this, SLOT(publish()));
+}
+
+void StatsPublisher::addSubscriber(QObject *connection)
+{
+    connect(this, SIGNAL(update(int, QByteArray)),
+            connection, SLOT(sendNotification(int, QByteArray)),
+            Qt::UniqueConnection);
+
+    // A dropped update leaves the subscriber with stale counters
+    connect(connection, SIGNAL(notificationDropped(int)),
+            this, SLOT(resendAll(int)), Qt::UniqueConnection);
+
+    // The new subscriber needs all the stats to apply later updates to
+    sendAll_.fetchAndStoreOrdered(1);
+
+    // The timer can be started only from our own thread
+    QMetaObject::invokeMethod(this, "start", Qt::QueuedConnection);
+}
+
+void StatsPublisher::removeSubscriber(QObject *connection)
+{
+    disconnect(this, SIGNAL(update(int, QByteArray)), connection, 0);
+    disconnect(connection, SIGNAL(notificationDropped(int)), this, 0);
+}
+
+void StatsPublisher::resendAll(int methodId)
+{
+    if (methodId == methodId_)
+        sendAll_.fetchAndStoreOrdered(1);
+}
+
+void StatsPublisher::start()
+{
+    if (!timer_->isActive())
+        timer_->start();
+}
+
+void StatsPublisher::publish()
+{
+    OstProto::PortStatsList current;
+    OstProto::PortStatsList delta;
+    OstProto::PortStatsList *list = &current;
+    std::string msg;
+
+    if (!receivers(SIGNAL(update(int, QByteArray))))
+    {
+        qDebug("no stats subscribers at %d msec; stopping", 
+                timer_->interval());
+        timer_->stop();
+        last_.Clear();
+        return;
+    }
+
+    // We run in the main thread, so we mustn't wait for a port locked for
+    // a change (e.g. by a RPC waiting for its packet list to be built) -
+    // such a port is carried over unchanged to the next update, or if we
+    // don't have its stats yet, the whole update is
+    for (int i = 0; i < service_->portCount(); i++)
+    {
+        OstProto::PortStats *stats = current.add_port_stats();
+
+        if (service_->portStats(i, stats, true))
+            continue;
+
+        if (i >= last_.port_stats_size())
+            return;
+        stats->CopyFrom(last_.port_stats(i));
+    }
+
+    if (!sendAll_.fetchAndStoreOrdered(0)
+            && (last_.port_stats_size() == current.port_stats_size()))
+    {
+        for (int i = 0; i < current.port_stats_size(); i++)
+        {
+            OstProto::PortStats *d = delta.add_port_stats();
+
+            if (!diffPortStats(last_.port_stats(i), current.port_stats(i), d))
+                delta.mutable_port_stats()->RemoveLast();
+        }
+        list = &delta;
+    }
+
+    last_.Swap(&current);
+
+    if (list->port_stats_size() == 0)
+        return;
+
+    list->SerializeToString(&msg);
+    emit update(methodId_, QByteArray(msg.data(), msg.size()));
+}
+
+#define COPY_IF_CHANGED(field) \
+    if (current.field() != last.field()) { \
+        delta->set_##field(current.field()); \
+        changed = true; \
+    }
+
+/*!
+ Fills in delta with the port id and the fields of current that are
+ different in last - returns false if there are no such fields
+*/
+bool StatsPublisher::diffPortStats(const OstProto::PortStats &last,
+        const OstProto::PortStats &current, OstProto::PortStats *delta)
+{
+    bool changed = false;
+
+    delta->mutable_port_id()->CopyFrom(current.port_id());
+
+    if (current.state().SerializeAsString() 
+            != last.state().SerializeAsString())
+    {
+        delta->mutable_state()->CopyFrom(current.state());
+        changed = true;
+    }
+
+    COPY_IF_CHANGED(rx_pkts);
+    COPY_IF_CHANGED(rx_bytes);
+    COPY_IF_CHANGED(rx_pps);
+    COPY_IF_CHANGED(rx_bps);
+
+    COPY_IF_CHANGED(tx_pkts);
+    COPY_IF_CHANGED(tx_bytes);
+    COPY_IF_CHANGED(tx_pps);
+    COPY_IF_CHANGED(tx_bps);
+
+    COPY_IF_CHANGED(rx_drops);
+    COPY_IF_CHANGED(rx_errors);
+    COPY_IF_CHANGED(rx_fifo_errors);
+    COPY_IF_CHANGED(rx_frame_errors);
+    COPY_IF_CHANGED(tx_drops);
+    COPY_IF_CHANGED(tx_errors);
+
+    COPY_IF_CHANGED(cap_kernel_drops);
+    COPY_IF_CHANGED(cap_ring_drops);
+
+    // Window rates are sent as a whole, if any of them changed
+    for (int i = 0; i < current.window_rates_size(); i++)
+    {
+        if ((i >= last.window_rates_size())
+                || (current.window_rates(i).SerializeAsString()
+                    != last.window_rates(i).SerializeAsString()))
+        {
+            delta->mutable_window_rates()->CopyFrom(current.window_rates());
+            changed = true;
+            break;
+        }
+    }
+
+    return changed;
+}
+
+#undef COPY_IF_CHANGED
@@ -0,0 +1,72 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_STATS_PUBLISHER_H
+#define _SERVER_STATS_PUBLISHER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QObject>
+
+#include "../common/protocol.pb.h"
+
+class MyService;
+class QTimer;
+
+/*
+ Pushes the stats of all ports every interval to the connections that
+ subscribed at that interval. Each update is encoded once and the same
+ bytes are sent to all subscribers.
+
+ An update has only the ports and counters that changed since the previous
+ update - except the first one after a new subscription, which has all of
+ them (and is sent to all subscribers)
+*/
+class StatsPublisher : public QObject
+{
+    Q_OBJECT
+public:
+    StatsPublisher(MyService *service, int methodId, int msecInterval);
+
+    // Thread safe - connection must have a sendNotification(int, QByteArray)
+    // slot and a notificationDropped(int) signal; it is unsubscribed
+    // automatically when it is destroyed
+    void addSubscriber(QObject *connection);
+    void removeSubscriber(QObject *connection);
+
+signals:
+    void update(int methodId, QByteArray msg);
+
+private slots:
+    void start();
+    void publish();
+    void resendAll(int methodId);
+
+private:
+    static bool diffPortStats(const OstProto::PortStats &last,
+            const OstProto::PortStats &current, OstProto::PortStats *delta);
+
+    MyService *service_;
+    int methodId_;
+    QTimer *timer_;
+    QAtomicInt sendAll_;
+    OstProto::PortStatsList last_;
+};
+
+#endif
@@ -0,0 +1,334 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#include "streamstats.h"
+
+#include "../common/streambase.h"
+
+#include <QMutexLocker>
+#include <QtEndian>
+
+#ifdef Q_OS_WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+#include <string.h>
+
+/*!
+ Returns the (folded) one's complement sum of the big endian 16-bit
+ words of data - length must be even
+*/
+static quint16 cksumSum(const uchar *data, int length, quint32 sum = 0)
+{
+    for (int i = 0; i < length; i += 2)
+        sum += (data[i] << 8) | data[i+1];
+
+    while (sum >> 16)
+        sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return quint16(sum);
+}
+
+StreamStats::StreamStats()
+{
+    isRxHwTimestamp_ = false;
+}
+
+StreamStats::~StreamStats()
+{
+    qDeleteAll(txStreams_);
+    qDeleteAll(rxStreams_);
+}
+
+/*!
+ Writes the static part of the signature at the end of the frame - the
+ frame is left as is if it is too short to have a signature
+*/
+void StreamStats::writeSignature(uchar *frame, int length,
+        uint portId, uint streamId)
+{
+    uchar *sign = frame + length - kStreamSignatureSize;
+    quint16 payloadSum;
+
+    if (length < kStreamSignatureSize)
+        return;
+
+    payloadSum = cksumSum(sign, kStreamSignatureSize);
+
+    qToBigEndian(kMagic, sign + kMagicOffset);
+    qToBigEndian(quint32(portId), sign + kPortIdOffset);
+    qToBigEndian(quint32(streamId), sign + kStreamIdOffset);
+    memset(sign + kSeqOffset, 0, kStreamSignatureSize - kSeqOffset);
+
+    // adjust = payloadSum - signatureSum (one's complement arithmetic)
+    qToBigEndian(cksumSum(sign, 0,
+                payloadSum + quint16(~cksumSum(sign, kStreamSignatureSize))),
+            sign + kCksumAdjustOffset);
+}
+
+quint64 StreamStats::nsecWallClock()
+{
+#ifdef Q_OS_WIN32
+    // 100ns units since 1 Jan 1601
+    const quint64 kEpochOffset = 116444736000000000ULL;
+    FILETIME now;
+
+    GetSystemTimeAsFileTime(&now);
+
+    return ((quint64(now.dwHighDateTime) << 32 | now.dwLowDateTime)
+                - kEpochOffset)*100;
+#elif defined(CLOCK_REALTIME)
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return now.tv_sec*quint64(1e9) + now.tv_nsec;
+#else
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec*quint64(1e9) + now.tv_usec*quint64(1e3);
+#endif
+}
+
+/*!
+ Sets the streams whose frames will be stamped - stats of streams not in
+ the list are dropped, those of streams already being tracked are retained
+*/
+void StreamStats::setTxStreams(const QList<uint> &streamIds)
+{
+    QHash<uint, TxStream*> txStreams;
+
+    foreach(uint id, streamIds)
+    {
+        TxStream *tx = txStreams_.take(id);
+
+        if (!tx)
+        {
+            tx = new TxStream;
+            memset(tx, 0, sizeof(*tx));
+        }
+        txStreams.insert(id, tx);
+    }
+
+    qDeleteAll(txStreams_);
+    txStreams_ = txStreams;
+}
+
+/*!
+ Fills in the sequence number and tx time of the signature of a frame
+ about to be sent and counts it - the tx time is the current wall clock
+ time unless the caller knows when the frame will actually be sent
+ (nsecTxTime, also wall clock)
+*/
+void StreamStats::stamp(uchar *frame, int length, quint64 nsecTxTime)
+{
+    uchar *sign = frame + length - kStreamSignatureSize;
+    TxStream *tx;
+    quint32 adjust;
+
+    if ((length < kStreamSignatureSize)
+            || (qFromBigEndian<quint32>(sign + kMagicOffset) != kMagic))
+        return;
+
+    tx = txStreams_.value(qFromBigEndian<quint32>(sign + kStreamIdOffset));
+    if (!tx)
+        return;
+
+    // Incremental update of the checksum adjust field (RFC 1624) so that
+    // the sum of the signature is unchanged: adjust' = adjust + old - new
+    adjust = qFromBigEndian<quint16>(sign + kCksumAdjustOffset);
+    adjust = cksumSum(sign + kSeqOffset, kCksumAdjustOffset - kSeqOffset,
+            adjust);
+
+    qToBigEndian(__atomic_fetch_add(&tx->nextSeq, 1, __ATOMIC_RELAXED),
+            sign + kSeqOffset);
+    qToBigEndian(nsecTxTime ? nsecTxTime : nsecWallClock(),
+            sign + kTxTimeOffset);
+
+    adjust += quint16(~cksumSum(sign + kSeqOffset,
+                kCksumAdjustOffset - kSeqOffset));
+    qToBigEndian(cksumSum(sign, 0, adjust), sign + kCksumAdjustOffset);
+
+    __atomic_fetch_add(&tx->pkts, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&tx->bytes, quint64(length), __ATOMIC_RELAXED);
+}
+
+void StreamStats::receive(const uchar *frame, int length, quint64 nsecRxTime)
+{
+    const uchar *sign = frame + length - kStreamSignatureSize;
+    quint64 key;
+    quint32 seq;
+    quint64 txTime;
+    quint64 latency = 0;
+    bool hasLatency;
+    RxStream *rx;
+
+    if ((length < kStreamSignatureSize)
+            || (qFromBigEndian<quint32>(sign + kMagicOffset) != kMagic))
+        return;
+
+    key = quint64(qFromBigEndian<quint32>(sign + kPortIdOffset)) << 32
+            | qFromBigEndian<quint32>(sign + kStreamIdOffset);
+    seq = qFromBigEndian<quint32>(sign + kSeqOffset);
+    txTime = qFromBigEndian<quint64>(sign + kTxTimeOffset);
+
+    // A tx time ahead of the rx time means the clocks are not in sync
+    hasLatency = txTime && (nsecRxTime >= txTime);
+    if (hasLatency)
+        latency = nsecRxTime - txTime;
+
+    QMutexLocker locker(&rxLock_);
+
+    rx = rxStreams_.value(key);
+    if (!rx)
+    {
+        rx = new RxStream();
+        rx->nextSeq = seq;
+        rxStreams_.insert(key, rx);
+    }
+    else
+    {
+        qint32 delta = qint32(seq - rx->nextSeq);
+
+        if (delta >= 0)
+        {
+            rx->lost += delta;
+            rx->seenMask = (delta < 63) ? rx->seenMask << (delta + 1) : 0;
+        }
+        else
+        {
+            int age = -delta - 1;
+            quint64 bit = (age < 64) ? (quint64(1) << age) : 0;
+
+            if (rx->seenMask & bit)
+                rx->duplicates++;
+            else
+            {
+                // Counted as lost when the later frames were received
+                rx->outOfOrder++;
+                if (rx->lost)
+                    rx->lost--;
+                rx->seenMask |= bit;
+            }
+        }
+    }
+
+    // In sequence (including the first frame)
+    if (seq == rx->nextSeq)
+    {
+        if (hasLatency && rx->hasLastLatency)
+            rx->jitter.add(latency > rx->lastLatency ?
+                    latency - rx->lastLatency : rx->lastLatency - latency);
+        rx->hasLastLatency = hasLatency;
+        rx->lastLatency = latency;
+
+        rx->seenMask |= 1;
+        rx->nextSeq = seq + 1;
+    }
+    else if (qint32(seq - rx->nextSeq) > 0)
+    {
+        // Frames in between are missing - no jitter sample
+        rx->hasLastLatency = hasLatency;
+        rx->lastLatency = latency;
+
+        rx->seenMask |= 1;
+        rx->nextSeq = seq + 1;
+    }
+
+    rx->pkts++;
+    rx->bytes += length;
+
+    if (hasLatency)
+    {
+        if (!rx->latency.count() || (latency < rx->latencyMin))
+            rx->latencyMin = latency;
+        if (latency > rx->latencyMax)
+            rx->latencyMax = latency;
+        rx->latencySum += latency;
+        rx->latency.add(latency);
+    }
+}
+
+void StreamStats::protoDataCopyInto(uint portId,
+        OstProto::StreamStatsList *list)
+{
+    QHash<uint, TxStream*>::const_iterator t;
+    QHash<quint64, RxStream*>::const_iterator r;
+
+    for (t = txStreams_.constBegin(); t != txStreams_.constEnd(); t++)
+    {
+        OstProto::StreamStats *s = list->add_stream_stats();
+
+        s->mutable_port_id()->set_id(portId);
+        s->mutable_tx_port_id()->set_id(portId);
+        s->mutable_stream_id()->set_id(t.key());
+
+        s->set_tx_pkts(__atomic_load_n(&t.value()->pkts, __ATOMIC_RELAXED));
+        s->set_tx_bytes(__atomic_load_n(&t.value()->bytes, __ATOMIC_RELAXED));
+    }
+
+    QMutexLocker locker(&rxLock_);
+
+    for (r = rxStreams_.constBegin(); r != rxStreams_.constEnd(); r++)
+    {
+        OstProto::StreamStats *s = list->add_stream_stats();
+        const RxStream &rx = *r.value();
+
+        s->mutable_port_id()->set_id(portId);
+        s->mutable_tx_port_id()->set_id(quint32(r.key() >> 32));
+        s->mutable_stream_id()->set_id(quint32(r.key()));
+
+        s->set_rx_pkts(rx.pkts);
+        s->set_rx_bytes(rx.bytes);
+        s->set_rx_lost(rx.lost);
+        s->set_rx_out_of_order(rx.outOfOrder);
+        s->set_rx_duplicates(rx.duplicates);
+
+        if (rx.latency.count())
+        {
+            s->set_latency_min(rx.latencyMin);
+            s->set_latency_max(rx.latencyMax);
+            s->set_latency_avg(rx.latencySum/rx.latency.count());
+            rx.latency.protoDataCopyInto(s->mutable_latency_histogram());
+        }
+        if (rx.jitter.count())
+            rx.jitter.protoDataCopyInto(s->mutable_jitter_histogram());
+        s->set_is_rx_hw_timestamp(isRxHwTimestamp_);
+    }
+}
+
+void StreamStats::clear()
+{
+    foreach(TxStream *tx, txStreams_)
+    {
+        __atomic_store_n(&tx->pkts, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&tx->bytes, 0, __ATOMIC_RELAXED);
+    }
+
+    QMutexLocker locker(&rxLock_);
+
+    // The next frame of each stream restarts its sequence tracking
+    qDeleteAll(rxStreams_);
+    rxStreams_.clear();
+}
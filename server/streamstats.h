@@ -0,0 +1,120 @@
+/*
+Copyright (C) 2010 Srivats P.
+
+This file is part of "Ostinato"
+
+This is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>
+*/
+
+#ifndef _SERVER_STREAM_STATS_H
+#define _SERVER_STREAM_STATS_H
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QtGlobal>
+
+#include "latencyhistogram.h"
+#include "../common/protocol.pb.h"
+
+/*
+ Per stream stats of a port for streams with stats tracking enabled
+
+ Each frame of such a stream ends (before the FCS) with a signature of
+ kStreamSignatureSize bytes, all fields in network byte order -
+
+    magic(4) tx port id(4) stream id(4) sequence number(4) tx time(8)
+    checksum adjust(2)
+
+ The magic and ids are written when the packet list is built and the
+ sequence number and tx time (nsec since the epoch) by the transmitter
+ just before the frame is sent. The receiver looks up the stream of a
+ frame from the ids in a hash table - the frame is not parsed.
+
+ The checksum adjust field is set such that the one's complement sum
+ of the signature equals that of the payload bytes it replaces - so any
+ protocol checksum that covers the payload (e.g. TCP/UDP/ICMP) stays
+ valid without having to locate and update it. The receiver ignores it.
+*/
+class StreamStats
+{
+public:
+    static const quint32 kMagic = 0x4f535453; // "OSTS"
+
+    StreamStats();
+    ~StreamStats();
+
+    static void writeSignature(uchar *frame, int length,
+            uint portId, uint streamId);
+    static quint64 nsecWallClock();
+
+    // Tx side: setTxStreams() must not be called while transmit is on;
+    // stamp() may be called by multiple transmitter threads
+    void setTxStreams(const QList<uint> &streamIds);
+    bool isTxTracking() { return !txStreams_.isEmpty(); }
+    void stamp(uchar *frame, int length, quint64 nsecTxTime = 0);
+
+    // Rx side: frames without a signature are ignored
+    void setRxHwTimestamp(bool isHwTimestamp) {
+        isRxHwTimestamp_ = isHwTimestamp;
+    }
+    void receive(const uchar *frame, int length, quint64 nsecRxTime);
+
+    void protoDataCopyInto(uint portId, OstProto::StreamStatsList *list);
+    void clear();
+
+private:
+    struct TxStream
+    {
+        quint32 nextSeq; // not reset by clear() so that rx doesn't see a gap
+        quint64 pkts;
+        quint64 bytes;
+    };
+
+    struct RxStream
+    {
+        quint64 pkts;
+        quint64 bytes;
+
+        quint32 nextSeq;
+        quint64 seenMask; // bit i set if nextSeq-1-i was received
+        quint64 lost;
+        quint64 outOfOrder;
+        quint64 duplicates;
+
+        quint64 latencyMin;
+        quint64 latencyMax;
+        quint64 latencySum;
+        LatencyHistogram latency;
+
+        bool hasLastLatency;
+        quint64 lastLatency;
+        LatencyHistogram jitter;
+    };
+
+    static const int kMagicOffset = 0;
+    static const int kPortIdOffset = 4;
+    static const int kStreamIdOffset = 8;
+    static const int kSeqOffset = 12;
+    static const int kTxTimeOffset = 16;
+    static const int kCksumAdjustOffset = 24;
+
+    QHash<uint, TxStream*> txStreams_;
+
+    QMutex rxLock_;
+    QHash<quint64, RxStream*> rxStreams_; // key: (tx port id, stream id)
+    bool isRxHwTimestamp_;
+};
+
+#endif
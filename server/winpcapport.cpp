@@ -37,8 +37,8 @@ WinPcapPort::WinPcapPort(int id, const char *device)
     delete monitorRx_;
     delete monitorTx_;
 
-    monitorRx_ = new PortMonitor(device, kDirectionRx, &stats_);
-    monitorTx_ = new PortMonitor(device, kDirectionTx, &stats_);
+    monitorRx_ = new PortMonitor(device, kDirectionRx, newStatsBlock());
+    monitorTx_ = new PortMonitor(device, kDirectionTx, newStatsBlock());
 
     adapter_ = PacketOpenAdapter((CHAR*)device);
     if (!adapter_)
@@ -127,7 +127,7 @@ bool WinPcapPort::setExclusiveControl(bool exclusive)
 }
 
 WinPcapPort::PortMonitor::PortMonitor(const char *device, Direction direction,
-    AbstractPort::PortStats *stats)
+    AbstractPort::StatsBlock *stats)
     : PcapPort::PortMonitor(device, direction, stats)
 {
     if (handle())
@@ -164,36 +164,41 @@ void WinPcapPort::PortMonitor::run()
 
                 uint usec = (hdr->ts.tv_sec - lastTs.tv_sec) * 1000000 + 
                     (hdr->ts.tv_usec - lastTs.tv_usec);
+                AbstractPort::PortStats *stats;
 
                 switch (direction())
                 {
                 case kDirectionRx:
-                    stats_->rxPkts += pkts;
-                    stats_->rxBytes += bytes;
-                    stats_->rxPps = (pkts  * 1000000) / usec;
-                    stats_->rxBps = (bytes * 1000000) / usec;
+                    stats = stats_->beginUpdate();
+                    stats->rxPkts += pkts;
+                    stats->rxBytes += bytes;
+                    stats->rxPps = (pkts  * 1000000) / usec;
+                    stats->rxBps = (bytes * 1000000) / usec;
+                    stats_->endUpdate();
                     break;
 
                 case kDirectionTx:
-                    if (isDirectional())
-                    {
-                        stats_->txPkts += pkts;
-                        stats_->txBytes += bytes;
-                    }
-                    else
+                    if (!isDirectional() && externalStats_)
                     {
-                        // Assuming stats_->txXXX are updated externally
-                        quint64 txPkts = stats_->txPkts;
-                        quint64 txBytes = stats_->txBytes;
+                        // txXXX are updated by the transmitter
+                        AbstractPort::PortStats txStats;
 
-                        pkts = txPkts - lastTxPkts;
-                        bytes = txBytes - lastTxBytes;
+                        externalStats_->read(&txStats);
+                        pkts = txStats.txPkts - lastTxPkts;
+                        bytes = txStats.txBytes - lastTxBytes;
 
-                        lastTxPkts = txPkts;
-                        lastTxBytes = txBytes;
+                        lastTxPkts = txStats.txPkts;
+                        lastTxBytes = txStats.txBytes;
+                    }
+                    stats = stats_->beginUpdate();
+                    if (isDirectional())
+                    {
+                        stats->txPkts += pkts;
+                        stats->txBytes += bytes;
                     }
-                    stats_->txPps = (pkts  * 1000000) / usec;
-                    stats_->txBps = (bytes * 1000000) / usec;
+                    stats->txPps = (pkts  * 1000000) / usec;
+                    stats->txBps = (bytes * 1000000) / usec;
+                    stats_->endUpdate();
                     break;
 
                 default:
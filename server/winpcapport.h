@@ -43,7 +43,7 @@ protected:
     {
     public:
         PortMonitor(const char *device, Direction direction,
-                AbstractPort::PortStats *stats);
+                AbstractPort::StatsBlock *stats);
         void run();
     };
 private:
@@ -1,15 +1,21 @@
 
+#include "frametemplate.h"
+#include "ip4.pb.h"
+#include "mac.pb.h"
 #include "ostprotolib.h"
 #include "pcapfileformat.h"
 #include "protocol.pb.h"
 #include "protocolmanager.h"
 #include "settings.h"
+#include "streambase.h"
 
 #include <QCoreApplication>
 #include <QFile>
 #include <QSettings>
 #include <QString>
 
+#include <string.h>
+
 extern ProtocolManager *OstProtocolManager;
 
 QSettings *appSettings;
@@ -26,6 +32,7 @@ int usage(int /*argc*/, char* argv[])
     printf("%s <command>\n", argv[0]);
     printf("command -\n");
     printf("  importpcap\n");
+    printf("  frametemplate\n");
 
     return 255;
 }
@@ -58,6 +65,144 @@ int testImportPcap(int argc, char* argv[])
     return 0;
 }
 
+/*
+ Compares the frames generated from the frame template of the stream with
+ those generated by the stream itself for every frame index up to and past
+ the count of all the varying fields; returns the number of mismatches
+*/
+static int compareFrameTemplate(const OstProto::Stream &config,
+        const QString &desc)
+{
+    const int kBufMaxSize = 2048;
+    StreamBase stream;
+    FrameTemplate frameTemplate;
+    uchar slow[kBufMaxSize];
+    uchar fast[kBufMaxSize];
+    int frameCount;
+    int mismatches = 0;
+
+    stream.protoDataCopyFrom(config);
+
+    if (!frameTemplate.compile(&stream, kBufMaxSize))
+    {
+        printf("FAIL %s: template not compiled\n", qPrintable(desc));
+        return 1;
+    }
+
+    frameCount = 2*stream.frameVariableCount() + 1;
+    for (int i = 0; i < frameCount; i++)
+    {
+        int slowLen = stream.frameValue(slow, kBufMaxSize, i);
+        int fastLen = frameTemplate.frameValue(fast, kBufMaxSize, i);
+
+        if ((slowLen != fastLen) || memcmp(slow, fast, slowLen))
+        {
+            int offset = 0;
+
+            while ((offset < qMin(slowLen, fastLen))
+                    && (slow[offset] == fast[offset]))
+                offset++;
+            printf("FAIL %s: frame %d differs at offset %d (len %d/%d)\n",
+                    qPrintable(desc), i, offset, slowLen, fastLen);
+            if (++mismatches >= 3)
+                break;
+        }
+    }
+
+    return mismatches;
+}
+
+int testFrameTemplate(int argc, char* argv[])
+{
+    const OstProto::Mac::MacAddrMode macModes[] = {
+        OstProto::Mac::e_mm_fixed,
+        OstProto::Mac::e_mm_inc,
+        OstProto::Mac::e_mm_dec
+    };
+    const OstProto::Ip4::IpAddrMode ipModes[] = {
+        OstProto::Ip4::e_im_fixed,
+        OstProto::Ip4::e_im_inc_host,
+        OstProto::Ip4::e_im_dec_host
+    };
+    const char *modeNames[] = { "fixed", "inc", "dec" };
+    const struct {
+        int protocolId;
+        const char *name;
+    } l4s[] = {
+        { OstProto::Protocol::kTcpFieldNumber, "tcp" },
+        { OstProto::Protocol::kUdpFieldNumber, "udp" },
+        { OstProto::Protocol::kIcmpFieldNumber, "icmp" }
+    };
+    int cases = 0;
+    int failures = 0;
+
+    if (argc != 2)
+    {
+        printf("usage:\n");
+        printf("%s frametemplate\n", argv[0]);
+        return 255;
+    }
+
+    // Counts are co-prime and the start values close to a byte boundary
+    // so that the fields wrap around and carry at different frames
+    for (int dm = 0; dm < 3; dm++)
+    for (int sm = 0; sm < 3; sm++)
+    for (int si = 0; si < 3; si++)
+    for (int di = 0; di < 3; di++)
+    for (uint l = 0; l < sizeof(l4s)/sizeof(l4s[0]); l++)
+    {
+        OstProto::Stream s;
+        OstProto::Protocol *p;
+
+        s.mutable_stream_id()->set_id(1);
+        s.mutable_core()->set_is_enabled(true);
+        s.mutable_core()->set_frame_len(128);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kMacFieldNumber);
+        OstProto::Mac *mac = p->MutableExtension(OstProto::mac);
+        mac->set_dst_mac(0x0011223344feULL);
+        mac->set_dst_mac_mode(macModes[dm]);
+        mac->set_dst_mac_count(3);
+        mac->set_dst_mac_step(5);
+        mac->set_src_mac(0x00aabbccdd01ULL);
+        mac->set_src_mac_mode(macModes[sm]);
+        mac->set_src_mac_count(4);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kEth2FieldNumber);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kIp4FieldNumber);
+        OstProto::Ip4 *ip4 = p->MutableExtension(OstProto::ip4);
+        ip4->set_src_ip(0x0a0001fd);
+        ip4->set_src_ip_mode(ipModes[si]);
+        ip4->set_src_ip_count(5);
+        ip4->set_src_ip_mask(0xfffffe00);
+        ip4->set_dst_ip(0xc0a80102);
+        ip4->set_dst_ip_mode(ipModes[di]);
+        ip4->set_dst_ip_count(7);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(l4s[l].protocolId);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kPayloadFieldNumber);
+
+        cases++;
+        if (compareFrameTemplate(s, QString("mac %1/%2 ip4 %3/%4 %5")
+                    .arg(modeNames[dm]).arg(modeNames[sm])
+                    .arg(modeNames[si]).arg(modeNames[di])
+                    .arg(l4s[l].name)))
+            failures++;
+    }
+
+    printf("%d of %d cases failed\n", failures, cases);
+
+    return failures ? 1 : 0;
+}
+
 int main(int argc, char* argv[])
 {
     QCoreApplication app(argc, argv);
@@ -100,6 +245,8 @@ int main(int argc, char* argv[])
         exitCode = usage(argc, argv);
     else if (strcmp(argv[1],"importpcap") == 0)
         exitCode = testImportPcap(argc, argv);
+    else if (strcmp(argv[1],"frametemplate") == 0)
+        exitCode = testFrameTemplate(argc, argv);
     else
         exitCode = usage(argc, argv);
 
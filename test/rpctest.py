@@ -3,9 +3,12 @@
 # standard modules
 import logging
 import os
+import socket
+import struct
 import subprocess
 import sys
 import time
+import zlib
 
 sys.path.insert(1, '../binding')
 from core import ost_pb, DroneProxy
@@ -59,10 +62,20 @@ class TestSuite:
     def passed(self):
         return passed == total and self.completed
 
+def recv_all(sock, n):
+    buf = b''
+    while len(buf) < n:
+        chunk = sock.recv(n - len(buf))
+        if not chunk:
+            raise Exception('connection closed by drone')
+        buf = buf + chunk
+    return buf
+
 # initialize defaults
 host_name = '127.0.0.1'
 tx_port_number = -1
 rx_port_number = -1 
+test_port_number = -1
 drone_version = ['0', '0', '0']
 
 if sys.platform == 'win32':
@@ -207,6 +220,92 @@ try:
         drone.proxy_version = None
         suite.test_end(passed)
 
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify a client that asks for pipelining in checkVersion()
+    #           can send several RPCs back to back and gets each reply
+    #           with the request id of its request
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('pipelinedRpcsAreRepliedWithTheirRequestIds')
+    sock = socket.create_connection((drone.host, drone.port))
+    try:
+        service = ost_pb.OstService.GetDescriptor()
+        ver = ost_pb.VersionInfo()
+        ver.version = '.'.join(drone_version)
+        ver.max_pending_rpcs = 8
+        req = ver.SerializeToString()
+        sock.sendall(struct.pack('>HHI', 1,
+            service.FindMethodByName('checkVersion').index, len(req)) + req)
+        (msg_type, method, resp_len) = struct.unpack('>HHI',
+                recv_all(sock, 8))
+        compat = ost_pb.VersionCompatibility()
+        compat.ParseFromString(recv_all(sock, resp_len))
+        log.info('max pending rpcs = %d' % compat.max_pending_rpcs)
+
+        # all 4 requests are sent before reading any reply
+        method = service.FindMethodByName('getPortIdList').index
+        req_ids = [100, 101, 102, 103]
+        for req_id in req_ids:
+            sock.sendall(struct.pack('>HHII', 1, method, 0, req_id))
+        reply_ids = []
+        for req_id in req_ids:
+            (msg_type, reply_method, resp_len, reply_id) = struct.unpack(
+                    '>HHII', recv_all(sock, 12))
+            recv_all(sock, resp_len)
+            if msg_type == 2 and reply_method == method:
+                reply_ids.append(reply_id)
+        log.info('reply ids = %s' % reply_ids)
+        passed = (compat.max_pending_rpcs > 1 
+                and sorted(reply_ids) == req_ids)
+    finally:
+        sock.close()
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify the first push after subscribeStats() has the stats
+    #           of all ports
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('subscribeStatsPushesAllStatsFirst')
+    sock = socket.create_connection((drone.host, drone.port), 10)
+    try:
+        service = ost_pb.OstService.GetDescriptor()
+        ver = ost_pb.VersionInfo()
+        ver.version = '.'.join(drone_version)
+        req = ver.SerializeToString()
+        sock.sendall(struct.pack('>HHI', 1,
+            service.FindMethodByName('checkVersion').index, len(req)) + req)
+        (msg_type, method, resp_len) = struct.unpack('>HHI', 
+                recv_all(sock, 8))
+        recv_all(sock, resp_len)
+
+        method = service.FindMethodByName('subscribeStats').index
+        sub = ost_pb.StatsSubscription()
+        sub.interval_msec = 200
+        req = sub.SerializeToString()
+        sock.sendall(struct.pack('>HHI', 1, method, len(req)) + req)
+        (msg_type, reply_method, resp_len) = struct.unpack('>HHI', 
+                recv_all(sock, 8))
+        recv_all(sock, resp_len)
+        if msg_type != 2:
+            raise Exception('subscribeStats failed')
+
+        # the first push has all ports, each with all counters - later
+        # ones are sent only if something changed, so aren't waited for
+        (msg_type, push_method, push_len) = struct.unpack('>HHI', 
+                recv_all(sock, 8))
+        stats = ost_pb.PortStatsList()
+        stats.ParseFromString(recv_all(sock, push_len))
+        log.info('push: type %d method %d ports %d' % (msg_type,
+                push_method, len(stats.port_stats)))
+        passed = (msg_type == 5 and push_method == method
+                and len(stats.port_stats) > 0
+                and all(s.HasField('rx_pkts') and s.HasField('tx_pkts')
+                        for s in stats.port_stats))
+    finally:
+        sock.close()
+        suite.test_end(passed)
+
     # ----------------------------------------------------------------- #
     # Baseline Configuration for subsequent testcases
     # ----------------------------------------------------------------- #
@@ -237,6 +336,10 @@ try:
         if ('lo' in port.name or 'loopback' in port.description.lower()):
             tx_port_number = port.port_id.id
             rx_port_number = port.port_id.id
+        # a virtual port, if any, is safe to use as another tx port
+        elif (port.name.startswith('veth') or port.name.startswith('dummy')) \
+                and test_port_number < 0:
+            test_port_number = port.port_id.id
 
     if tx_port_number < 0 or rx_port_number < 0:
         log.warning('loopback port not found')
@@ -536,6 +639,298 @@ try:
         drone.stopTransmit(tx_port)
         suite.test_end(passed)
 
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify getCaptureChunk() while capture is on returns the
+    #           capture incrementally and the chunks put together are
+    #           the same as the capture buffer
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('getCaptureChunkTailsLiveCapture')
+    try:
+        req = ost_pb.CaptureChunkRequest()
+        req.port_id.CopyFrom(rx_port.port_id[0])
+        req.max_length = 4096
+        req.compress = True
+        tail = ''
+        live_chunks = 0
+
+        drone.startCapture(rx_port)
+        drone.startTransmit(tx_port)
+        log.info('tailing capture while transmit is on ...')
+        while True:
+            req.offset = len(tail)
+            chunk = drone.getCaptureChunk(req)
+            if chunk.offset != len(tail):
+                raise Exception('unexpected chunk offset %d (expected %d)'
+                        % (chunk.offset, len(tail)))
+            data = chunk.data
+            if chunk.is_compressed:
+                data = zlib.decompress(data[4:])
+            tail += data
+            if len(data) and chunk.is_capture_on:
+                live_chunks += 1
+            if not chunk.is_capture_on and len(tail) >= chunk.total_size:
+                break
+            if not len(data):
+                time.sleep(1)
+                stats = drone.getStats(tx_port)
+                if not stats.port_stats[0].state.is_transmit_on:
+                    drone.stopCapture(rx_port)
+        log.info('got %d bytes, %d chunks while capture was on'
+                % (len(tail), live_chunks))
+
+        buff = drone.getCaptureBuffer(rx_port.port_id[0])
+        if tail == buff and live_chunks > 1:
+            passed = True
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(tx_port)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify per stream stats of a stream with track_stats set
+    #           account for all its packets on both tx and rx side
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('streamStatsTrackAllPackets')
+    port_cfg = ost_pb.PortConfigList()
+    port_cfg.port.add().port_id.CopyFrom(rx_port.port_id[0])
+    try:
+        port_cfg.port[0].is_tracking_stream_stats = True
+        drone.modifyPort(port_cfg)
+
+        # leave room for the signature after the protocol headers
+        s.core.frame_len = 128
+        s.control.num_packets = 10
+        s.control.track_stats = True
+        drone.modifyStream(stream_cfg)
+
+        drone.clearStreamStats(tx_port)
+        drone.clearStreamStats(rx_port)
+        drone.startTransmit(tx_port)
+        log.info('waiting for transmit to finish ...')
+        time.sleep(12)
+        drone.stopTransmit(tx_port)
+
+        tx = rx = None
+        for ss in drone.getStreamStats(tx_port).stream_stats:
+            if ss.stream_id.id == s.stream_id.id and ss.tx_pkts:
+                tx = ss
+        for ss in drone.getStreamStats(rx_port).stream_stats:
+            if (ss.stream_id.id == s.stream_id.id
+                    and ss.tx_port_id.id == tx_port_number and ss.rx_pkts):
+                rx = ss
+        log.info('tx: %s rx: %s' % (tx, rx))
+        if (tx and rx and tx.tx_pkts == 10 and rx.rx_pkts == 10
+                and rx.rx_lost == 0 and rx.rx_duplicates == 0
+                and rx.latency_histogram.count == 10
+                and rx.latency_histogram.p50 <= rx.latency_max):
+            passed = True
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(tx_port)
+        port_cfg.port[0].is_tracking_stream_stats = False
+        drone.modifyPort(port_cfg)
+        s.control.track_stats = False
+        drone.modifyStream(stream_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify the stream stats signature leaves the UDP checksum
+    #           of tracked frames valid
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('streamStatsSignatureKeepsChecksumValid')
+    try:
+        s.core.frame_len = 128
+        s.control.num_packets = 10
+        s.control.track_stats = True
+        drone.modifyStream(stream_cfg)
+
+        drone.startCapture(rx_port)
+        drone.startTransmit(tx_port)
+        log.info('waiting for transmit to finish ...')
+        time.sleep(12)
+        drone.stopTransmit(tx_port)
+        drone.stopCapture(rx_port)
+
+        buff = drone.getCaptureBuffer(rx_port.port_id[0])
+        drone.saveCaptureBuffer(buff, 'capture.pcap')
+        log.info('dumping Rx capture buffer (good UDP checksums only)')
+        cap_pkts = subprocess.check_output([tshark, '-r', 'capture.pcap',
+            '-o', 'udp.check_checksum:TRUE',
+            '-Y', 'udp.checksum.status == 1'])
+        print(cap_pkts)
+        if cap_pkts.count('\n') == 10:
+            passed = True
+        os.remove('capture.pcap')
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(tx_port)
+        s.control.track_stats = False
+        drone.modifyStream(stream_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify applyPortConfig() replaces all streams of a port in
+    #           one go and changes nothing if any port in it is invalid
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('applyPortConfigReplacesStreamsAtomically')
+    try:
+        apply_cfg = ost_pb.PortStreamsConfigList()
+        cfg = apply_cfg.port.add()
+        cfg.port_id.CopyFrom(tx_port.port_id[0])
+        cfg.replace_streams = True
+        for i in range(1000):
+            st = cfg.stream.add()
+            st.CopyFrom(s)
+            st.stream_id.id = 100 + i
+        start = time.time()
+        drone.applyPortConfig(apply_cfg)
+        log.info('applied 1000 streams in %.3f secs' % (time.time() - start))
+        count = len(drone.getStreamIdList(tx_port.port_id[0]).stream_id)
+
+        # an invalid port fails the whole request
+        bad_cfg = apply_cfg.port.add()
+        bad_cfg.port_id.id = 0xffff
+        del cfg.stream[:]
+        try:
+            drone.applyPortConfig(apply_cfg)
+            failed = False
+        except RpcError as e:
+            failed = 'invalid port id' in str(e)
+        count_after = len(drone.getStreamIdList(
+                    tx_port.port_id[0]).stream_id)
+        log.info('stream count %d; after invalid apply %d' 
+                % (count, count_after))
+        passed = (count == 1000 and failed and count_after == 1000)
+    except RpcError as e:
+            raise
+    finally:
+        # restore the original stream
+        apply_cfg = ost_pb.PortStreamsConfigList()
+        cfg = apply_cfg.port.add()
+        cfg.port_id.CopyFrom(tx_port.port_id[0])
+        cfg.replace_streams = True
+        cfg.stream.add().CopyFrom(s)
+        drone.applyPortConfig(apply_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify startTransmit() of multiple ports returns with
+    #           transmit on and no packets are lost at the start barrier -
+    #           uses a virtual (veth/dummy) port as the second port if
+    #           there is one, the loopback port twice otherwise
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('startTransmitOfMultiplePortsStartsAll')
+    ports = ost_pb.PortIdList()
+    ports.port_id.add().CopyFrom(tx_port.port_id[0])
+    if test_port_number >= 0:
+        ports.port_id.add().id = test_port_number
+        test_stream_id = ost_pb.StreamIdList()
+        test_stream_id.port_id.CopyFrom(ports.port_id[1])
+        test_stream_id.stream_id.add().id = stream_id.stream_id[0].id
+        drone.addStream(test_stream_id)
+        test_cfg = ost_pb.StreamConfigList()
+        test_cfg.port_id.CopyFrom(ports.port_id[1])
+        test_cfg.stream.add().CopyFrom(
+                drone.getStreamConfig(stream_id).stream[0])
+        drone.modifyStream(test_cfg)
+    else:
+        ports.port_id.add().CopyFrom(tx_port.port_id[0])
+    try:
+        drone.clearStats(ports)
+        drone.startTransmit(ports)
+        is_on = drone.getStats(ports).port_stats[0].state.is_transmit_on
+        log.info('waiting for transmit to finish ...')
+        time.sleep(12)
+        drone.stopTransmit(ports)
+        tx_stats = drone.getStats(ports)
+        tx_pkts = [ps.tx_pkts for ps in tx_stats.port_stats]
+        log.info('transmit on %s; tx_pkts %s' % (is_on, tx_pkts))
+        # the same port twice is started (and counted) once
+        if test_port_number >= 0:
+            passed = (is_on and tx_pkts == [10, 10])
+        else:
+            passed = (is_on and tx_pkts[0] == 10)
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(ports)
+        if test_port_number >= 0:
+            drone.deleteStream(test_stream_id)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify modifyStream() during transmit changes the rate of
+    #           none of the streams if it can't change that of all
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('modifyStreamRateDuringTransmitIsAllOrNothing')
+    try:
+        s.control.mode = ost_pb.StreamControl.e_sm_continuous
+        s.control.packets_per_sec = 100
+        drone.modifyStream(stream_cfg)
+        drone.startTransmit(tx_port)
+
+        rate_cfg = ost_pb.StreamConfigList()
+        rate_cfg.port_id.CopyFrom(tx_port.port_id[0])
+        st = rate_cfg.stream.add()
+        st.CopyFrom(s)
+        st.control.packets_per_sec = 200
+        st = rate_cfg.stream.add()
+        st.CopyFrom(s)
+        st.stream_id.id = 9999   # no such stream
+        failed = False
+        try:
+            drone.modifyStream(rate_cfg)
+        except RpcError as e:
+            failed = True
+        rate = drone.getStreamConfig(stream_id).stream[0].control \
+                    .packets_per_sec
+        log.info('modify failed %s; rate %s' % (failed, rate))
+        passed = (failed and rate == 100)
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(tx_port)
+        s.control.mode = ost_pb.StreamControl.e_sm_fixed
+        s.control.ClearField('packets_per_sec')
+        drone.modifyStream(stream_cfg)
+        suite.test_end(passed)
+
+    # ----------------------------------------------------------------- #
+    # TESTCASE: Verify startTransmit() reports the result of each port -
+    #           the rx port has no streams and so nothing to transmit
+    # ----------------------------------------------------------------- #
+    passed = False
+    suite.test_begin('startTransmitReportsResultPerPort')
+    ports = ost_pb.PortIdList()
+    ports.port_id.add().CopyFrom(tx_port.port_id[0])
+    ports.port_id.add().CopyFrom(rx_port.port_id[0])
+    ports.port_id.add().id = 9999
+    try:
+        ack = drone.startTransmit(ports)
+        results = [(r.port_id.id, r.status, r.error) for r in ack.port_result]
+        log.info('results %s' % results)
+        drone.stopTransmit(ports)
+        if (len(results) == 3
+                and results[0][1] == ost_pb.PortResult.kOk
+                and results[1][1] == ost_pb.PortResult.kFailed
+                and 'no packets' in results[1][2]
+                and results[2][1] == ost_pb.PortResult.kFailed):
+            passed = True
+    except RpcError as e:
+            raise
+    finally:
+        drone.stopTransmit(tx_port)
+        suite.test_end(passed)
+
     suite.complete()
 
     # delete streams
@@ -0,0 +1,546 @@
+#include "pcapport.h"
+#include "linuxport.h"
+#include "settings.h"
+#include "startbarrier.h"
+
+#include "mac.pb.h"
+#include "ip4.pb.h"
+#include "protocol.pb.h"
+#include "protocolmanager.h"
+#include "streambase.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QList>
+#include <QSettings>
+#include <QSharedPointer>
+#include <QVector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern ProtocolManager *OstProtocolManager;
+QSettings *appSettings;
+
+/*
+ Transmit engine microbenchmark - builds the packet list of a port for a
+ matrix of stream counts, frame sizes and number of varying fields and
+ transmits it to a null sink or using one of the transmit backends to a
+ real device (e.g. one end of a veth pair)
+
+ Alternatively (-p), starts several ports together and checks the skew
+ between their first packets
+*/
+
+struct BenchConfig
+{
+    const char *device;
+    const char *backend;    // null, pcap or (Linux only) mmsg, ring, txtime
+    int packets;    // per case, split across the streams
+    double rate;    // pps, per stream
+    int startPorts; // if non-zero, check the start skew of these many ports
+};
+
+struct BenchResult
+{
+    quint64 frames;
+    quint64 listBytes;
+    double buildFps;
+    quint64 startLatency;   // nsec
+    quint64 sent;
+    double achievedPps;
+    quint64 jitterHist[7];  // |IPG - expected IPG| in decades of nsec
+};
+
+static const char *kJitterBucketName[] = {
+    "<10ns", "<100ns", "<1us", "<10us", "<100us", "<1ms", ">=1ms"
+};
+
+/*
+ Timestamps every packet before handing it to the transmit backend (Base)
+ - or dropping it, if the sink is null
+*/
+template <class Base>
+class BenchTransmitter : public Base
+{
+public:
+    BenchTransmitter(const char *device, bool nullSink)
+        : Base(device)
+    {
+        nullSink_ = nullSink;
+        count_ = 0;
+    }
+    void clearRecords(int maxPackets) {
+        txTimes_.resize(maxPackets);
+        deadlines_.resize(maxPackets);
+        count_ = 0;
+    }
+
+    QVector<quint64> txTimes_;
+    QVector<quint64> deadlines_;
+    int count_;
+
+protected:
+    virtual int transmitPacket(const uchar *packet, int length,
+            quint64 nsecDeadline) {
+        if (count_ < txTimes_.size()) {
+            txTimes_[count_] = Base::nsecTimeStamp();
+            deadlines_[count_] = nsecDeadline;
+        }
+        count_++;
+        if (nullSink_)
+            return 0;
+        return Base::transmitPacket(packet, length, nsecDeadline);
+    }
+
+private:
+    bool nullSink_;
+};
+
+/*
+ A port (PcapPort or LinuxPort) whose transmitter is replaced by one that
+ records when each packet is sent
+*/
+template <class Port>
+class BenchPort : public Port
+{
+public:
+    BenchPort(const char *device, bool nullSink);
+
+    virtual void clearPacketList() {
+        frames_ = listBytes_ = 0;
+        Port::clearPacketList();
+    }
+    virtual bool appendToPacketList(long sec, long nsec, const uchar *packet,
+            int length) {
+        frames_++;
+        listBytes_ += sizeof(struct pcap_pkthdr) + length;
+        return Port::appendToPacketList(sec, nsec, packet, length);
+    }
+
+    void clearRecords(int maxPackets) {
+        benchTransmitter_->clearRecords(maxPackets);
+    }
+    void waitForTransmit() {
+        benchTransmitter_->wait();
+    }
+    quint64 frames() { return frames_; }
+    quint64 listBytes() { return listBytes_; }
+    const QVector<quint64>& txTimes() { return benchTransmitter_->txTimes_; }
+    const QVector<quint64>& deadlines() {
+        return benchTransmitter_->deadlines_;
+    }
+    int sent() { return benchTransmitter_->count_; }
+
+    static quint64 timeStamp() {
+        return Port::PortTransmitter::nsecTimeStamp();
+    }
+
+private:
+    typedef BenchTransmitter<typename Port::PortTransmitter> Transmitter;
+
+    Transmitter *benchTransmitter_;
+    quint64 frames_;
+    quint64 listBytes_;
+};
+
+template <>
+BenchPort<PcapPort>::BenchPort(const char *device, bool nullSink)
+    : PcapPort(0, device)
+{
+    delete transmitter_;
+    transmitter_ = benchTransmitter_ = new Transmitter(device, nullSink);
+    transmitter_->setStreamStats(&streamStats_);
+    frames_ = listBytes_ = 0;
+}
+
+#ifdef Q_OS_LINUX
+// The transmit method of the (single) worker is as per appSettings
+template <>
+BenchPort<LinuxPort>::BenchPort(const char *device, bool nullSink)
+    : LinuxPort(0, device)
+{
+    Q_ASSERT(txWorkers_.size() == 1);
+
+    delete transmitter_;
+    benchTransmitter_ = new Transmitter(device, nullSink);
+    benchTransmitter_->setStreamStats(&streamStats_);
+    benchTransmitter_->setDropStats(newStatsBlock());
+    txWorkers_[0] = benchTransmitter_;
+    transmitter_ = benchTransmitter_;
+    frames_ = listBytes_ = 0;
+}
+#endif
+
+static void addStreams(AbstractPort *port, int streamCount, int frameSize,
+        int varFields, const BenchConfig &config)
+{
+    for (int i = 0; i < streamCount; i++)
+    {
+        OstProto::Stream s;
+        OstProto::Protocol *p;
+        StreamBase *stream = new StreamBase();
+
+        s.mutable_stream_id()->set_id(i);
+        s.mutable_core()->set_is_enabled(true);
+        s.mutable_core()->set_ordinal(i);
+        s.mutable_core()->set_frame_len(frameSize);
+        s.mutable_control()->set_num_packets(config.packets/streamCount);
+        s.mutable_control()->set_packets_per_sec(config.rate);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kMacFieldNumber);
+        OstProto::Mac *mac = p->MutableExtension(OstProto::mac);
+        mac->set_dst_mac(0x001122334455ULL);
+        mac->set_src_mac(0x00aabbccdd00ULL + i);
+        if (varFields > 0)
+            mac->set_dst_mac_mode(OstProto::Mac::e_mm_inc);
+        if (varFields > 1)
+            mac->set_src_mac_mode(OstProto::Mac::e_mm_inc);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kEth2FieldNumber);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kIp4FieldNumber);
+        OstProto::Ip4 *ip4 = p->MutableExtension(OstProto::ip4);
+        ip4->set_src_ip(0x0a000001 + (i << 8));
+        ip4->set_dst_ip(0x0a640001);
+        if (varFields > 2)
+            ip4->set_src_ip_mode(OstProto::Ip4::e_im_inc_host);
+        if (varFields > 3)
+            ip4->set_dst_ip_mode(OstProto::Ip4::e_im_inc_host);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(OstProto::Protocol::kUdpFieldNumber);
+
+        p = s.add_protocol();
+        p->mutable_protocol_id()->set_id(
+                OstProto::Protocol::kPayloadFieldNumber);
+
+        stream->protoDataCopyFrom(s);
+        port->addStream(stream);
+    }
+}
+
+template <class Port>
+static void runCase(BenchPort<Port> *port, int streamCount, int frameSize,
+        int varFields, const BenchConfig &config, BenchResult &result)
+{
+    quint64 start, end;
+    int sent;
+
+    memset(&result, 0, sizeof(result));
+
+    while (port->streamCount())
+        port->deleteStream(port->streamAtIndex(0)->id());
+    addStreams(port, streamCount, frameSize, varFields, config);
+
+    // Packet list build rate and size (cold frame cache)
+    start = BenchPort<Port>::timeStamp();
+    port->updatePacketList();
+    end = BenchPort<Port>::timeStamp();
+
+    result.frames = port->frames();
+    result.listBytes = port->listBytes();
+    if (end > start)
+        result.buildFps = result.frames * 1e9 / (end - start);
+
+    // Start transmit the way the RPC server does - the packet list is
+    // rebuilt in the background while transmit is on
+    port->clearRecords(config.packets);
+    port->setDirty();
+    start = BenchPort<Port>::timeStamp();
+    port->startPacketListUpdate();
+    port->startTransmit();
+    port->waitForTransmit();
+    port->stopPacketListUpdate();
+
+    sent = qMin(port->sent(), config.packets);
+    result.sent = port->sent();
+    if (sent == 0)
+        return;
+
+    const QVector<quint64> &txTimes = port->txTimes();
+    const QVector<quint64> &deadlines = port->deadlines();
+
+    result.startLatency = txTimes[0] - start;
+    if ((sent > 1) && (txTimes[sent-1] > txTimes[0]))
+        result.achievedPps = (sent - 1) * 1e9 / (txTimes[sent-1] - txTimes[0]);
+
+    for (int i = 1; i < sent; i++)
+    {
+        qint64 ipg = txTimes[i] - txTimes[i-1];
+        qint64 expected = deadlines[i] - deadlines[i-1];
+        quint64 jitter = qAbs(ipg - expected);
+        int bucket = 0;
+
+        for (quint64 limit = 10; (jitter >= limit) && (bucket < 6);
+                limit *= 10)
+            bucket++;
+        result.jitterHist[bucket]++;
+    }
+}
+
+// Transmitters spin for the last kSpinMargin before their (common) start
+// time, so their first packets should be no more than a few usec apart
+static const quint64 kMaxStartSkew = 100000; // nsec
+
+/*
+ Starts all the ports together the way the RPC server does (see
+ MyService::startTransmit()) a few times and returns the worst skew (nsec)
+ between their first packets
+*/
+template <class Port>
+static quint64 runStartSkew(const BenchConfig &config)
+{
+    const int kRounds = 10;
+    const int kStartBarrierTimeout = 2000; // msec
+    QList<BenchPort<Port>*> ports;
+    BenchConfig skewConfig = config;
+    quint64 maxSkew = 0;
+
+    skewConfig.packets = 1000;
+    for (int i = 0; i < config.startPorts; i++)
+    {
+        BenchPort<Port> *port = new BenchPort<Port>(config.device,
+                strcmp(config.backend, "null") == 0);
+
+        addStreams(port, 1, 64, 0, skewConfig);
+        port->updatePacketList();
+        ports.append(port);
+    }
+
+    for (int round = 0; round < kRounds; round++)
+    {
+        QSharedPointer<StartBarrier> barrier(new StartBarrier);
+        quint64 first = ~quint64(0);
+        quint64 last = 0;
+
+        foreach(BenchPort<Port> *port, ports)
+        {
+            port->clearRecords(1);
+            port->armTransmit(barrier);
+        }
+        if (!barrier->waitForAll(kStartBarrierTimeout))
+            printf("# round %d: not all ports ready in %d msec\n",
+                    round, kStartBarrierTimeout);
+        barrier->release();
+
+        foreach(BenchPort<Port> *port, ports)
+        {
+            port->waitForTransmit();
+            if (port->sent() == 0)
+            {
+                printf("# round %d: a port sent nothing\n", round);
+                maxSkew = ~quint64(0);
+                goto _exit;
+            }
+            first = qMin(first, port->txTimes()[0]);
+            last = qMax(last, port->txTimes()[0]);
+        }
+
+        printf("%5d %10.1f\n", round, (last - first)/1e3);
+        fflush(stdout);
+        maxSkew = qMax(maxSkew, last - first);
+    }
+
+_exit:
+    qDeleteAll(ports);
+    return maxSkew;
+}
+
+int usage(int /*argc*/, char* argv[])
+{
+    printf("usage:\n");
+    printf("%s [-d <device>] [-b <backend>] [-n <packets>] [-r <pps>] "
+           "[-p <ports>]\n", argv[0]);
+    printf("  -d  device to transmit on (default lo)\n");
+    printf("  -b  null: packets are dropped by the transmitter (default)\n");
+    printf("      pcap: packets are sent on the device using pcap\n");
+#ifdef Q_OS_LINUX
+    printf("      mmsg: ... using sendmmsg()\n");
+    printf("      ring: ... using a PACKET_TX_RING\n");
+    printf("      txtime: ... using sendmmsg() with a SO_TXTIME launch\n"
+           "              time (needs an etf or fq qdisc on the device)\n");
+#endif
+    printf("  -n  packets per case (default 100000)\n");
+    printf("  -r  packet rate per stream (default 1000000)\n");
+    printf("  -p  instead of the benchmark, start <ports> (>= 2) ports\n"
+           "      together and fail if their first packets are more than\n"
+           "      %llu us apart\n", kMaxStartSkew/1000);
+
+    return 255;
+}
+
+static void silentMessageHandler(QtMsgType type, const char *msg)
+{
+    if (type != QtDebugMsg)
+        fprintf(stderr, "%s\n", msg);
+}
+
+template <class Port>
+static void runCases(BenchPort<Port> *port, const BenchConfig &config)
+{
+    const int streamCounts[] = { 1, 16, 64 };
+    const int frameSizes[] = { 64, 512, 1518 };
+    const int varFieldCounts[] = { 0, 1, 2, 4 };
+
+    for (uint i = 0; i < sizeof(streamCounts)/sizeof(streamCounts[0]); i++)
+    {
+        for (uint j = 0; j < sizeof(frameSizes)/sizeof(frameSizes[0]); j++)
+        {
+            for (uint k = 0;
+                    k < sizeof(varFieldCounts)/sizeof(varFieldCounts[0]); k++)
+            {
+                BenchResult r;
+
+                runCase(port, streamCounts[i], frameSizes[j],
+                        varFieldCounts[k], config, r);
+
+                printf("%7d %5d %4d %10llu %12llu %12.0f %10.1f %10llu %12.0f",
+                        streamCounts[i], frameSizes[j], varFieldCounts[k],
+                        r.frames, r.listBytes, r.buildFps,
+                        r.startLatency/1e3, r.sent, r.achievedPps);
+                for (int b = 0; b < 7; b++)
+                    printf(" %8llu", r.jitterHist[b]);
+                printf("\n");
+                fflush(stdout);
+            }
+        }
+    }
+}
+
+static bool isLinuxBackend(const char *backend)
+{
+    return (strcmp(backend, "mmsg") == 0) || (strcmp(backend, "ring") == 0)
+            || (strcmp(backend, "txtime") == 0);
+}
+
+int main(int argc, char* argv[])
+{
+    QCoreApplication app(argc, argv);
+    BenchConfig config;
+    QString settingsFile;
+    int exitCode = 0;
+
+    config.device = "lo";
+    config.backend = "null";
+    config.packets = 100000;
+    config.rate = 1000000;
+    config.startPorts = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            return usage(argc, argv);
+
+        if (strcmp(argv[i], "-d") == 0)
+            config.device = argv[++i];
+        else if (strcmp(argv[i], "-b") == 0)
+            config.backend = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0)
+            config.packets = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0)
+            config.rate = atof(argv[++i]);
+        else if (strcmp(argv[i], "-p") == 0)
+            config.startPorts = atoi(argv[++i]);
+        else
+            return usage(argc, argv);
+    }
+
+    if ((config.packets <= 0) || (config.rate <= 0)
+            || (config.startPorts == 1) || (config.startPorts < 0))
+        return usage(argc, argv);
+
+#ifdef Q_OS_LINUX
+    if ((strcmp(config.backend, "null") != 0)
+            && (strcmp(config.backend, "pcap") != 0)
+            && !isLinuxBackend(config.backend))
+        return usage(argc, argv);
+#else
+    if ((strcmp(config.backend, "null") != 0)
+            && (strcmp(config.backend, "pcap") != 0))
+        return usage(argc, argv);
+#endif
+
+    qInstallMsgHandler(silentMessageHandler);
+    OstProtocolManager = new ProtocolManager();
+
+    // LinuxPort picks its transmit method from the settings
+    appSettings = new QSettings(QDir::temp().filePath("txbench.ini"),
+                                QSettings::IniFormat);
+    appSettings->clear();
+    appSettings->setValue(kTxWorkersKey, 1);
+    if (isLinuxBackend(config.backend))
+    {
+        bool isTxTime = (strcmp(config.backend, "txtime") == 0);
+
+        appSettings->setValue(kTxMethodKey,
+                isTxTime ? "mmsg" : config.backend);
+        appSettings->setValue(kTxLaunchTimeKey, isTxTime);
+    }
+
+    if (config.startPorts)
+    {
+        quint64 skew;
+
+        printf("# device %s, backend %s, %d ports started together\n",
+                config.device, config.backend, config.startPorts);
+        printf("%5s %10s\n", "round", "skew_us");
+
+#ifdef Q_OS_LINUX
+        if (isLinuxBackend(config.backend))
+            skew = runStartSkew<LinuxPort>(config);
+        else
+#endif
+            skew = runStartSkew<PcapPort>(config);
+
+        if (skew <= kMaxStartSkew)
+            printf("# PASS: max skew %.1f us\n", skew/1e3);
+        else
+        {
+            printf("# FAIL: max skew %.1f us\n", skew/1e3);
+            exitCode = 1;
+        }
+        goto _exit;
+    }
+
+    printf("# device %s, backend %s, %d packets/case, %.0f pps/stream\n",
+            config.device, config.backend, config.packets, config.rate);
+    printf("%7s %5s %4s %10s %12s %12s %10s %10s %12s",
+            "streams", "size", "var", "frames", "list_bytes", "build_fps",
+            "start_us", "sent", "pps");
+    for (int b = 0; b < 7; b++)
+        printf(" %8s", kJitterBucketName[b]);
+    printf("\n");
+
+#ifdef Q_OS_LINUX
+    if (isLinuxBackend(config.backend))
+    {
+        BenchPort<LinuxPort> *port =
+            new BenchPort<LinuxPort>(config.device, false);
+
+        runCases(port, config);
+        delete port;
+    }
+    else
+#endif
+    {
+        BenchPort<PcapPort> *port = new BenchPort<PcapPort>(config.device,
+                strcmp(config.backend, "null") == 0);
+
+        runCases(port, config);
+        delete port;
+    }
+
+_exit:
+    settingsFile = appSettings->fileName();
+    delete appSettings;
+    QFile::remove(settingsFile);
+    delete OstProtocolManager;
+
+    return exitCode;
+}
@@ -0,0 +1,39 @@
+TEMPLATE = app
+CONFIG += qt console
+QT += network script
+QT -= gui
+TARGET = txbench
+DEFINES += HAVE_REMOTE WPCAP
+linux*:system(grep -q IFLA_STATS64 /usr/include/linux/if_link.h): \
+    DEFINES += HAVE_IFLA_STATS64
+INCLUDEPATH += "../rpc/" "../common/" "../server/"
+win32 {
+    LIBS += -lwpcap -lpacket
+    CONFIG(debug, debug|release) {
+        LIBS += -L"../common/debug" -lostproto
+        POST_TARGETDEPS += "../common/debug/libostproto.a"
+    } else {
+        LIBS += -L"../common/release" -lostproto
+        POST_TARGETDEPS += "../common/release/libostproto.a"
+    }
+} else {
+    LIBS += -lpcap
+    LIBS += -L"../common" -lostproto
+    POST_TARGETDEPS += "../common/libostproto.a"
+}
+LIBS += -lm
+LIBS += -lprotobuf
+
+HEADERS += 
+SOURCES += txbench.cpp
+SOURCES += \
+    ../server/abstractport.cpp \
+    ../server/latencyhistogram.cpp \
+    ../server/ratemeter.cpp \
+    ../server/startbarrier.cpp \
+    ../server/streamstats.cpp \
+    ../server/pcapport.cpp \
+    ../server/pcapextra.cpp
+linux*:SOURCES += ../server/linuxport.cpp
+
+QMAKE_DISTCLEAN += object_script.*